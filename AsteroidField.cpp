@@ -0,0 +1,202 @@
+#include "AsteroidField.h"
+#include <emmintrin.h>
+#include <math.h>
+
+using namespace DirectX;
+
+static const float TWO_PI = 6.28318531f;
+
+AsteroidField::AsteroidField(int capacity, float halfSize)
+{
+	this->capacity = capacity;
+	this->halfSize = halfSize;
+	count = 0;
+
+	// Padding slots stay free with zero radius and never move
+	int padded = (capacity + 3) & ~3;
+	spheres.x.resize(padded, 0.0f);
+	spheres.y.resize(padded, 0.0f);
+	spheres.z.resize(padded, 0.0f);
+	spheres.radius.resize(padded, 0.0f);
+	velocityX.resize(padded, 0.0f);
+	velocityY.resize(padded, 0.0f);
+	velocityZ.resize(padded, 0.0f);
+	spinAngle.resize(padded, 0.0f);
+	spinRate.resize(padded, 0.0f);
+	spinAxisX.resize(padded, 0.0f);
+	spinAxisY.resize(padded, 1.0f);
+	spinAxisZ.resize(padded, 0.0f);
+	baseOrientation.resize(padded, XMFLOAT4(0, 0, 0, 1));
+	state.resize(padded, ASTEROID_FREE);
+
+	// Lowest index comes off the back first
+	freeSlots.reserve(capacity);
+	for (int i = capacity - 1; i >= 0; i--)
+		freeSlots.push_back(i);
+}
+
+int AsteroidField::Spawn(const XMFLOAT3& position, const XMFLOAT3& velocity, const XMFLOAT4& orientation, const XMFLOAT3& spin, float radius)
+{
+	if (freeSlots.empty())
+		return -1;
+
+	int index = freeSlots.back();
+	freeSlots.pop_back();
+
+	spheres.radius[index] = radius;
+	state[index] = ASTEROID_PROMOTED;
+	Demote(index, position, velocity, orientation, spin);
+	count++;
+	return index;
+}
+
+void AsteroidField::Remove(int index)
+{
+	if (state[index] == ASTEROID_FREE)
+		return;
+
+	state[index] = ASTEROID_FREE;
+	velocityX[index] = velocityY[index] = velocityZ[index] = 0.0f;
+	spinRate[index] = 0.0f;
+	freeSlots.push_back(index);
+	count--;
+}
+
+void AsteroidField::Promote(int index)
+{
+	if (state[index] == ASTEROID_OWNED)
+		state[index] = ASTEROID_PROMOTED;
+}
+
+void AsteroidField::Demote(int index, const XMFLOAT3& position, const XMFLOAT3& velocity, const XMFLOAT4& orientation, const XMFLOAT3& spin)
+{
+	if (state[index] != ASTEROID_PROMOTED)
+		return;
+
+	spheres.x[index] = position.x;
+	spheres.y[index] = position.y;
+	spheres.z[index] = position.z;
+	velocityX[index] = velocity.x;
+	velocityY[index] = velocity.y;
+	velocityZ[index] = velocity.z;
+
+	// A spinning body turns about a fixed axis, so the angle is all that
+	// changes from here on
+	float rate = sqrtf(spin.x * spin.x + spin.y * spin.y + spin.z * spin.z);
+	if (rate > 0)
+	{
+		spinAxisX[index] = spin.x / rate;
+		spinAxisY[index] = spin.y / rate;
+		spinAxisZ[index] = spin.z / rate;
+	}
+	spinRate[index] = rate;
+	spinAngle[index] = 0.0f;
+	baseOrientation[index] = orientation;
+
+	state[index] = ASTEROID_OWNED;
+}
+
+// Slots that aren't owned still get integrated, it's cheaper than masking
+// them out and their motion is reset before they're used again
+void AsteroidField::Update(float deltaTime)
+{
+	__m128 dt = _mm_set1_ps(deltaTime);
+	__m128 high = _mm_set1_ps(halfSize);
+	__m128 low = _mm_set1_ps(-halfSize);
+	__m128 size = _mm_set1_ps(2.0f * halfSize);
+	__m128 turn = _mm_set1_ps(TWO_PI);
+
+	float* x = &spheres.x[0];
+	float* y = &spheres.y[0];
+	float* z = &spheres.z[0];
+
+	int padded = (int)spheres.x.size();
+	for (int i = 0; i < padded; i += 4)
+	{
+		__m128 px = _mm_add_ps(_mm_loadu_ps(x + i), _mm_mul_ps(_mm_loadu_ps(&velocityX[i]), dt));
+		__m128 py = _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(_mm_loadu_ps(&velocityY[i]), dt));
+		__m128 pz = _mm_add_ps(_mm_loadu_ps(z + i), _mm_mul_ps(_mm_loadu_ps(&velocityZ[i]), dt));
+
+		// Out one side, in the other
+		px = _mm_add_ps(_mm_sub_ps(px, _mm_and_ps(_mm_cmpgt_ps(px, high), size)), _mm_and_ps(_mm_cmplt_ps(px, low), size));
+		py = _mm_add_ps(_mm_sub_ps(py, _mm_and_ps(_mm_cmpgt_ps(py, high), size)), _mm_and_ps(_mm_cmplt_ps(py, low), size));
+		pz = _mm_add_ps(_mm_sub_ps(pz, _mm_and_ps(_mm_cmpgt_ps(pz, high), size)), _mm_and_ps(_mm_cmplt_ps(pz, low), size));
+
+		_mm_storeu_ps(x + i, px);
+		_mm_storeu_ps(y + i, py);
+		_mm_storeu_ps(z + i, pz);
+
+		// Keep the angle small so it doesn't lose precision over a long session
+		__m128 angle = _mm_add_ps(_mm_loadu_ps(&spinAngle[i]), _mm_mul_ps(_mm_loadu_ps(&spinRate[i]), dt));
+		angle = _mm_sub_ps(angle, _mm_and_ps(_mm_cmpgt_ps(angle, turn), turn));
+		_mm_storeu_ps(&spinAngle[i], angle);
+	}
+}
+
+float AsteroidField::RayCast(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, int& index)
+{
+	__m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+	__m128 dx = _mm_set1_ps(direction.x), dy = _mm_set1_ps(direction.y), dz = _mm_set1_ps(direction.z);
+	__m128 zero = _mm_setzero_ps();
+
+	index = -1;
+	float closest = maxDistance;
+
+	int padded = (int)spheres.x.size();
+	for (int i = 0; i < padded; i += 4)
+	{
+		__m128 cx = _mm_sub_ps(_mm_loadu_ps(&spheres.x[i]), ox);
+		__m128 cy = _mm_sub_ps(_mm_loadu_ps(&spheres.y[i]), oy);
+		__m128 cz = _mm_sub_ps(_mm_loadu_ps(&spheres.z[i]), oz);
+		__m128 r = _mm_loadu_ps(&spheres.radius[i]);
+
+		// Closest approach along the ray, and how far either side of it
+		// the ray is inside the sphere
+		__m128 along = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, dx), _mm_mul_ps(cy, dy)), _mm_mul_ps(cz, dz));
+		__m128 centerSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, cx), _mm_mul_ps(cy, cy)), _mm_mul_ps(cz, cz));
+		__m128 halfChordSq = _mm_sub_ps(_mm_mul_ps(r, r), _mm_sub_ps(centerSq, _mm_mul_ps(along, along)));
+		__m128 halfChord = _mm_sqrt_ps(_mm_max_ps(halfChordSq, zero));
+
+		// Entry point, or zero if the ray starts inside
+		__m128 t = _mm_max_ps(_mm_sub_ps(along, halfChord), zero);
+		__m128 hit = _mm_and_ps(_mm_cmpge_ps(halfChordSq, zero), _mm_cmpge_ps(_mm_add_ps(along, halfChord), zero));
+		hit = _mm_and_ps(hit, _mm_cmplt_ps(t, _mm_set1_ps(closest)));
+
+		int mask = _mm_movemask_ps(hit);
+		if (mask == 0)
+			continue;
+
+		float distances[4];
+		_mm_storeu_ps(distances, t);
+		for (int lane = 0; lane < 4; lane++)
+		{
+			if ((mask & (1 << lane)) && state[i + lane] == ASTEROID_OWNED && distances[lane] < closest)
+			{
+				closest = distances[lane];
+				index = i + lane;
+			}
+		}
+	}
+	return index >= 0 ? closest : -1.0f;
+}
+
+// Spin quaternion times the base orientation, so the base is applied first
+XMFLOAT4 AsteroidField::GetOrientation(int index)
+{
+	float half = spinAngle[index] * 0.5f;
+	float s = sinf(half);
+	XMFLOAT4 p(spinAxisX[index] * s, spinAxisY[index] * s, spinAxisZ[index] * s, cosf(half));
+	const XMFLOAT4& q = baseOrientation[index];
+
+	return XMFLOAT4(
+		p.w * q.x + q.w * p.x + p.y * q.z - p.z * q.y,
+		p.w * q.y + q.w * p.y + p.z * q.x - p.x * q.z,
+		p.w * q.z + q.w * p.z + p.x * q.y - p.y * q.x,
+		p.w * q.w - p.x * q.x - p.y * q.y - p.z * q.z);
+}
+
+XMFLOAT3 AsteroidField::GetSpin(int index)
+{
+	float rate = spinRate[index];
+	return XMFLOAT3(spinAxisX[index] * rate, spinAxisY[index] * rate, spinAxisZ[index] * rate);
+}
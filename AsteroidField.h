@@ -0,0 +1,83 @@
+#pragma once
+
+#include <vector>
+#include <DirectXMath.h>
+#include "FrustumCuller.h"
+
+// --------------------------------------------------------
+// Background asteroid field simulated outside Bullet.
+//
+// Asteroids here only drift in a straight line and spin
+// about a fixed axis, so tens of thousands of them can be
+// integrated with SSE over structure-of-arrays storage and
+// never touch the physics world.  The field is a cube
+// centred on the origin; anything drifting out of one side
+// comes back in the other.
+//
+// An asteroid that needs to collide (near the player or a
+// projectile) is promoted: the field stops showing it and
+// the game gives it a real rigid body.  When that body is
+// far enough away again the game demotes it, handing its
+// current motion back to the field.
+// --------------------------------------------------------
+class AsteroidField
+{
+public:
+	AsteroidField(int capacity, float halfSize);
+
+	// spin is an angular velocity, axis times radians per second.  Returns
+	// the asteroid's index, or -1 if the field is full.
+	int Spawn(const DirectX::XMFLOAT3& position, const DirectX::XMFLOAT3& velocity, const DirectX::XMFLOAT4& orientation, const DirectX::XMFLOAT3& spin, float radius);
+	void Remove(int index);
+
+	// Drift and spin every asteroid the field owns
+	void Update(float deltaTime);
+
+	// Distance along the ray to the nearest field-owned asteroid it hits,
+	// or -1 for a miss.  direction must be normalized.
+	float RayCast(const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float maxDistance, int& index);
+
+	// Hands an asteroid to a rigid body, and takes it back with the motion
+	// the body ended up with.  Read the motion before promoting, a promoted
+	// asteroid's slot goes stale.
+	void Promote(int index);
+	void Demote(int index, const DirectX::XMFLOAT3& position, const DirectX::XMFLOAT3& velocity, const DirectX::XMFLOAT4& orientation, const DirectX::XMFLOAT3& spin);
+
+	// Only asteroids the field owns should be drawn from it
+	bool IsOwned(int index) { return state[index] == ASTEROID_OWNED; }
+	int GetCapacity() { return capacity; }
+	int GetCount() { return count; }
+
+	DirectX::XMFLOAT3 GetPosition(int index) { return DirectX::XMFLOAT3(spheres.x[index], spheres.y[index], spheres.z[index]); }
+	DirectX::XMFLOAT3 GetVelocity(int index) { return DirectX::XMFLOAT3(velocityX[index], velocityY[index], velocityZ[index]); }
+	DirectX::XMFLOAT4 GetOrientation(int index);
+	DirectX::XMFLOAT3 GetSpin(int index);
+	float GetRadius(int index) { return spheres.radius[index]; }
+
+	// Positions and radii of every slot, for the culling and LOD passes.
+	// Slots that aren't owned are in here too, skip them with IsOwned().
+	const BoundingSphereList& GetBounds() { return spheres; }
+
+private:
+	enum AsteroidState
+	{
+		ASTEROID_FREE,			// Empty slot
+		ASTEROID_OWNED,			// Simulated and drawn by the field
+		ASTEROID_PROMOTED		// Handed to a rigid body
+	};
+
+	int capacity;
+	int count;
+	float halfSize;
+
+	// Padded to a multiple of four so the SSE loops need no tail.
+	// Orientation is the spin about spinAxis by spinAngle applied
+	// after baseOrientation.
+	BoundingSphereList spheres;
+	std::vector<float> velocityX, velocityY, velocityZ;
+	std::vector<float> spinAngle, spinRate;
+	std::vector<float> spinAxisX, spinAxisY, spinAxisZ;
+	std::vector<DirectX::XMFLOAT4> baseOrientation;
+	std::vector<unsigned char> state;
+	std::vector<int> freeSlots;
+};
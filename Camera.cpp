@@ -1,4 +1,5 @@
 #include "Camera.h"
+#include "FrustumCuller.h"
 #include <Windows.h>
 
 using namespace DirectX;
@@ -13,6 +14,9 @@ Camera::Camera(float x, float y, float z, bool _cameraMove) {
 	cameraMove = _cameraMove;
 	XMStoreFloat4x4(&viewMatrix, XMMatrixIdentity());
 	XMStoreFloat4x4(&projMatrix, XMMatrixIdentity());
+	viewDirty = true;
+	derivedDirty = true;
+	version = 0;
 }
 
 // Nothing to really do
@@ -28,6 +32,7 @@ void Camera::MoveRelative(float x, float y, float z) {
 	XMStoreFloat3(&cameraDirection, dir);
 	// Move in that direction
 	XMStoreFloat3(&position, XMLoadFloat3(&position) + dir);
+	viewDirty = true;
 }
 
 // Moves the camera in world space (not local space)
@@ -36,6 +41,7 @@ void Camera::MoveAbsolute(float x, float y, float z) {
 	position.x += x;
 	position.y += y;
 	position.z += z;
+	viewDirty = true;
 }
 
 // Rotate on the X and/or Y axis
@@ -49,36 +55,39 @@ void Camera::Rotate(float x, float y) {
 
 	// Recreate the quaternion
 	XMStoreFloat4(&rotation, XMQuaternionRotationRollPitchYaw(xRotation, yRotation, 0));
+	viewDirty = true;
 }
 
 // Camera's update, which looks for key presses
-void Camera::Update(float dt) {
+void Camera::Update(float dt, const InputSnapshot& input) {
 	 if(cameraMove == true){
 	// Current speed
 		float speed = dt * 3;
 
 		// Speed up or down as necessary
-		if (GetAsyncKeyState(VK_SHIFT)) { speed *= 5; }
-		if (GetAsyncKeyState(VK_CONTROL)) { speed *= 0.1f; }
+		if (input.IsDown(INPUT_SHIFT)) { speed *= 5; }
+		if (input.IsDown(INPUT_CONTROL)) { speed *= 0.1f; }
 
 		// Movement
-		if (GetAsyncKeyState('W') & 0x8000) { MoveRelative(0, 0, speed); }
-		if (GetAsyncKeyState('S') & 0x8000) { MoveRelative(0, 0, -speed); }
-		if (GetAsyncKeyState('A') & 0x8000) { MoveRelative(-speed, 0, 0); }
-		if (GetAsyncKeyState('D') & 0x8000) { MoveRelative(speed, 0, 0); }
-		if (GetAsyncKeyState('X') & 0x8000) { MoveAbsolute(0, -speed, 0); }
-		if (GetAsyncKeyState(' ') & 0x8000) { MoveAbsolute(0, speed, 0); }
+		if (input.IsDown(INPUT_W)) { MoveRelative(0, 0, speed); }
+		if (input.IsDown(INPUT_S)) { MoveRelative(0, 0, -speed); }
+		if (input.IsDown(INPUT_A)) { MoveRelative(-speed, 0, 0); }
+		if (input.IsDown(INPUT_D)) { MoveRelative(speed, 0, 0); }
+		if (input.IsDown(INPUT_X)) { MoveAbsolute(0, -speed, 0); }
+		if (input.IsDown(INPUT_SPACE)) { MoveAbsolute(0, speed, 0); }
 
 		// Check for reset
-		if (GetAsyncKeyState('R') & 0x8000) {
+		if (input.IsDown(INPUT_R)) {
 			position = startPosition;
 			xRotation = 0;
 			xRotation = 0;
 			XMStoreFloat4(&rotation, XMQuaternionIdentity());
+			viewDirty = true;
 		}
 		}
-		// Update the view every frame - could be optimized
-		UpdateViewMatrix();
+		// Only rebuild the view when something actually moved
+		if (viewDirty)
+			UpdateViewMatrix();
 	
 }
 
@@ -94,6 +103,9 @@ void Camera::UpdateViewMatrix() {
 		XMVectorSet(0, 1, 0, 0));
 
 	XMStoreFloat4x4(&viewMatrix, XMMatrixTranspose(view));
+	viewDirty = false;
+	derivedDirty = true;
+	version++;
 }
 
 // Updates the projection matrix
@@ -104,4 +116,47 @@ void Camera::UpdateProjectionMatrix(float aspectRatio) {
 		0.1f,				// Near clip plane distance
 		100.0f);			// Far clip plane distance
 	XMStoreFloat4x4(&projMatrix, XMMatrixTranspose(P)); // Transpose for HLSL!
+	derivedDirty = true;
+	version++;
+}
+
+const XMFLOAT4X4& Camera::GetViewProjection() {
+	if (derivedDirty) UpdateDerivedMatrices();
+	return viewProjMatrix;
+}
+
+const XMFLOAT4X4& Camera::GetInverseView() {
+	if (derivedDirty) UpdateDerivedMatrices();
+	return invViewMatrix;
+}
+
+const XMFLOAT4X4& Camera::GetInverseProjection() {
+	if (derivedDirty) UpdateDerivedMatrices();
+	return invProjMatrix;
+}
+
+const XMFLOAT4X4& Camera::GetInverseViewProjection() {
+	if (derivedDirty) UpdateDerivedMatrices();
+	return invViewProjMatrix;
+}
+
+const XMFLOAT4* Camera::GetFrustumPlanes() {
+	if (derivedDirty) UpdateDerivedMatrices();
+	return frustumPlanes;
+}
+
+// Everything built from view and projection, done once per change
+// instead of by every consumer
+void Camera::UpdateDerivedMatrices() {
+	XMMATRIX view = XMMatrixTranspose(XMLoadFloat4x4(&viewMatrix));
+	XMMATRIX proj = XMMatrixTranspose(XMLoadFloat4x4(&projMatrix));
+	XMMATRIX viewProj = XMMatrixMultiply(view, proj);
+
+	XMStoreFloat4x4(&viewProjMatrix, XMMatrixTranspose(viewProj));
+	XMStoreFloat4x4(&invViewMatrix, XMMatrixTranspose(XMMatrixInverse(nullptr, view)));
+	XMStoreFloat4x4(&invProjMatrix, XMMatrixTranspose(XMMatrixInverse(nullptr, proj)));
+	XMStoreFloat4x4(&invViewProjMatrix, XMMatrixTranspose(XMMatrixInverse(nullptr, viewProj)));
+	FrustumCuller::ExtractPlanes(viewProj, frustumPlanes);
+
+	derivedDirty = false;
 }
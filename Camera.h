@@ -1,5 +1,6 @@
 #pragma once
 #include <DirectXMath.h>
+#include "InputRecorder.h"
 
 
 class Camera {
@@ -13,7 +14,7 @@ public:
 	void Rotate(float x, float y);
 
 	// Updating
-	void Update(float dt);
+	void Update(float dt, const InputSnapshot& input);
 	void UpdateViewMatrix();
 	void UpdateProjectionMatrix(float aspectRatio);
 
@@ -23,13 +24,40 @@ public:
 	DirectX::XMFLOAT4X4 GetView() { return viewMatrix; }
 	DirectX::XMFLOAT4X4 GetProjection() { return projMatrix; }
 	DirectX::XMFLOAT3 cameraDirection;
+
+	// Built from view and projection on first use after either changes.
+	// Matrices are transposed for HLSL like the two above.
+	const DirectX::XMFLOAT4X4& GetViewProjection();
+	const DirectX::XMFLOAT4X4& GetInverseView();
+	const DirectX::XMFLOAT4X4& GetInverseProjection();
+	const DirectX::XMFLOAT4X4& GetInverseViewProjection();
+
+	// Left, right, bottom, top, near, far - normalized, pointing inwards
+	const DirectX::XMFLOAT4* GetFrustumPlanes();
+
+	// Bumped whenever the view or projection changes, so callers can
+	// tell whether anything they cached from the camera is stale
+	unsigned int GetVersion() { return version; }
 	
 
 private:
+	void UpdateDerivedMatrices();
+
 	// Camera matrices
 	DirectX::XMFLOAT4X4 viewMatrix;
 	DirectX::XMFLOAT4X4 projMatrix;
 
+	// Derived from the two above
+	DirectX::XMFLOAT4X4 viewProjMatrix;
+	DirectX::XMFLOAT4X4 invViewMatrix;
+	DirectX::XMFLOAT4X4 invProjMatrix;
+	DirectX::XMFLOAT4X4 invViewProjMatrix;
+	DirectX::XMFLOAT4 frustumPlanes[6];
+
+	bool viewDirty;
+	bool derivedDirty;
+	unsigned int version;
+
 	// Transformations
 	DirectX::XMFLOAT3 startPosition;
 	DirectX::XMFLOAT4 rotation;
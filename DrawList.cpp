@@ -0,0 +1,123 @@
+#include "DrawList.h"
+
+// Views rarely see anything past this, and it only decides depth precision
+static const float DEFAULT_DEPTH_RANGE = 1024.0f;
+
+DrawList::DrawList()
+{
+	depthRange = DEFAULT_DEPTH_RANGE;
+}
+
+void DrawList::Clear()
+{
+	items.clear();
+	order.clear();
+}
+
+unsigned int DrawList::GetId(std::vector<const void*>& table, const void* first, const void* second, int bits)
+{
+	for (int i = 0; i < (int)table.size(); i += 2)
+	{
+		if (table[i] == first && table[i + 1] == second)
+			return (unsigned int)(i / 2);
+	}
+
+	unsigned int maxId = (1u << bits) - 1;
+	if (table.size() / 2 >= maxId)
+		return maxId;
+
+	table.push_back(first);
+	table.push_back(second);
+	return (unsigned int)(table.size() / 2 - 1);
+}
+
+void DrawList::Add(DrawPass pass, GameEntity* entity, int lod, float depth, ID3D11ShaderResourceView* texture)
+{
+	Material* material = entity->GetMaterial();
+	unsigned long long shader = GetId(shaderIds, material->GetVertexShader(), material->GetPixelShader(), SHADER_BITS);
+	unsigned long long materialId = GetId(materialIds, material, texture, MATERIAL_BITS);
+	unsigned long long mesh = GetId(meshIds, entity->GetMesh(), 0, MESH_BITS);
+
+	unsigned int maxLod = (1u << LOD_BITS) - 1;
+	unsigned long long lodBits = lod < 0 ? 0 : ((unsigned int)lod > maxLod ? maxLod : (unsigned int)lod);
+
+	//Opaque goes front to back so the depth test rejects what's behind,
+	//transparent back to front so it blends right
+	unsigned int maxDepth = (1u << DEPTH_BITS) - 1;
+	float scaled = depth / depthRange;
+	if (scaled < 0.0f) scaled = 0.0f;
+	if (scaled > 1.0f) scaled = 1.0f;
+	unsigned long long depthBits = (unsigned int)(scaled * maxDepth);
+	if (pass == DRAW_PASS_TRANSPARENT)
+		depthBits = maxDepth - depthBits;
+
+	DrawItem item;
+	item.key = ((unsigned long long)pass << PASS_SHIFT) |
+		(shader << SHADER_SHIFT) |
+		(materialId << MATERIAL_SHIFT) |
+		(mesh << MESH_SHIFT) |
+		(lodBits << LOD_SHIFT) |
+		(depthBits << DEPTH_SHIFT);
+	item.entity = entity;
+	item.lod = lod;
+	item.texture = texture;
+
+	order.push_back((int)items.size());
+	items.push_back(item);
+}
+
+void DrawList::Sort()
+{
+	int count = (int)items.size();
+	if (count < 2)
+		return;
+
+	entries.resize(count);
+	scratch.resize(count);
+	for (int i = 0; i < count; i++)
+	{
+		entries[i].key = items[i].key;
+		entries[i].item = i;
+	}
+
+	//Histograms for all eight bytes in one read of the keys
+	int histograms[8][256] = {};
+	for (int i = 0; i < count; i++)
+	{
+		unsigned long long key = entries[i].key;
+		for (int b = 0; b < 8; b++)
+			histograms[b][(key >> (b * 8)) & 0xff]++;
+	}
+
+	//Least significant byte first.  Each pass is stable, so earlier bytes
+	//stay in order among keys that tie on this one.
+	SortEntry* source = &entries[0];
+	SortEntry* destination = &scratch[0];
+	for (int b = 0; b < 8; b++)
+	{
+		int* histogram = histograms[b];
+		if (histogram[(source[0].key >> (b * 8)) & 0xff] == count)
+			continue;	// Every key has the same byte here
+
+		int offsets[256];
+		int total = 0;
+		for (int d = 0; d < 256; d++)
+		{
+			offsets[d] = total;
+			total += histogram[d];
+		}
+
+		for (int i = 0; i < count; i++)
+		{
+			int digit = (int)((source[i].key >> (b * 8)) & 0xff);
+			destination[offsets[digit]++] = source[i];
+		}
+
+		SortEntry* swap = source;
+		source = destination;
+		destination = swap;
+	}
+
+	for (int i = 0; i < count; i++)
+		order[i] = source[i].item;
+}
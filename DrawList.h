@@ -0,0 +1,96 @@
+#pragma once
+
+#include <vector>
+#include <d3d11.h>
+#include "GameEntity.h"
+
+// Coarsest sort field first.  Transparent items sort back to front.
+enum DrawPass
+{
+	DRAW_PASS_OPAQUE = 0,
+	DRAW_PASS_TRANSPARENT = 1
+};
+
+struct DrawItem
+{
+	unsigned long long key;
+	GameEntity* entity;
+	int lod;
+	ID3D11ShaderResourceView* texture;	// In place of the material's, or 0
+};
+
+// --------------------------------------------------------
+// One frame's draws for a view, sorted so that items which
+// share render state end up next to each other.
+//
+// Every item gets a 64 bit key packing, from the top bit
+// down: pass, shader, material, mesh, LOD and quantized
+// view depth.  Shaders, materials and meshes are given
+// small ids the first time they're seen.  Sorting on the
+// whole key groups items by the most expensive state first,
+// and within the same state draws opaque items front to
+// back.
+//
+// The sort is an LSD radix sort over the key a byte at a
+// time, skipping any byte that is the same in every key.
+// --------------------------------------------------------
+class DrawList
+{
+public:
+	static const int PASS_BITS = 4;
+	static const int SHADER_BITS = 8;
+	static const int MATERIAL_BITS = 12;
+	static const int MESH_BITS = 12;
+	static const int LOD_BITS = 4;
+	static const int DEPTH_BITS = 24;
+
+	static const int DEPTH_SHIFT = 0;
+	static const int LOD_SHIFT = DEPTH_SHIFT + DEPTH_BITS;
+	static const int MESH_SHIFT = LOD_SHIFT + LOD_BITS;
+	static const int MATERIAL_SHIFT = MESH_SHIFT + MESH_BITS;
+	static const int SHADER_SHIFT = MATERIAL_SHIFT + MATERIAL_BITS;
+	static const int PASS_SHIFT = SHADER_SHIFT + SHADER_BITS;
+
+	DrawList();
+
+	// Views farther than this all quantize to the same depth
+	void SetDepthRange(float range) { depthRange = range; }
+
+	void Clear();
+
+	// depth is the item's distance from the camera.  texture, if given,
+	// is drawn instead of the material's and gets its own material id.
+	void Add(DrawPass pass, GameEntity* entity, int lod, float depth, ID3D11ShaderResourceView* texture = 0);
+
+	void Sort();
+
+	int GetCount() { return (int)items.size(); }
+
+	// In the order they were added until Sort(), then in key order
+	const DrawItem& GetItem(int i) { return items[order[i]]; }
+	const DrawItem& GetAddedItem(int i) { return items[i]; }
+
+private:
+	struct SortEntry
+	{
+		unsigned long long key;
+		int item;
+	};
+
+	// Id of a pair of pointers in a table, added if it isn't there.  Once
+	// a table is full everything new shares the last id, which only makes
+	// the sort less useful, since state is compared by pointer when drawn.
+	static unsigned int GetId(std::vector<const void*>& table, const void* first, const void* second, int bits);
+
+	std::vector<DrawItem> items;
+	std::vector<int> order;
+	std::vector<SortEntry> entries;
+	std::vector<SortEntry> scratch;
+
+	// Pairs of pointers, two entries per id
+	std::vector<const void*> shaderIds;
+	std::vector<const void*> materialIds;
+	std::vector<const void*> meshIds;
+
+	float depthRange;
+};
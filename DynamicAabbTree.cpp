@@ -0,0 +1,401 @@
+#include "DynamicAabbTree.h"
+#include <math.h>
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Aabb
+// --------------------------------------------------------
+Aabb Aabb::FromSphere(const XMFLOAT4& sphere)
+{
+	Aabb box;
+	box.min = XMFLOAT3(sphere.x - sphere.w, sphere.y - sphere.w, sphere.z - sphere.w);
+	box.max = XMFLOAT3(sphere.x + sphere.w, sphere.y + sphere.w, sphere.z + sphere.w);
+	return box;
+}
+
+Aabb Aabb::Union(const Aabb& a, const Aabb& b)
+{
+	Aabb box;
+	box.min.x = a.min.x < b.min.x ? a.min.x : b.min.x;
+	box.min.y = a.min.y < b.min.y ? a.min.y : b.min.y;
+	box.min.z = a.min.z < b.min.z ? a.min.z : b.min.z;
+	box.max.x = a.max.x > b.max.x ? a.max.x : b.max.x;
+	box.max.y = a.max.y > b.max.y ? a.max.y : b.max.y;
+	box.max.z = a.max.z > b.max.z ? a.max.z : b.max.z;
+	return box;
+}
+
+bool Aabb::Contains(const Aabb& other) const
+{
+	return min.x <= other.min.x && min.y <= other.min.y && min.z <= other.min.z &&
+		max.x >= other.max.x && max.y >= other.max.y && max.z >= other.max.z;
+}
+
+bool Aabb::Overlaps(const Aabb& other) const
+{
+	return min.x <= other.max.x && max.x >= other.min.x &&
+		min.y <= other.max.y && max.y >= other.min.y &&
+		min.z <= other.max.z && max.z >= other.min.z;
+}
+
+float Aabb::SurfaceArea() const
+{
+	float dx = max.x - min.x;
+	float dy = max.y - min.y;
+	float dz = max.z - min.z;
+	return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+// --------------------------------------------------------
+// DynamicAabbTree
+// --------------------------------------------------------
+DynamicAabbTree::DynamicAabbTree(float fatMargin)
+{
+	this->fatMargin = fatMargin;
+	root = INVALID_PROXY;
+	freeList = INVALID_PROXY;
+	proxyCount = 0;
+	rebalanceCursor = 0;
+}
+
+DynamicAabbTree::~DynamicAabbTree()
+{
+	// The tree never owns the user data
+}
+
+int DynamicAabbTree::AllocateNode()
+{
+	int node;
+	if (freeList != INVALID_PROXY)
+	{
+		node = freeList;
+		freeList = nodes[node].parent;
+	}
+	else
+	{
+		node = (int)nodes.size();
+		nodes.push_back(TreeNode());
+	}
+
+	nodes[node].userData = 0;
+	nodes[node].parent = INVALID_PROXY;
+	nodes[node].child1 = INVALID_PROXY;
+	nodes[node].child2 = INVALID_PROXY;
+	nodes[node].height = 0;
+	return node;
+}
+
+void DynamicAabbTree::FreeNode(int node)
+{
+	nodes[node].parent = freeList;
+	nodes[node].height = -1;
+	freeList = node;
+}
+
+int DynamicAabbTree::CreateProxy(const Aabb& box, void* userData)
+{
+	int proxy = AllocateNode();
+
+	nodes[proxy].box = box;
+	nodes[proxy].box.min.x -= fatMargin; nodes[proxy].box.min.y -= fatMargin; nodes[proxy].box.min.z -= fatMargin;
+	nodes[proxy].box.max.x += fatMargin; nodes[proxy].box.max.y += fatMargin; nodes[proxy].box.max.z += fatMargin;
+	nodes[proxy].userData = userData;
+
+	InsertLeaf(proxy);
+	proxyCount++;
+	return proxy;
+}
+
+void DynamicAabbTree::DestroyProxy(int proxy)
+{
+	if (proxy < 0 || proxy >= (int)nodes.size() || !nodes[proxy].IsLeaf() || nodes[proxy].height != 0)
+		return;
+
+	RemoveLeaf(proxy);
+	FreeNode(proxy);
+	proxyCount--;
+}
+
+bool DynamicAabbTree::MoveProxy(int proxy, const Aabb& box)
+{
+	// Still inside the fat box, nothing to do
+	if (nodes[proxy].box.Contains(box))
+		return false;
+
+	Aabb fat = box;
+	fat.min.x -= fatMargin; fat.min.y -= fatMargin; fat.min.z -= fatMargin;
+	fat.max.x += fatMargin; fat.max.y += fatMargin; fat.max.z += fatMargin;
+	nodes[proxy].box = fat;
+
+	// Refit in place rather than reinserting, and tidy the path on the way up
+	int node = nodes[proxy].parent;
+	while (node != INVALID_PROXY)
+	{
+		RefitNode(node);
+		if (Rotate(node))
+			RefitNode(node);
+		node = nodes[node].parent;
+	}
+	return true;
+}
+
+// Picks a sibling by walking down towards the cheapest spot,
+// using the surface area heuristic (the same cost Box2D uses)
+void DynamicAabbTree::InsertLeaf(int leaf)
+{
+	if (root == INVALID_PROXY)
+	{
+		root = leaf;
+		nodes[leaf].parent = INVALID_PROXY;
+		return;
+	}
+
+	Aabb leafBox = nodes[leaf].box;
+	int index = root;
+	while (!nodes[index].IsLeaf())
+	{
+		int child1 = nodes[index].child1;
+		int child2 = nodes[index].child2;
+
+		float area = nodes[index].box.SurfaceArea();
+		float combinedArea = Aabb::Union(nodes[index].box, leafBox).SurfaceArea();
+
+		// Cost of making a new parent for this node and the leaf
+		float cost = 2.0f * combinedArea;
+
+		// Minimum cost of pushing the leaf further down
+		float inheritanceCost = 2.0f * (combinedArea - area);
+
+		float cost1 = Aabb::Union(leafBox, nodes[child1].box).SurfaceArea() + inheritanceCost;
+		if (!nodes[child1].IsLeaf())
+			cost1 -= nodes[child1].box.SurfaceArea();
+
+		float cost2 = Aabb::Union(leafBox, nodes[child2].box).SurfaceArea() + inheritanceCost;
+		if (!nodes[child2].IsLeaf())
+			cost2 -= nodes[child2].box.SurfaceArea();
+
+		if (cost < cost1 && cost < cost2)
+			break;
+
+		index = cost1 < cost2 ? child1 : child2;
+	}
+
+	int sibling = index;
+	int oldParent = nodes[sibling].parent;
+	int newParent = AllocateNode();
+
+	nodes[newParent].parent = oldParent;
+	nodes[newParent].box = Aabb::Union(leafBox, nodes[sibling].box);
+	nodes[newParent].height = nodes[sibling].height + 1;
+	nodes[newParent].child1 = sibling;
+	nodes[newParent].child2 = leaf;
+	nodes[sibling].parent = newParent;
+	nodes[leaf].parent = newParent;
+
+	if (oldParent == INVALID_PROXY)
+		root = newParent;
+	else if (nodes[oldParent].child1 == sibling)
+		nodes[oldParent].child1 = newParent;
+	else
+		nodes[oldParent].child2 = newParent;
+
+	RefitAncestors(newParent);
+}
+
+void DynamicAabbTree::RemoveLeaf(int leaf)
+{
+	if (leaf == root)
+	{
+		root = INVALID_PROXY;
+		return;
+	}
+
+	// The sibling takes the parent's place
+	int parent = nodes[leaf].parent;
+	int grandParent = nodes[parent].parent;
+	int sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+
+	if (grandParent == INVALID_PROXY)
+	{
+		root = sibling;
+		nodes[sibling].parent = INVALID_PROXY;
+		FreeNode(parent);
+		return;
+	}
+
+	if (nodes[grandParent].child1 == parent)
+		nodes[grandParent].child1 = sibling;
+	else
+		nodes[grandParent].child2 = sibling;
+	nodes[sibling].parent = grandParent;
+	FreeNode(parent);
+
+	RefitAncestors(grandParent);
+}
+
+void DynamicAabbTree::RefitNode(int node)
+{
+	int child1 = nodes[node].child1;
+	int child2 = nodes[node].child2;
+
+	nodes[node].box = Aabb::Union(nodes[child1].box, nodes[child2].box);
+	nodes[node].height = 1 + (nodes[child1].height > nodes[child2].height ? nodes[child1].height : nodes[child2].height);
+}
+
+// Recomputes boxes and heights from node up to the root
+void DynamicAabbTree::RefitAncestors(int node)
+{
+	while (node != INVALID_PROXY)
+	{
+		RefitNode(node);
+		node = nodes[node].parent;
+	}
+}
+
+// Tree rotation (Kopta et al. 2012).  Tries swapping one child of
+// node with a grandchild from the other side, and keeps the swap
+// that shrinks the surface area of the changed child the most.
+// The node's own box never changes, since it covers the same leaves,
+// but its height might - the caller refits above the node.
+bool DynamicAabbTree::Rotate(int node)
+{
+	if (nodes[node].IsLeaf())
+		return false;
+
+	int b = nodes[node].child1;
+	int c = nodes[node].child2;
+
+	int bestKeep = INVALID_PROXY;	// Child of node that receives the grandchild
+	int bestMove = INVALID_PROXY;	// Child of node that swaps down
+	int bestGrand = INVALID_PROXY;	// Grandchild that swaps up
+	float bestGain = 0;
+
+	// Swap b with one of c's children, or c with one of b's children
+	for (int side = 0; side < 2; side++)
+	{
+		int move = side == 0 ? b : c;
+		int keep = side == 0 ? c : b;
+		if (nodes[keep].IsLeaf())
+			continue;
+
+		float oldArea = nodes[keep].box.SurfaceArea();
+		int grand[2] = { nodes[keep].child1, nodes[keep].child2 };
+		for (int g = 0; g < 2; g++)
+		{
+			// keep ends up holding move and the other grandchild
+			float newArea = Aabb::Union(nodes[move].box, nodes[grand[1 - g]].box).SurfaceArea();
+			float gain = oldArea - newArea;
+			if (gain > bestGain)
+			{
+				bestGain = gain;
+				bestKeep = keep;
+				bestMove = move;
+				bestGrand = grand[g];
+			}
+		}
+	}
+
+	if (bestKeep == INVALID_PROXY)
+		return false;
+
+	// bestGrand moves up to node, bestMove moves down into bestKeep
+	if (nodes[node].child1 == bestMove)
+		nodes[node].child1 = bestGrand;
+	else
+		nodes[node].child2 = bestGrand;
+	nodes[bestGrand].parent = node;
+
+	if (nodes[bestKeep].child1 == bestGrand)
+		nodes[bestKeep].child1 = bestMove;
+	else
+		nodes[bestKeep].child2 = bestMove;
+	nodes[bestMove].parent = bestKeep;
+
+	RefitNode(bestKeep);
+	return true;
+}
+
+void DynamicAabbTree::Rebalance(int maxNodes)
+{
+	int nodeCount = (int)nodes.size();
+	if (nodeCount == 0)
+		return;
+
+	for (int i = 0; i < maxNodes && i < nodeCount; i++)
+	{
+		if (rebalanceCursor >= nodeCount)
+			rebalanceCursor = 0;
+
+		int node = rebalanceCursor++;
+		if (nodes[node].height > 0 && Rotate(node))
+			RefitAncestors(node);
+	}
+}
+
+float DynamicAabbTree::DistanceSq(const Aabb& box, const XMFLOAT3& point)
+{
+	float dx = point.x < box.min.x ? box.min.x - point.x : (point.x > box.max.x ? point.x - box.max.x : 0);
+	float dy = point.y < box.min.y ? box.min.y - point.y : (point.y > box.max.y ? point.y - box.max.y : 0);
+	float dz = point.z < box.min.z ? box.min.z - point.z : (point.z > box.max.z ? point.z - box.max.z : 0);
+	return dx * dx + dy * dy + dz * dz;
+}
+
+unsigned int DynamicAabbTree::GetFrustumMask(int proxy, const XMFLOAT4* const* planeSets, int viewCount) const
+{
+	unsigned int viewMask = 0;
+	for (int v = 0; v < viewCount; v++)
+	{
+		if (ClassifyFrustum(nodes[proxy].box, planeSets[v], 0x3f) >= 0)
+			viewMask |= 1u << v;
+	}
+	return viewMask;
+}
+
+// Returns -1 if the box is outside the frustum, otherwise the subset
+// of mask's planes that the box still straddles
+int DynamicAabbTree::ClassifyFrustum(const Aabb& box, const XMFLOAT4* planes, int mask)
+{
+	float cx = (box.min.x + box.max.x) * 0.5f;
+	float cy = (box.min.y + box.max.y) * 0.5f;
+	float cz = (box.min.z + box.max.z) * 0.5f;
+	float ex = (box.max.x - box.min.x) * 0.5f;
+	float ey = (box.max.y - box.min.y) * 0.5f;
+	float ez = (box.max.z - box.min.z) * 0.5f;
+
+	for (int p = 0; p < 6; p++)
+	{
+		if (!(mask & (1 << p)))
+			continue;
+
+		float dist = planes[p].x * cx + planes[p].y * cy + planes[p].z * cz + planes[p].w;
+		float reach = fabsf(planes[p].x) * ex + fabsf(planes[p].y) * ey + fabsf(planes[p].z) * ez;
+
+		if (dist + reach < 0)
+			return -1;
+		if (dist - reach >= 0)
+			mask &= ~(1 << p);
+	}
+	return mask;
+}
+
+// Slab test against [0, maxDistance]
+bool DynamicAabbTree::RayHitsBox(const Aabb& box, const XMFLOAT3& origin, const XMFLOAT3& invDir, float maxDistance)
+{
+	float t1 = (box.min.x - origin.x) * invDir.x;
+	float t2 = (box.max.x - origin.x) * invDir.x;
+	float tMin = t1 < t2 ? t1 : t2;
+	float tMax = t1 < t2 ? t2 : t1;
+
+	t1 = (box.min.y - origin.y) * invDir.y;
+	t2 = (box.max.y - origin.y) * invDir.y;
+	if ((t1 < t2 ? t1 : t2) > tMin) tMin = t1 < t2 ? t1 : t2;
+	if ((t1 < t2 ? t2 : t1) < tMax) tMax = t1 < t2 ? t2 : t1;
+
+	t1 = (box.min.z - origin.z) * invDir.z;
+	t2 = (box.max.z - origin.z) * invDir.z;
+	if ((t1 < t2 ? t1 : t2) > tMin) tMin = t1 < t2 ? t1 : t2;
+	if ((t1 < t2 ? t2 : t1) < tMax) tMax = t1 < t2 ? t2 : t1;
+
+	return tMax >= (tMin > 0 ? tMin : 0) && tMin <= maxDistance;
+}
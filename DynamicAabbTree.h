@@ -0,0 +1,282 @@
+#pragma once
+
+#include <vector>
+#include <DirectXMath.h>
+
+// --------------------------------------------------------
+// Axis aligned box used by the scene tree
+// --------------------------------------------------------
+struct Aabb
+{
+	DirectX::XMFLOAT3 min;
+	DirectX::XMFLOAT3 max;
+
+	static Aabb FromSphere(const DirectX::XMFLOAT4& sphere);
+	static Aabb Union(const Aabb& a, const Aabb& b);
+
+	bool Contains(const Aabb& other) const;
+	bool Overlaps(const Aabb& other) const;
+	float SurfaceArea() const;
+};
+
+// --------------------------------------------------------
+// Dynamic bounding volume hierarchy over scene objects.
+//
+// Leaves store a "fat" box - the object's box grown by a
+// margin - so small movements don't touch the tree at all.
+// When an object does leave its fat box, the leaf is resized
+// and its ancestors are refit in place.  Refits slowly make
+// the tree worse, so Rebalance() applies a budget of local
+// tree rotations each frame that shrink the surface area of
+// internal nodes.
+//
+// This is separate from Bullet's broadphase so objects that
+// only exist for rendering can be queried as well.
+// Not thread safe - update and query from one thread.
+// --------------------------------------------------------
+class DynamicAabbTree
+{
+public:
+	static const int INVALID_PROXY = -1;
+	static const int MAX_QUERY_VIEWS = 8;
+
+	DynamicAabbTree(float fatMargin);
+	~DynamicAabbTree();
+
+	// Proxy lifetime.  userData is handed back to queries.
+	int CreateProxy(const Aabb& box, void* userData);
+	void DestroyProxy(int proxy);
+
+	// Returns true if the tree had to change
+	bool MoveProxy(int proxy, const Aabb& box);
+
+	// Rotates up to maxNodes internal nodes, picking up where the last call stopped
+	void Rebalance(int maxNodes);
+
+	void* GetUserData(int proxy) const { return nodes[proxy].userData; }
+	const Aabb& GetFatAabb(int proxy) const { return nodes[proxy].box; }
+	int GetHeight() const { return root == INVALID_PROXY ? 0 : nodes[root].height; }
+	int GetProxyCount() const { return proxyCount; }
+
+	// False once the proxy is destroyed, unless its node went to a new proxy
+	bool IsProxy(int proxy) const { return proxy >= 0 && proxy < (int)nodes.size() && nodes[proxy].height == 0 && nodes[proxy].IsLeaf(); }
+
+	// Bit v set for every view v whose frustum the proxy's fat box touches
+	unsigned int GetFrustumMask(int proxy, const DirectX::XMFLOAT4* const* planeSets, int viewCount) const;
+
+	// --------------------------------------------------------
+	// Queries.  The callback gets the proxy id of every leaf
+	// whose fat box passes the test and returns false to stop.
+	// --------------------------------------------------------
+	template<typename F>
+	void QueryAabb(const Aabb& box, F callback)
+	{
+		QueryNodes([&](const Aabb& nodeBox) { return nodeBox.Overlaps(box); }, callback);
+	}
+
+	template<typename F>
+	void QuerySphere(const DirectX::XMFLOAT3& center, float radius, F callback)
+	{
+		float radiusSq = radius * radius;
+		QueryNodes([&](const Aabb& nodeBox) { return DistanceSq(nodeBox, center) <= radiusSq; }, callback);
+	}
+
+	// planes point inwards, as produced by FrustumCuller.  A subtree that
+	// is entirely inside a plane isn't tested against that plane again.
+	template<typename F>
+	void QueryFrustum(const DirectX::XMFLOAT4* planes, F callback)
+	{
+		if (root == INVALID_PROXY)
+			return;
+
+		queryStack.clear();
+		queryStack.push_back(root);
+		queryMasks.clear();
+		queryMasks.push_back(0x3f);
+
+		while (!queryStack.empty())
+		{
+			int node = queryStack.back();
+			int mask = queryMasks.back();
+			queryStack.pop_back();
+			queryMasks.pop_back();
+
+			mask = ClassifyFrustum(nodes[node].box, planes, mask);
+			if (mask < 0)
+				continue;
+
+			if (nodes[node].IsLeaf())
+			{
+				if (!callback(node))
+					return;
+			}
+			else
+			{
+				queryStack.push_back(nodes[node].child1);
+				queryMasks.push_back(mask);
+				queryStack.push_back(nodes[node].child2);
+				queryMasks.push_back(mask);
+			}
+		}
+	}
+
+	// Same as QueryFrustum for several views at once.  planeSets[v] holds
+	// the six planes of view v.  The callback gets (proxy, viewMask) with
+	// bit v set for every view whose frustum the leaf touches, and is called
+	// once per proxy however many views see it.
+	template<typename F>
+	void QueryFrustums(const DirectX::XMFLOAT4* const* planeSets, int viewCount, F callback)
+	{
+		if (root == INVALID_PROXY || viewCount <= 0)
+			return;
+		if (viewCount > MAX_QUERY_VIEWS)
+			viewCount = MAX_QUERY_VIEWS;
+
+		// Plane masks are kept per view, viewCount entries per stack slot.
+		// A view that has rejected a subtree stays at -1 below it.
+		queryStack.clear();
+		queryStack.push_back(root);
+		queryMasks.clear();
+		for (int v = 0; v < viewCount; v++)
+			queryMasks.push_back(0x3f);
+
+		int masks[MAX_QUERY_VIEWS];
+		while (!queryStack.empty())
+		{
+			int node = queryStack.back();
+			queryStack.pop_back();
+			for (int v = viewCount - 1; v >= 0; v--)
+			{
+				masks[v] = queryMasks.back();
+				queryMasks.pop_back();
+			}
+
+			unsigned int viewMask = 0;
+			for (int v = 0; v < viewCount; v++)
+			{
+				if (masks[v] >= 0)
+					masks[v] = ClassifyFrustum(nodes[node].box, planeSets[v], masks[v]);
+				if (masks[v] >= 0)
+					viewMask |= 1u << v;
+			}
+			if (viewMask == 0)
+				continue;
+
+			if (nodes[node].IsLeaf())
+			{
+				if (!callback(node, viewMask))
+					return;
+			}
+			else
+			{
+				queryStack.push_back(nodes[node].child1);
+				queryMasks.insert(queryMasks.end(), masks, masks + viewCount);
+				queryStack.push_back(nodes[node].child2);
+				queryMasks.insert(queryMasks.end(), masks, masks + viewCount);
+			}
+		}
+	}
+
+	// The callback gets (proxy, maxDistance) and returns the distance to
+	// the hit, or a negative number for a miss.  Hits shorten the ray so
+	// subtrees beyond the closest hit so far are skipped.
+	template<typename F>
+	void RayCast(const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float maxDistance, F callback)
+	{
+		if (root == INVALID_PROXY)
+			return;
+
+		DirectX::XMFLOAT3 invDir(
+			direction.x != 0 ? 1.0f / direction.x : 1e30f,
+			direction.y != 0 ? 1.0f / direction.y : 1e30f,
+			direction.z != 0 ? 1.0f / direction.z : 1e30f);
+
+		queryStack.clear();
+		queryStack.push_back(root);
+
+		while (!queryStack.empty())
+		{
+			int node = queryStack.back();
+			queryStack.pop_back();
+
+			if (!RayHitsBox(nodes[node].box, origin, invDir, maxDistance))
+				continue;
+
+			if (nodes[node].IsLeaf())
+			{
+				float hit = callback(node, maxDistance);
+				if (hit >= 0 && hit < maxDistance)
+					maxDistance = hit;
+			}
+			else
+			{
+				queryStack.push_back(nodes[node].child1);
+				queryStack.push_back(nodes[node].child2);
+			}
+		}
+	}
+
+private:
+	struct TreeNode
+	{
+		Aabb box;
+		void* userData;
+		int parent;		// Next free node while on the free list
+		int child1;
+		int child2;
+		int height;		// 0 for leaves, -1 while free
+
+		bool IsLeaf() const { return child1 == INVALID_PROXY; }
+	};
+
+	int AllocateNode();
+	void FreeNode(int node);
+	void InsertLeaf(int leaf);
+	void RemoveLeaf(int leaf);
+	void RefitNode(int node);
+	void RefitAncestors(int node);
+	bool Rotate(int node);
+
+	static float DistanceSq(const Aabb& box, const DirectX::XMFLOAT3& point);
+	static int ClassifyFrustum(const Aabb& box, const DirectX::XMFLOAT4* planes, int mask);
+	static bool RayHitsBox(const Aabb& box, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& invDir, float maxDistance);
+
+	// Walks every node the test accepts
+	template<typename Test, typename F>
+	void QueryNodes(Test test, F& callback)
+	{
+		if (root == INVALID_PROXY)
+			return;
+
+		queryStack.clear();
+		queryStack.push_back(root);
+		while (!queryStack.empty())
+		{
+			int node = queryStack.back();
+			queryStack.pop_back();
+
+			if (!test(nodes[node].box))
+				continue;
+
+			if (nodes[node].IsLeaf())
+			{
+				if (!callback(node))
+					return;
+			}
+			else
+			{
+				queryStack.push_back(nodes[node].child1);
+				queryStack.push_back(nodes[node].child2);
+			}
+		}
+	}
+
+	std::vector<TreeNode> nodes;
+	std::vector<int> queryStack;
+	std::vector<int> queryMasks;
+	int root;
+	int freeList;
+	int proxyCount;
+	int rebalanceCursor;
+	float fatMargin;
+};
@@ -106,14 +106,14 @@ void Emitter::setParticleSpawn() {
 	spawnParticle = true;
 }
 
-void Emitter::UpdateEmitterPosition(float dt)
+void Emitter::UpdateEmitterPosition(float dt, const InputSnapshot& input)
 {
 	dt *= 3;
 
-	if (GetAsyncKeyState('W') & 0x8000) { emitterPosition.z += dt; }
-	if (GetAsyncKeyState('S') & 0x8000) { emitterPosition.z -= dt; }
-	if (GetAsyncKeyState('A') & 0x8000) { emitterPosition.x -= dt; }
-	if (GetAsyncKeyState('D') & 0x8000) { emitterPosition.x += dt; }
+	if (input.IsDown(INPUT_W)) { emitterPosition.z += dt; }
+	if (input.IsDown(INPUT_S)) { emitterPosition.z -= dt; }
+	if (input.IsDown(INPUT_A)) { emitterPosition.x -= dt; }
+	if (input.IsDown(INPUT_D)) { emitterPosition.x += dt; }
 }
 
 void Emitter::UpdateEmitterVelocity()
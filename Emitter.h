@@ -55,7 +55,7 @@ public:
 	void CopyOneParticle(int index);
 	void Draw(ID3D11DeviceContext* context, Camera* camera);
 	void setParticleSpawn();
-	void UpdateEmitterPosition(float dt);
+	void UpdateEmitterPosition(float dt, const InputSnapshot& input);
 	void UpdateEmitterVelocity();
 
 
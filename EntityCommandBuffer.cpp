@@ -0,0 +1,75 @@
+#include "EntityCommandBuffer.h"
+#include <algorithm>
+#include <cstring>
+
+// Every header starts on a multiple of this, so with vector storage coming
+// from new they can be read in place during playback
+static const unsigned int COMMAND_ALIGNMENT = 16;
+
+void EntityCommandBuffer::Append(std::vector<unsigned char>& buffer, EntityId key, int op, EntityId entity, int type, ComponentMask mask, const void* payload, unsigned int size)
+{
+	CommandHeader header;
+	header.mask = mask;
+	header.key = key;
+	header.entity = entity;
+	header.op = op;
+	header.type = type;
+	header.size = size;
+
+	size_t offset = buffer.size();
+	size_t total = (sizeof(CommandHeader) + size + COMMAND_ALIGNMENT - 1) & ~(size_t)(COMMAND_ALIGNMENT - 1);
+	buffer.resize(offset + total);
+	memcpy(&buffer[offset], &header, sizeof(header));
+	if (size > 0)
+		memcpy(&buffer[offset + sizeof(header)], payload, size);
+}
+
+bool EntityCommandBuffer::IsEmpty()
+{
+	for (auto it = commands.begin(); it != commands.end(); ++it)
+	{
+		if (!it->empty())
+			return false;
+	}
+	return true;
+}
+
+// Moves every thread's commands out to be played back, so commands recorded
+// during playback go into fresh buffers instead of moving these ones.  The
+// threads' buffers come out in no particular order, but as long as a key is
+// only used from one thread, a stable sort by key is deterministic.
+void EntityCommandBuffer::Sort()
+{
+	sorted.clear();
+	size_t buffer = 0;
+	for (auto it = commands.begin(); it != commands.end(); ++it, buffer++)
+	{
+		// Swapping hands the thread last playback's memory to reuse
+		if (playing.size() <= buffer)
+			playing.push_back(std::vector<unsigned char>());
+		playing[buffer].swap(*it);
+
+		const std::vector<unsigned char>& data = playing[buffer];
+		size_t offset = 0;
+		while (offset < data.size())
+		{
+			const CommandHeader* header = (const CommandHeader*)&data[offset];
+			SortedCommand command = { header->key, header };
+			sorted.push_back(command);
+			offset += (sizeof(CommandHeader) + header->size + COMMAND_ALIGNMENT - 1) & ~(size_t)(COMMAND_ALIGNMENT - 1);
+		}
+	}
+
+	std::stable_sort(sorted.begin(), sorted.end(), [](const SortedCommand& a, const SortedCommand& b)
+	{
+		return a.key < b.key;
+	});
+}
+
+// Keeps the memory, the same commands tend to come back every frame
+void EntityCommandBuffer::Clear()
+{
+	for (size_t i = 0; i < playing.size(); i++)
+		playing[i].clear();
+	sorted.clear();
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <vector>
+#include <enumerable_thread_specific.h>
+#include "EntityComponentSystem.h"
+
+// --------------------------------------------------------
+// Structural changes recorded while systems run, applied
+// later at a sync point.
+//
+// Systems can't create or destroy entities while a query
+// is walking the chunks, and anything that touches state
+// outside the component world (Bullet, the scene tree) has
+// to happen on the main thread.  Instead a system records
+// commands here and the game plays them back once the
+// systems are done.
+//
+// Every thread appends to its own buffer, so recording takes
+// no locks.  Each command carries a sort key and playback
+// sorts by it, keeping commands with the same key in the
+// order they were recorded.  Using the id of the entity
+// whose row is being processed as the key makes playback
+// order independent of how the chunks were split across
+// threads; a key shouldn't be used from two threads
+// between playbacks.
+//
+// Events are commands the buffer doesn't interpret: the code
+// and a plain data payload are handed to the callback given
+// to Playback, for work the component world can't do itself.
+// --------------------------------------------------------
+class EntityCommandBuffer
+{
+public:
+	// The components are set on a new entity, which later commands can't
+	// refer to since its id isn't known until playback
+	template<typename... Ts>
+	void Create(EntityId key, const Ts&... components)
+	{
+		std::vector<unsigned char>& buffer = commands.local();
+		Append(buffer, key, COMMAND_CREATE, INVALID_ENTITY, 0, MaskOf<Ts...>(), 0, 0);
+		AppendSets(buffer, key, components...);
+	}
+
+	void Destroy(EntityId key, EntityId id)
+	{
+		Append(commands.local(), key, COMMAND_DESTROY, id, 0, 0, 0, 0);
+	}
+
+	// Adds the component if the entity doesn't have it
+	template<typename T>
+	void Set(EntityId key, EntityId id, const T& value)
+	{
+		Append(commands.local(), key, COMMAND_SET, id, ComponentTypeId<T>(), 0, &value, sizeof(T));
+	}
+
+	template<typename T>
+	void Remove(EntityId key, EntityId id)
+	{
+		Append(commands.local(), key, COMMAND_REMOVE, id, ComponentTypeId<T>(), 0, 0, 0);
+	}
+
+	void Event(EntityId key, int code, EntityId id)
+	{
+		Append(commands.local(), key, COMMAND_EVENT, id, code, 0, 0, 0);
+	}
+
+	template<typename T>
+	void Event(EntityId key, int code, EntityId id, const T& payload)
+	{
+		Append(commands.local(), key, COMMAND_EVENT, id, code, 0, &payload, sizeof(T));
+	}
+
+	// Applies everything recorded since the last playback, from the main
+	// thread.  onEvent is called as onEvent(code, entityId, payload) and
+	// may record more commands, which wait for the next playback.
+	template<typename F>
+	void Playback(ComponentWorld& world, F onEvent)
+	{
+		Sort();
+
+		EntityId created = INVALID_ENTITY;
+		for (size_t i = 0; i < sorted.size(); i++)
+		{
+			const CommandHeader& command = *sorted[i].header;
+			const void* payload = sorted[i].header + 1;
+			EntityId target = command.entity == INVALID_ENTITY ? created : command.entity;
+
+			switch (command.op)
+			{
+			case COMMAND_CREATE:
+				created = world.CreateEntityFromMask(command.mask);
+				break;
+			case COMMAND_DESTROY:
+				world.DestroyEntity(target);
+				break;
+			case COMMAND_SET:
+				world.SetComponentData(target, command.type, payload);
+				break;
+			case COMMAND_REMOVE:
+				world.RemoveComponentData(target, command.type);
+				break;
+			case COMMAND_EVENT:
+				onEvent(command.type, command.entity, command.size > 0 ? payload : 0);
+				break;
+			}
+		}
+
+		Clear();
+	}
+
+	bool IsEmpty();
+
+private:
+	enum CommandOp
+	{
+		COMMAND_CREATE,
+		COMMAND_DESTROY,
+		COMMAND_SET,
+		COMMAND_REMOVE,
+		COMMAND_EVENT
+	};
+
+	// Followed by size bytes of payload, then padding up to the next
+	// header.  entity is INVALID_ENTITY for sets on a just created entity.
+	struct CommandHeader
+	{
+		ComponentMask mask;
+		EntityId key;
+		EntityId entity;
+		int op;
+		int type;		// Component type, or the event code
+		unsigned int size;
+	};
+
+	struct SortedCommand
+	{
+		EntityId key;
+		const CommandHeader* header;
+	};
+
+	void Append(std::vector<unsigned char>& buffer, EntityId key, int op, EntityId entity, int type, ComponentMask mask, const void* payload, unsigned int size);
+
+	void AppendSets(std::vector<unsigned char>& buffer, EntityId key) {}
+
+	template<typename T, typename... Rest>
+	void AppendSets(std::vector<unsigned char>& buffer, EntityId key, const T& first, const Rest&... rest)
+	{
+		Append(buffer, key, COMMAND_SET, INVALID_ENTITY, ComponentTypeId<T>(), 0, &first, sizeof(T));
+		AppendSets(buffer, key, rest...);
+	}
+
+	void Sort();
+	void Clear();
+
+	tbb::enumerable_thread_specific<std::vector<unsigned char>> commands;
+	std::vector<std::vector<unsigned char>> playing;	// Swapped out of commands for playback
+	std::vector<SortedCommand> sorted;
+};
@@ -0,0 +1,415 @@
+#include "EntityComponentSystem.h"
+#include <malloc.h>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <task_group.h>
+
+// --------------------------------------------------------
+// Component type registry
+// --------------------------------------------------------
+static ComponentTypeInfo componentTypes[ECS_MAX_COMPONENT_TYPES];
+static std::atomic<int> componentTypeCount(0);
+
+int RegisterComponentType(unsigned int size, unsigned int alignment)
+{
+	int id = componentTypeCount++;
+	if (id >= ECS_MAX_COMPONENT_TYPES)
+	{
+		//Sharing an id would put two types in one column, so stop here.
+		//Raise ECS_MAX_COMPONENT_TYPES (and the mask width) instead.
+		printf("ECS: too many component types (max %d)\n", ECS_MAX_COMPONENT_TYPES);
+		abort();
+	}
+
+	componentTypes[id].Size = size;
+	componentTypes[id].Alignment = alignment;
+	return id;
+}
+
+const ComponentTypeInfo& GetComponentTypeInfo(int type)
+{
+	return componentTypes[type];
+}
+
+static int AlignUp(int offset, int alignment)
+{
+	return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+// --------------------------------------------------------
+// Archetype
+// --------------------------------------------------------
+Archetype::Archetype(ComponentMask mask)
+{
+	this->mask = mask;
+
+	// Work out how many rows fit, leaving room to align every array
+	int rowSize = sizeof(EntityId);
+	int arrayCount = 1;
+	for (int t = 0; t < ECS_MAX_COMPONENT_TYPES; t++)
+	{
+		typeOffsets[t] = -1;
+		if (mask & (1ull << t))
+		{
+			rowSize += GetComponentTypeInfo(t).Size;
+			arrayCount++;
+		}
+	}
+	capacity = (ECS_CHUNK_SIZE - 16 * arrayCount) / rowSize;
+	if (capacity < 1)
+		capacity = 1;
+
+	// Entity ids first, then one array per component type
+	int offset = capacity * sizeof(EntityId);
+	for (int t = 0; t < ECS_MAX_COMPONENT_TYPES; t++)
+	{
+		if (!(mask & (1ull << t)))
+			continue;
+
+		const ComponentTypeInfo& info = GetComponentTypeInfo(t);
+		offset = AlignUp(offset, info.Alignment);
+		typeOffsets[t] = offset;
+		offset += capacity * info.Size;
+	}
+}
+
+Archetype::~Archetype()
+{
+	for (size_t c = 0; c < chunks.size(); c++)
+		_aligned_free(chunks[c].data);
+}
+
+int Archetype::GetEntityCount() const
+{
+	if (chunks.empty())
+		return 0;
+
+	// Only the last chunk can be partially filled
+	return (int)(chunks.size() - 1) * capacity + chunks.back().count;
+}
+
+void Archetype::AddRow(EntityId id, int& chunk, int& row)
+{
+	if (chunks.empty() || chunks.back().count == capacity)
+	{
+		Chunk fresh;
+		fresh.data = (unsigned char*)_aligned_malloc(ECS_CHUNK_SIZE, 64);
+		fresh.count = 0;
+		chunks.push_back(fresh);
+	}
+
+	chunk = (int)chunks.size() - 1;
+	row = chunks[chunk].count++;
+
+	GetEntities(chunk)[row] = id;
+	for (int t = 0; t < ECS_MAX_COMPONENT_TYPES; t++)
+	{
+		if (typeOffsets[t] < 0)
+			continue;
+
+		unsigned int size = GetComponentTypeInfo(t).Size;
+		memset((unsigned char*)GetArray(chunk, t) + row * size, 0, size);
+	}
+}
+
+EntityId Archetype::RemoveRow(int chunk, int row)
+{
+	int lastChunk = (int)chunks.size() - 1;
+	int lastRow = chunks[lastChunk].count - 1;
+	EntityId moved = INVALID_ENTITY;
+
+	// Fill the hole with the very last row so the chunks stay dense
+	if (chunk != lastChunk || row != lastRow)
+	{
+		moved = GetEntities(lastChunk)[lastRow];
+		GetEntities(chunk)[row] = moved;
+
+		for (int t = 0; t < ECS_MAX_COMPONENT_TYPES; t++)
+		{
+			if (typeOffsets[t] < 0)
+				continue;
+
+			unsigned int size = GetComponentTypeInfo(t).Size;
+			memcpy(
+				(unsigned char*)GetArray(chunk, t) + row * size,
+				(unsigned char*)GetArray(lastChunk, t) + lastRow * size,
+				size);
+		}
+	}
+
+	chunks[lastChunk].count--;
+
+	// Give back empty chunks, but always keep one around
+	if (chunks[lastChunk].count == 0 && lastChunk > 0)
+	{
+		_aligned_free(chunks[lastChunk].data);
+		chunks.pop_back();
+	}
+
+	return moved;
+}
+
+// --------------------------------------------------------
+// ComponentWorld
+// --------------------------------------------------------
+ComponentWorld::ComponentWorld()
+{
+	freeRecord = -1;
+	liveCount = 0;
+}
+
+ComponentWorld::~ComponentWorld()
+{
+	for (size_t a = 0; a < archetypes.size(); a++)
+		delete archetypes[a];
+}
+
+Archetype* ComponentWorld::FindOrCreateArchetype(ComponentMask mask)
+{
+	for (size_t a = 0; a < archetypes.size(); a++)
+	{
+		if (archetypes[a]->GetMask() == mask)
+			return archetypes[a];
+	}
+
+	Archetype* arch = new Archetype(mask);
+	archetypes.push_back(arch);
+	return arch;
+}
+
+EntityId ComponentWorld::AllocateEntity(ComponentMask mask)
+{
+	// Reuse a destroyed record if there is one, otherwise grow
+	unsigned int index;
+	if (freeRecord >= 0)
+	{
+		index = (unsigned int)freeRecord;
+		freeRecord = records[index].nextFree;
+	}
+	else
+	{
+		if (records.size() >= ECS_INDEX_MASK)
+			return INVALID_ENTITY;
+
+		index = (unsigned int)records.size();
+		EntityRecord fresh = {};
+		records.push_back(fresh);
+	}
+
+	EntityRecord& record = records[index];
+	EntityId id = (record.generation << ECS_INDEX_BITS) | index;
+
+	record.archetype = FindOrCreateArchetype(mask);
+	record.alive = true;
+	record.nextFree = -1;
+	record.archetype->AddRow(id, record.chunk, record.row);
+
+	liveCount++;
+	return id;
+}
+
+bool ComponentWorld::IsAlive(EntityId id) const
+{
+	unsigned int index = EntityIndex(id);
+	return index < records.size() &&
+		records[index].alive &&
+		records[index].generation == EntityGeneration(id);
+}
+
+void ComponentWorld::DestroyEntity(EntityId id)
+{
+	if (!IsAlive(id))
+		return;
+
+	unsigned int index = EntityIndex(id);
+	EntityRecord& record = records[index];
+	EntityId moved = record.archetype->RemoveRow(record.chunk, record.row);
+	if (moved != INVALID_ENTITY)
+	{
+		records[EntityIndex(moved)].chunk = record.chunk;
+		records[EntityIndex(moved)].row = record.row;
+	}
+
+	// New generation so any copies of this id go stale
+	record.alive = false;
+	record.archetype = 0;
+	record.generation = (record.generation + 1) & ECS_GENERATION_MASK;
+	record.nextFree = freeRecord;
+	freeRecord = (int)index;
+	liveCount--;
+}
+
+void* ComponentWorld::GetComponent(EntityId id, int type)
+{
+	if (!IsAlive(id))
+		return 0;
+
+	EntityRecord& record = records[EntityIndex(id)];
+	if (!(record.archetype->GetMask() & (1ull << type)))
+		return 0;
+
+	unsigned int size = GetComponentTypeInfo(type).Size;
+	return (unsigned char*)record.archetype->GetArray(record.chunk, type) + record.row * size;
+}
+
+void ComponentWorld::SetComponentData(EntityId id, int type, const void* data)
+{
+	if (!IsAlive(id))
+		return;
+
+	ChangeArchetype(id, records[EntityIndex(id)].archetype->GetMask() | (1ull << type));
+	memcpy(GetComponent(id, type), data, GetComponentTypeInfo(type).Size);
+}
+
+void ComponentWorld::RemoveComponentData(EntityId id, int type)
+{
+	if (!IsAlive(id))
+		return;
+
+	ChangeArchetype(id, records[EntityIndex(id)].archetype->GetMask() & ~(1ull << type));
+}
+
+void ComponentWorld::ChangeArchetype(EntityId id, ComponentMask newMask)
+{
+	EntityRecord& record = records[EntityIndex(id)];
+	Archetype* oldArch = record.archetype;
+	if (oldArch->GetMask() == newMask)
+		return;
+
+	Archetype* newArch = FindOrCreateArchetype(newMask);
+	int newChunk, newRow;
+	newArch->AddRow(id, newChunk, newRow);
+
+	// Carry over everything the two archetypes have in common
+	ComponentMask shared = oldArch->GetMask() & newMask;
+	for (int t = 0; t < ECS_MAX_COMPONENT_TYPES; t++)
+	{
+		if (!(shared & (1ull << t)))
+			continue;
+
+		unsigned int size = GetComponentTypeInfo(t).Size;
+		memcpy(
+			(unsigned char*)newArch->GetArray(newChunk, t) + newRow * size,
+			(unsigned char*)oldArch->GetArray(record.chunk, t) + record.row * size,
+			size);
+	}
+
+	EntityId moved = oldArch->RemoveRow(record.chunk, record.row);
+	if (moved != INVALID_ENTITY)
+	{
+		records[EntityIndex(moved)].chunk = record.chunk;
+		records[EntityIndex(moved)].row = record.row;
+	}
+
+	record.archetype = newArch;
+	record.chunk = newChunk;
+	record.row = newRow;
+}
+
+void ComponentWorld::GatherChunks(ComponentMask required, std::vector<ChunkRef>& chunks)
+{
+	chunks.clear();
+	for (size_t a = 0; a < archetypes.size(); a++)
+	{
+		Archetype* arch = archetypes[a];
+		if ((arch->GetMask() & required) != required)
+			continue;
+
+		for (int c = 0; c < arch->GetChunkCount(); c++)
+		{
+			if (arch->GetChunkSize(c) == 0)
+				continue;
+
+			ChunkRef ref;
+			ref.archetype = arch;
+			ref.chunk = c;
+			chunks.push_back(ref);
+		}
+	}
+}
+
+// --------------------------------------------------------
+// Systems and scheduling
+// --------------------------------------------------------
+bool EcsSystem::ConflictsWith(const EcsSystem& other) const
+{
+	if (exclusive || other.exclusive)
+		return true;
+
+	// Two writers, or a writer and a reader, of the same component
+	return (writeMask & (other.readMask | other.writeMask)) != 0 ||
+		(other.writeMask & readMask) != 0;
+}
+
+SystemScheduler::SystemScheduler()
+{
+	phaseCount = 0;
+	phasesDirty = false;
+}
+
+SystemScheduler::~SystemScheduler()
+{
+	for (size_t i = 0; i < systems.size(); i++)
+		delete systems[i];
+}
+
+void SystemScheduler::AddSystem(EcsSystem* system)
+{
+	systems.push_back(system);
+	phasesDirty = true;
+}
+
+// Each system goes in the phase right after the last earlier
+// system it conflicts with, which keeps registration order
+// wherever order actually matters
+void SystemScheduler::BuildPhases()
+{
+	systemPhase.assign(systems.size(), 0);
+	phaseCount = 0;
+
+	for (size_t i = 0; i < systems.size(); i++)
+	{
+		for (size_t j = 0; j < i; j++)
+		{
+			if (systems[i]->ConflictsWith(*systems[j]) && systemPhase[j] + 1 > systemPhase[i])
+				systemPhase[i] = systemPhase[j] + 1;
+		}
+		if (systemPhase[i] + 1 > phaseCount)
+			phaseCount = systemPhase[i] + 1;
+	}
+
+	phasesDirty = false;
+}
+
+void SystemScheduler::Run(ComponentWorld& world, float deltaTime)
+{
+	if (phasesDirty)
+		BuildPhases();
+
+	for (int p = 0; p < phaseCount; p++)
+	{
+		tbb::task_group group;
+		EcsSystem* inlineSystem = 0;
+
+		for (size_t i = 0; i < systems.size(); i++)
+		{
+			if (systemPhase[i] != p)
+				continue;
+
+			// Keep the first system of the phase on this thread
+			if (!inlineSystem)
+			{
+				inlineSystem = systems[i];
+				continue;
+			}
+
+			EcsSystem* system = systems[i];
+			group.run([system, &world, deltaTime]() { system->Run(world, deltaTime); });
+		}
+
+		if (inlineSystem)
+			inlineSystem->Run(world, deltaTime);
+		group.wait();
+	}
+}
@@ -0,0 +1,323 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <parallel_for.h>
+#include <blocked_range.h>
+
+// --------------------------------------------------------
+// Archetype/chunk based entity component system.
+//
+// Every distinct set of component types is an "archetype".
+// An archetype stores its entities in fixed 16 KB chunks, with
+// one tightly packed array per component type inside each chunk
+// (structure of arrays), so iterating a query walks memory
+// linearly.  Components are moved around with memcpy, so they
+// must be plain data (pointers are fine, owning objects are not).
+//
+// Entity ids pack a record index in the low bits with a
+// generation in the high bits.  Destroyed records are reused
+// through a free list and get a new generation, so stale ids
+// fail IsAlive() instead of aliasing a newer entity.
+// --------------------------------------------------------
+
+typedef unsigned int EntityId;
+typedef unsigned long long ComponentMask;
+
+static const int ECS_CHUNK_SIZE = 16 * 1024;
+static const int ECS_MAX_COMPONENT_TYPES = 64;
+static const EntityId INVALID_ENTITY = 0xffffffff;
+
+static const unsigned int ECS_INDEX_BITS = 20;
+static const unsigned int ECS_INDEX_MASK = (1u << ECS_INDEX_BITS) - 1;
+static const unsigned int ECS_GENERATION_MASK = (1u << (32 - ECS_INDEX_BITS)) - 1;
+
+inline unsigned int EntityIndex(EntityId id) { return id & ECS_INDEX_MASK; }
+inline unsigned int EntityGeneration(EntityId id) { return id >> ECS_INDEX_BITS; }
+
+// --------------------------------------------------------
+// Component type registry - every component struct gets a
+// small integer id the first time it's used
+// --------------------------------------------------------
+struct ComponentTypeInfo
+{
+	unsigned int Size;
+	unsigned int Alignment;
+};
+
+int RegisterComponentType(unsigned int size, unsigned int alignment);
+const ComponentTypeInfo& GetComponentTypeInfo(int type);
+
+template<typename T>
+int ComponentTypeId()
+{
+	static const int id = RegisterComponentType(sizeof(T), alignof(T));
+	return id;
+}
+
+template<typename T>
+ComponentMask ComponentBit() { return 1ull << ComponentTypeId<T>(); }
+
+template<typename... Ts>
+ComponentMask MaskOf()
+{
+	ComponentMask bits[] = { 0ull, ComponentBit<Ts>()... };
+	ComponentMask mask = 0;
+	for (ComponentMask b : bits) mask |= b;
+	return mask;
+}
+
+// --------------------------------------------------------
+// All the chunks for one combination of component types
+// --------------------------------------------------------
+class Archetype
+{
+public:
+	Archetype(ComponentMask mask);
+	~Archetype();
+
+	ComponentMask GetMask() const { return mask; }
+	int GetCapacity() const { return capacity; }
+	int GetChunkCount() const { return (int)chunks.size(); }
+	int GetChunkSize(int chunk) const { return chunks[chunk].count; }
+	int GetEntityCount() const;
+
+	EntityId* GetEntities(int chunk) { return (EntityId*)chunks[chunk].data; }
+	void* GetArray(int chunk, int type) { return chunks[chunk].data + typeOffsets[type]; }
+	template<typename T> T* GetArray(int chunk) { return (T*)GetArray(chunk, ComponentTypeId<T>()); }
+
+	// Appends a zeroed row for the entity
+	void AddRow(EntityId id, int& chunk, int& row);
+
+	// Removes a row by moving the last row into its place.  Returns the
+	// entity that was moved (so its record can be fixed up) or INVALID_ENTITY.
+	EntityId RemoveRow(int chunk, int row);
+
+private:
+	struct Chunk
+	{
+		unsigned char* data;
+		int count;
+	};
+
+	ComponentMask mask;
+	int capacity;
+	int typeOffsets[ECS_MAX_COMPONENT_TYPES];
+	std::vector<Chunk> chunks;
+};
+
+// --------------------------------------------------------
+// Owns every archetype and maps entity ids to their rows
+// --------------------------------------------------------
+class ComponentWorld
+{
+public:
+	ComponentWorld();
+	~ComponentWorld();
+
+	// Entity lifetime.  Returns INVALID_ENTITY once every id is in use.
+	template<typename... Ts>
+	EntityId CreateEntity(const Ts&... components)
+	{
+		EntityId id = AllocateEntity(MaskOf<Ts...>());
+		if (id != INVALID_ENTITY)
+			SetComponents(id, components...);
+		return id;
+	}
+	void DestroyEntity(EntityId id);
+	bool IsAlive(EntityId id) const;
+	int GetEntityCount() const { return liveCount; }
+
+	// Component access - returns null if the entity doesn't have it
+	template<typename T>
+	T* GetComponent(EntityId id) { return (T*)GetComponent(id, ComponentTypeId<T>()); }
+
+	template<typename T>
+	bool HasComponent(EntityId id) { return GetComponent(id, ComponentTypeId<T>()) != 0; }
+
+	// Adding or removing a component moves the entity to another archetype
+	template<typename T>
+	void AddComponent(EntityId id, const T& value)
+	{
+		if (!IsAlive(id)) return;
+		ChangeArchetype(id, records[EntityIndex(id)].archetype->GetMask() | ComponentBit<T>());
+		*GetComponent<T>(id) = value;
+	}
+
+	template<typename T>
+	void RemoveComponent(EntityId id)
+	{
+		if (!IsAlive(id)) return;
+		ChangeArchetype(id, records[EntityIndex(id)].archetype->GetMask() & ~ComponentBit<T>());
+	}
+
+	// Untyped versions of the above, with types given by ComponentTypeId,
+	// for code that only finds out the types at run time.  Setting a
+	// component the entity doesn't have adds it.
+	EntityId CreateEntityFromMask(ComponentMask mask) { return AllocateEntity(mask); }
+	void SetComponentData(EntityId id, int type, const void* data);
+	void RemoveComponentData(EntityId id, int type);
+
+	// --------------------------------------------------------
+	// Typed queries.  Ts are the components an archetype must have.
+	//
+	// EachChunk calls fn(count, entityIds, Ts* arrays...) once per chunk.
+	// Each calls fn(entityId, Ts&...) once per entity.
+	// The Parallel versions split the chunks across worker threads,
+	// so fn must only touch the rows it's given.
+	// --------------------------------------------------------
+	template<typename... Ts, typename F>
+	void EachChunk(F fn)
+	{
+		ComponentMask required = MaskOf<Ts...>();
+		for (size_t a = 0; a < archetypes.size(); a++)
+		{
+			Archetype* arch = archetypes[a];
+			if ((arch->GetMask() & required) != required)
+				continue;
+
+			for (int c = 0; c < arch->GetChunkCount(); c++)
+			{
+				int count = arch->GetChunkSize(c);
+				if (count > 0)
+					fn(count, arch->GetEntities(c), arch->template GetArray<Ts>(c)...);
+			}
+		}
+	}
+
+	template<typename... Ts, typename F>
+	void Each(F fn)
+	{
+		EachChunk<Ts...>(RowVisitor<F>(fn));
+	}
+
+	template<typename... Ts, typename F>
+	void ParallelEachChunk(F fn)
+	{
+		// Local rather than a member, systems in the same phase can be
+		// running queries on this world at the same time
+		std::vector<ChunkRef> chunks;
+		GatherChunks(MaskOf<Ts...>(), chunks);
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, chunks.size(), 1),
+			[&](const tbb::blocked_range<size_t>& range)
+		{
+			for (size_t i = range.begin(); i != range.end(); i++)
+			{
+				Archetype* arch = chunks[i].archetype;
+				int c = chunks[i].chunk;
+				fn(arch->GetChunkSize(c), arch->GetEntities(c), arch->template GetArray<Ts>(c)...);
+			}
+		});
+	}
+
+	template<typename... Ts, typename F>
+	void ParallelEach(F fn)
+	{
+		ParallelEachChunk<Ts...>(RowVisitor<F>(fn));
+	}
+
+private:
+	struct EntityRecord
+	{
+		Archetype* archetype;
+		int chunk;
+		int row;
+		unsigned int generation;
+		int nextFree;
+		bool alive;
+	};
+
+	struct ChunkRef
+	{
+		Archetype* archetype;
+		int chunk;
+	};
+
+	// Adapts a per-entity callback to the per-chunk interface
+	template<typename F>
+	struct RowVisitor
+	{
+		F& fn;
+		RowVisitor(F& f) : fn(f) {}
+
+		template<typename... Ptrs>
+		void operator()(int count, const EntityId* ids, Ptrs... arrays) const
+		{
+			for (int i = 0; i < count; i++)
+				fn(ids[i], arrays[i]...);
+		}
+	};
+
+	EntityId AllocateEntity(ComponentMask mask);
+	void* GetComponent(EntityId id, int type);
+	void ChangeArchetype(EntityId id, ComponentMask newMask);
+	Archetype* FindOrCreateArchetype(ComponentMask mask);
+	void GatherChunks(ComponentMask required, std::vector<ChunkRef>& chunks);
+
+	void SetComponents(EntityId id) {}
+
+	template<typename T, typename... Rest>
+	void SetComponents(EntityId id, const T& first, const Rest&... rest)
+	{
+		*GetComponent<T>(id) = first;
+		SetComponents(id, rest...);
+	}
+
+	std::vector<Archetype*> archetypes;
+	std::vector<EntityRecord> records;
+	int freeRecord;
+	int liveCount;
+};
+
+// --------------------------------------------------------
+// A unit of per-frame logic.  Systems declare which component
+// types they read and write so the scheduler can run the ones
+// that don't conflict at the same time.  Systems that touch
+// anything outside the component world (Bullet, D3D, the Game)
+// should call SetExclusive() so they always run alone.
+//
+// Systems must not create or destroy entities while running.
+// --------------------------------------------------------
+class EcsSystem
+{
+public:
+	EcsSystem() : readMask(0), writeMask(0), exclusive(false) {}
+	virtual ~EcsSystem() {}
+
+	virtual void Run(ComponentWorld& world, float deltaTime) = 0;
+
+	bool ConflictsWith(const EcsSystem& other) const;
+
+protected:
+	template<typename T> void Reads() { readMask |= ComponentBit<T>(); }
+	template<typename T> void Writes() { writeMask |= ComponentBit<T>(); }
+	void SetExclusive() { exclusive = true; }
+
+private:
+	ComponentMask readMask;
+	ComponentMask writeMask;
+	bool exclusive;
+};
+
+// --------------------------------------------------------
+// Runs systems in registration order, batching consecutive
+// non-conflicting systems into phases that run in parallel
+// --------------------------------------------------------
+class SystemScheduler
+{
+public:
+	SystemScheduler();
+	~SystemScheduler();
+
+	// The scheduler takes ownership of the system
+	void AddSystem(EcsSystem* system);
+	void Run(ComponentWorld& world, float deltaTime);
+
+private:
+	void BuildPhases();
+
+	std::vector<EcsSystem*> systems;
+	std::vector<int> systemPhase;
+	int phaseCount;
+	bool phasesDirty;
+};
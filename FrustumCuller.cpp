@@ -0,0 +1,191 @@
+#include "FrustumCuller.h"
+#include <emmintrin.h>
+#include <math.h>
+
+using namespace DirectX;
+
+FrustumCuller::FrustumCuller()
+{
+	// Wide open until a camera is set
+	for (int i = 0; i < 6; i++)
+		planes[i] = XMFLOAT4(0, 0, 0, 1);
+}
+
+// The camera caches its planes, so this is just a copy
+void FrustumCuller::SetCamera(Camera* camera)
+{
+	const XMFLOAT4* cameraPlanes = camera->GetFrustumPlanes();
+	for (int i = 0; i < 6; i++)
+		planes[i] = cameraPlanes[i];
+}
+
+void FrustumCuller::SetViewProjection(CXMMATRIX viewProjection)
+{
+	ExtractPlanes(viewProjection, planes);
+}
+
+// Planes come from the columns of the view-projection matrix
+// (Gribb & Hartmann).  D3D clip space z runs from 0 to w, so the
+// near plane is just the third column.
+void FrustumCuller::ExtractPlanes(CXMMATRIX viewProjection, XMFLOAT4* planes)
+{
+	XMFLOAT4X4 m;
+	XMStoreFloat4x4(&m, viewProjection);
+
+	planes[0] = XMFLOAT4(m._14 + m._11, m._24 + m._21, m._34 + m._31, m._44 + m._41);
+	planes[1] = XMFLOAT4(m._14 - m._11, m._24 - m._21, m._34 - m._31, m._44 - m._41);
+	planes[2] = XMFLOAT4(m._14 + m._12, m._24 + m._22, m._34 + m._32, m._44 + m._42);
+	planes[3] = XMFLOAT4(m._14 - m._12, m._24 - m._22, m._34 - m._32, m._44 - m._42);
+	planes[4] = XMFLOAT4(m._13, m._23, m._33, m._43);
+	planes[5] = XMFLOAT4(m._14 - m._13, m._24 - m._23, m._34 - m._33, m._44 - m._43);
+
+	// Normalize so plane distances are real distances to compare radii against
+	for (int i = 0; i < 6; i++)
+	{
+		float length = sqrtf(planes[i].x * planes[i].x + planes[i].y * planes[i].y + planes[i].z * planes[i].z);
+		if (length > 0)
+		{
+			float inv = 1.0f / length;
+			planes[i].x *= inv;
+			planes[i].y *= inv;
+			planes[i].z *= inv;
+			planes[i].w *= inv;
+		}
+	}
+}
+
+bool FrustumCuller::TestSphere(const XMFLOAT4& sphere)
+{
+	for (int i = 0; i < 6; i++)
+	{
+		float dist = planes[i].x * sphere.x + planes[i].y * sphere.y + planes[i].z * sphere.z + planes[i].w;
+		if (dist < -sphere.w)
+			return false;
+	}
+	return true;
+}
+
+// Writes the set lanes of a 4 wide result into the visible list.
+// Every lane is written, only the count moves, so there are no branches.
+static inline int AppendVisible(int mask, int first, int* visible, int written)
+{
+	visible[written] = first;		written += mask & 1;
+	visible[written] = first + 1;	written += (mask >> 1) & 1;
+	visible[written] = first + 2;	written += (mask >> 2) & 1;
+	visible[written] = first + 3;	written += (mask >> 3) & 1;
+	return written;
+}
+
+int FrustumCuller::CullSpheres(const float* x, const float* y, const float* z, const float* radius, int count, int* visible)
+{
+	// Splat every plane once up front
+	__m128 px[6], py[6], pz[6], pw[6];
+	for (int p = 0; p < 6; p++)
+	{
+		px[p] = _mm_set1_ps(planes[p].x);
+		py[p] = _mm_set1_ps(planes[p].y);
+		pz[p] = _mm_set1_ps(planes[p].z);
+		pw[p] = _mm_set1_ps(planes[p].w);
+	}
+
+	int written = 0;
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 cx = _mm_loadu_ps(x + i);
+		__m128 cy = _mm_loadu_ps(y + i);
+		__m128 cz = _mm_loadu_ps(z + i);
+		__m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radius + i));
+
+		// Inside means not entirely behind any plane
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int p = 0; p < 6; p++)
+		{
+			__m128 dist = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(px[p], cx), _mm_mul_ps(py[p], cy)),
+				_mm_add_ps(_mm_mul_ps(pz[p], cz), pw[p]));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(dist, negRadius));
+		}
+
+		written = AppendVisible(_mm_movemask_ps(inside), i, visible, written);
+	}
+
+	// Leftovers that don't fill a whole group
+	for (; i < count; i++)
+	{
+		if (TestSphere(XMFLOAT4(x[i], y[i], z[i], radius[i])))
+			visible[written++] = i;
+	}
+
+	return written;
+}
+
+int FrustumCuller::CullSpheres(const BoundingSphereList& spheres, int* visible)
+{
+	if (spheres.Count() == 0)
+		return 0;
+
+	return CullSpheres(&spheres.x[0], &spheres.y[0], &spheres.z[0], &spheres.radius[0], spheres.Count(), visible);
+}
+
+int FrustumCuller::CullBoxes(
+	const float* centerX, const float* centerY, const float* centerZ,
+	const float* extentX, const float* extentY, const float* extentZ,
+	int count, int* visible)
+{
+	// A box is outside a plane when its center is further behind it than
+	// the box reaches along the plane normal: |n.x|*e.x + |n.y|*e.y + |n.z|*e.z
+	__m128 px[6], py[6], pz[6], pw[6];
+	__m128 ax[6], ay[6], az[6];
+	for (int p = 0; p < 6; p++)
+	{
+		px[p] = _mm_set1_ps(planes[p].x);
+		py[p] = _mm_set1_ps(planes[p].y);
+		pz[p] = _mm_set1_ps(planes[p].z);
+		pw[p] = _mm_set1_ps(planes[p].w);
+		ax[p] = _mm_set1_ps(fabsf(planes[p].x));
+		ay[p] = _mm_set1_ps(fabsf(planes[p].y));
+		az[p] = _mm_set1_ps(fabsf(planes[p].z));
+	}
+
+	int written = 0;
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 cx = _mm_loadu_ps(centerX + i);
+		__m128 cy = _mm_loadu_ps(centerY + i);
+		__m128 cz = _mm_loadu_ps(centerZ + i);
+		__m128 ex = _mm_loadu_ps(extentX + i);
+		__m128 ey = _mm_loadu_ps(extentY + i);
+		__m128 ez = _mm_loadu_ps(extentZ + i);
+
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int p = 0; p < 6; p++)
+		{
+			__m128 dist = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(px[p], cx), _mm_mul_ps(py[p], cy)),
+				_mm_add_ps(_mm_mul_ps(pz[p], cz), pw[p]));
+			__m128 reach = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(ax[p], ex), _mm_mul_ps(ay[p], ey)),
+				_mm_mul_ps(az[p], ez));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(dist, reach), _mm_setzero_ps()));
+		}
+
+		written = AppendVisible(_mm_movemask_ps(inside), i, visible, written);
+	}
+
+	for (; i < count; i++)
+	{
+		bool inside = true;
+		for (int p = 0; p < 6 && inside; p++)
+		{
+			float dist = planes[p].x * centerX[i] + planes[p].y * centerY[i] + planes[p].z * centerZ[i] + planes[p].w;
+			float reach = fabsf(planes[p].x) * extentX[i] + fabsf(planes[p].y) * extentY[i] + fabsf(planes[p].z) * extentZ[i];
+			inside = dist + reach >= 0;
+		}
+		if (inside)
+			visible[written++] = i;
+	}
+
+	return written;
+}
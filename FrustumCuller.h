@@ -0,0 +1,61 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <vector>
+#include "Camera.h"
+
+// --------------------------------------------------------
+// Bounding spheres in structure-of-arrays form, so the
+// culler can load four of them with a single SSE load
+// --------------------------------------------------------
+struct BoundingSphereList
+{
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+	std::vector<float> radius;
+
+	void Clear() { x.clear(); y.clear(); z.clear(); radius.clear(); }
+	void Add(const DirectX::XMFLOAT4& sphere) { x.push_back(sphere.x); y.push_back(sphere.y); z.push_back(sphere.z); radius.push_back(sphere.w); }
+	int Count() const { return (int)x.size(); }
+};
+
+// --------------------------------------------------------
+// View frustum test for bounding spheres and boxes.
+//
+// The six planes are pulled straight out of the camera's
+// view-projection matrix.  Batches are tested four objects
+// at a time with SSE and written out as a compact list of
+// the indices that survived, in input order.
+// --------------------------------------------------------
+class FrustumCuller
+{
+public:
+	FrustumCuller();
+
+	// Rebuild the planes - call after the camera moves
+	void SetCamera(Camera* camera);
+	void SetViewProjection(DirectX::CXMMATRIX viewProjection);
+
+	bool TestSphere(const DirectX::XMFLOAT4& sphere);
+
+	// visible must have room for count indices.  Returns how many were written.
+	int CullSpheres(const float* x, const float* y, const float* z, const float* radius, int count, int* visible);
+	int CullSpheres(const BoundingSphereList& spheres, int* visible);
+
+	// Boxes are given as centers and half extents
+	int CullBoxes(
+		const float* centerX, const float* centerY, const float* centerZ,
+		const float* extentX, const float* extentY, const float* extentZ,
+		int count, int* visible);
+
+	const DirectX::XMFLOAT4* GetPlanes() { return planes; }
+
+	// Normalized planes of a (non-transposed) view-projection matrix, in
+	// the order below
+	static void ExtractPlanes(DirectX::CXMMATRIX viewProjection, DirectX::XMFLOAT4* planes);
+
+private:
+	// Left, right, bottom, top, near, far.  xyz points inwards.
+	DirectX::XMFLOAT4 planes[6];
+};
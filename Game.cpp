@@ -4,6 +4,62 @@
 #include "DDSTextureLoader.h"
 #include "btBulletCollisionCommon.h"
 #include "btBulletDynamicsCommon.h"
+#include <algorithm>
+
+// Entities this close to the player on every axis are highlighted on the minimap
+static const float MINIMAP_HIGHLIGHT_RANGE = 5.0f;
+
+// Software occlusion buffer size and how many occluders go into it per frame
+static const int OCCLUSION_BUFFER_WIDTH = 256;
+static const int OCCLUSION_BUFFER_HEIGHT = 144;
+static const int MAX_OCCLUDERS = 8;
+
+// Projected size in pixels where the main view switches to LOD 1 and LOD 2,
+// and below which an entity isn't drawn at all
+static const float LOD1_PIXELS = 96.0f;
+static const float LOD2_PIXELS = 32.0f;
+static const float LOD_CULL_PIXELS = 2.0f;
+static const float LOD_HYSTERESIS = 0.15f;
+
+// Cached visibility holds until a camera moves or turns (radians) this much
+static const float VISIBILITY_CACHE_MOVE = 2.0f;
+static const float VISIBILITY_CACHE_TURN = 0.1f;
+
+// Level text and the blob it gets cooked into
+static const char* LEVEL_TEXT_FILE = "Debug/Levels/asteroids.scene";
+static const char* LEVEL_FILE = "Debug/Levels/asteroids.sceneb";
+
+// Sectors load inside the first radius and unload outside the second.
+// Prefetch looks this many seconds ahead along the camera's velocity.
+static const float STREAM_LOAD_RADIUS = 64.0f;
+static const float STREAM_UNLOAD_RADIUS = 96.0f;
+static const float STREAM_PREFETCH_TIME = 1.0f;
+static const int MAX_STREAMED_SPAWNS_PER_FRAME = 32;
+
+// Background field simulated outside Bullet.  Field asteroids get a rigid
+// body inside the promote range of the player or a bullet and give it back
+// outside the demote range.
+static const int FIELD_ASTEROID_COUNT = 20000;
+static const float FIELD_HALF_SIZE = 200.0f;
+static const float FIELD_ASTEROID_RADIUS = 1.0f;
+static const float FIELD_PROMOTE_RANGE = 20.0f;
+static const float FIELD_DEMOTE_RANGE = 30.0f;
+static const int MAX_FIELD_PROMOTIONS_PER_FRAME = 16;
+static const int FIELD_GRID_BUCKETS = 8192;
+
+// Gameplay objects within this distance of the camera update every frame,
+// and every doubling of the distance halves how often they update
+static const float UPDATE_NEAR_DISTANCE = 25.0f;
+
+// Asteroids farther than this from the camera are drawn as impostor quads.
+// The atlas is cooked from the level's asteroid mesh when it's out of date.
+static const float IMPOSTOR_DISTANCE = 60.0f;
+static const int MAX_IMPOSTORS = 16384;
+static const char* IMPOSTOR_MESH_FILE = "Debug/Models/asteroid.obj";
+static const char* IMPOSTOR_FILE = "Debug/Models/asteroid.impostor";
+
+// Nearer asteroids are drawn instanced, one draw per mesh LOD
+static const int MAX_ASTEROID_INSTANCES = 4096;
 
 
 
@@ -71,18 +127,28 @@ Game::~Game()
 	delete skyPS;
 	delete particleVS;
 	delete particlePS;
+	delete impostorVS;
+	delete impostorPS;
+	delete instancedVS;
 	delete material2;
 
 	for (auto& e : entities) delete e;
 	for (auto& m : meshes) delete m;
-	
-	for (auto& ae : astEntities) delete ae;
-	//for (auto& b : bulletEntities) delete b;
 	delete camera;
 	delete camera2;
 
 	delete minimapPlayer;
 	delete minimapPlayerEntity;
+	delete sceneGraph;
+	delete sceneTree;
+	delete proximityGrid;
+	delete occlusionCuller;
+	delete worldStreamer;
+
+	if (inputRecorder)
+		inputRecorder->Close();
+	delete inputRecorder;
+	delete inputReplayer;
 
 	//Clean up normal map stuff
 	metalSRV->Release();
@@ -106,27 +172,34 @@ Game::~Game()
 	frameTexture->Release();
 
 
-	for (int i = 0; i < asteroids.size(); i++)
+	//Clean up the asteroids and bullets, along with their rigid bodies.
+	//Asteroid bodies go back to their pool, which is freed below.
+	ecs.Each<PhysicsBodyComponent, RenderComponent>([this](EntityId id, PhysicsBodyComponent& physics, RenderComponent& render)
 	{
-		world->removeCollisionObject(asteroids[i]->body);
-		btMotionState* motionState = asteroids[i]->body->getMotionState();
-		btCollisionShape* shape = asteroids[i]->body->getCollisionShape();
-		delete asteroids[i]->body;
-		delete shape;
-		delete motionState;
-		delete asteroids[i];
-	}
+		world->removeCollisionObject(physics.body);
 
-	/*for (int i = 0; i < bullets.size(); i++)
-	{
-		world->removeCollisionObject(bullets[i]->bulletBody);
-		btMotionState* motionState = bullets[i]->bulletBody->getMotionState();
-		btCollisionShape* shape = bullets[i]->bulletBody->getCollisionShape();
-		delete bullets[i]->bulletBody;
+		AsteroidComponent* asteroid = ecs.GetComponent<AsteroidComponent>(id);
+		if (asteroid)
+		{
+			asteroidBodyPool->Destroy(asteroid->body);
+			return;
+		}
+
+		btMotionState* motionState = physics.body->getMotionState();
+		btCollisionShape* shape = physics.body->getCollisionShape();
+		delete physics.body;
 		delete shape;
 		delete motionState;
-		delete bullets[i];
-	}*/
+	});
+
+	//Destroys whatever render entities are still alive
+	delete entityPool;
+	delete asteroidBodyPool;
+	delete asteroidField;
+	delete fieldGrid;
+	delete fieldEntity;
+	delete impostorRenderer;
+	delete asteroidInstances;
 
 	delete world;
 	delete collisionConfig;
@@ -154,6 +227,9 @@ Game::~Game()
 // --------------------------------------------------------
 void Game::Init()
 {
+	//Seeds rand() before anything random is spawned, from the replay if there is one
+	StartInput();
+
 	// Helper methods for loading shaders, creating some basic
 	// geometry to draw and some simple camera matrices.
 	//  - You'll be expanding and/or replacing these later
@@ -162,6 +238,31 @@ void Game::Init()
 	CreateMatrices();
 	CreateBasicGeometry();
 
+	//Scene hierarchy - the minimap marker is parented to an anchor
+	//node that follows the player, instead of being synced by hand
+	sceneGraph = new SceneGraph(256);
+	for (auto& e : entities) sceneGraph->CreateNode(e);
+	playerNode = sceneGraph->CreateNode(0);
+	minimapPlayerNode = sceneGraph->CreateNode(minimapPlayerEntity);
+	sceneGraph->Attach(minimapPlayerNode, playerNode);
+
+	//Spatial tree over everything that gets frustum culled.  The sky and
+	//the minimap marker are always drawn, so they stay out of it.
+	sceneTree = new DynamicAabbTree(0.5f);
+	proximityGrid = new SpatialHashGrid(MINIMAP_HIGHLIGHT_RANGE, 256);
+	occlusionCuller = new OcclusionCuller(OCCLUSION_BUFFER_WIDTH, OCCLUSION_BUFFER_HEIGHT);
+	lodSelector.SetThresholds(LOD1_PIXELS, LOD2_PIXELS);
+	lodSelector.SetCullPixels(LOD_CULL_PIXELS);
+	lodSelector.SetHysteresis(LOD_HYSTERESIS);
+	visibility.SetCacheThresholds(VISIBILITY_CACHE_MOVE, VISIBILITY_CACHE_TURN);
+	for (int i = 0; i <= 1; i++)
+	{
+		entities[i]->UpdateWorldMatrix();
+		staticProxies.push_back(sceneTree->CreateProxy(Aabb::FromSphere(entities[i]->GetWorldBoundingSphere()), entities[i]));
+		staticVersions.push_back(entities[i]->GetTransformVersion());
+		visibility.ProxyChanged(staticProxies.back());
+	}
+
 	//UI
 
 	//Create SpriteBatch
@@ -222,10 +323,6 @@ void Game::Init()
 		particleTexture
 	);
 
-	//set up directional lights
-	dirLight1.SetLightValues(XMFLOAT4(0.1f, 0.1f, 0.1f, 1.0f), XMFLOAT4(0.0f, 0.0f, 1.0f, 1.0f), XMFLOAT3(1.0f, -1.0f, 0));
-	dirLight2.SetLightValues(XMFLOAT4(0.1f, 0.1f, 0.1f, 1.0f), XMFLOAT4(1.0f, 0.0f, 0.0f, 1.0f), XMFLOAT3(-1.0f, -1.0f, 0));
-	
 	/*********Trial Bullet*******/
 	//btBoxShape* box = new btBoxShape(btVector3(1, 1, 1)); 
 	collisionConfig = new btDefaultCollisionConfiguration();      // Setting the collision properties to default
@@ -245,9 +342,51 @@ void Game::Init()
 	planeBody = new btRigidBody(infoPlane);                                             // Initiate the rigid body
 	world->addRigidBody(planeBody);                                                     // Add body to world
 
-	for (int i = 0; i < 5; i++)
+	//Spawning never allocates, asteroids and bullets take their entities from here
+	entityPool = new ObjectPool<GameEntity>(MAX_GAMEPLAY_ENTITIES);
+	asteroidBodyPool = new ObjectPool<SphereBody>(MAX_ASTEROIDS);
+	entityPool->Prewarm();
+	asteroidBodyPool->Prewarm();
+	releaseScratch.reserve(MAX_GAMEPLAY_ENTITIES);
+
+	//Fill the background field.  Nothing in it has a rigid body yet.
+	asteroidField = new AsteroidField(FIELD_ASTEROID_COUNT, FIELD_HALF_SIZE);
+	fieldEntity = new GameEntity(sphereMesh, material1);
+	fieldLods.resize(FIELD_ASTEROID_COUNT, 0);
+	fieldGrid = new SpatialHashGrid(FIELD_PROMOTE_RANGE, FIELD_GRID_BUCKETS);
+	fieldGridSlots.reserve(FIELD_ASTEROID_COUNT);
+	fieldVisible.resize(FIELD_ASTEROID_COUNT);
+	for (int i = 0; i < FIELD_ASTEROID_COUNT; i++)
 	{
-		CreateAsteroid(1, 5+(i * 2), 5, 5, 1);
+		XMFLOAT3 position(
+			((float)rand() / RAND_MAX * 2.0f - 1.0f) * FIELD_HALF_SIZE,
+			((float)rand() / RAND_MAX * 2.0f - 1.0f) * FIELD_HALF_SIZE,
+			((float)rand() / RAND_MAX * 2.0f - 1.0f) * FIELD_HALF_SIZE);
+		XMFLOAT3 velocity((float)(rand() % 5 - 2), (float)(rand() % 5 - 2), (float)(rand() % 5 - 2));
+		XMFLOAT3 spin((float)rand() / RAND_MAX - 0.5f, (float)rand() / RAND_MAX - 0.5f, (float)rand() / RAND_MAX - 0.5f);
+		asteroidField->Spawn(position, velocity, XMFLOAT4(0, 0, 0, 1), spin, FIELD_ASTEROID_RADIUS);
+	}
+
+	//Far asteroids, field or not, are drawn from the impostor atlas
+	if (!ImpostorAtlas::IsCookedUpToDate(IMPOSTOR_MESH_FILE, IMPOSTOR_FILE))
+		ImpostorAtlas::Cook(IMPOSTOR_MESH_FILE, IMPOSTOR_FILE);
+	if (!asteroidImpostor.Load(IMPOSTOR_FILE, device))
+		printf("Could not load impostor atlas %s\n", IMPOSTOR_FILE);
+	impostorRenderer = new ImpostorRenderer(MAX_IMPOSTORS, device, impostorVS, impostorPS);
+	asteroidInstances = new InstanceBatch(MAX_ASTEROID_INSTANCES, device);
+
+	//Systems run in this order every frame, in parallel where they don't conflict
+	gameSystems.AddSystem(new HitAsteroidSystem(&commands));
+	updateScheduler.SetNearDistance(UPDATE_NEAR_DISTANCE);
+	gameSystems.AddSystem(new PhysicsTransformSystem(entityPool, &updateScheduler));
+
+	//The level's asteroids and scenery stream in by sector around the camera
+	worldStreamer = 0;
+	lastCameraPosition = camera->GetPosition();
+	if (levelFile.IsLoaded())
+	{
+		worldStreamer = new WorldStreamer(&levelFile, STREAM_LOAD_RADIUS, STREAM_UNLOAD_RADIUS, STREAM_PREFETCH_TIME);
+		sectorEntities.resize(levelFile.GetSectorCount());
 	}
 
 
@@ -313,6 +452,21 @@ void Game::LoadShaders()
 	particlePS = new SimplePixelShader(device, context);
 	if (!particlePS->LoadShaderFile(L"Debug/ParticlePS.cso"))
 		particlePS->LoadShaderFile(L"ParticlePS.cso");
+
+	//load impostor vertex and pixel shaders
+	impostorVS = new SimpleVertexShader(device, context);
+	if (!impostorVS->LoadShaderFile(L"Debug/ImpostorVS.cso"))
+		impostorVS->LoadShaderFile(L"ImpostorVS.cso");
+
+	impostorPS = new SimplePixelShader(device, context);
+	if (!impostorPS->LoadShaderFile(L"Debug/ImpostorPS.cso"))
+		impostorPS->LoadShaderFile(L"ImpostorPS.cso");
+
+	//load the instanced vertex shader, its per instance inputs come from
+	//a second vertex buffer
+	instancedVS = new SimpleVertexShader(device, context);
+	if (!instancedVS->LoadShaderFile(L"Debug/InstancedVS.cso"))
+		instancedVS->LoadShaderFile(L"InstancedVS.cso");
 }
 
 void Game::CreateMaterials()
@@ -379,43 +533,67 @@ void Game::CreateMatrices()
 // --------------------------------------------------------
 void Game::CreateBasicGeometry()
 {
-	sphereMesh = new Mesh("Debug/Models/asteroid.obj", device);
-	meshes.push_back(sphereMesh);
-
-	sphereEntity = new GameEntity(sphereMesh, material1);
-	entities.push_back(sphereEntity);
-
-	for (int i = 0; i < 5; i++)
+	//The level lives in a cooked scene file.  Cook it again if the text
+	//has changed, then map it and build the scenery straight from its arrays.
+	//A blob from an older version of the format gets cooked again too.
+	if (!SceneFile::IsCookedUpToDate(LEVEL_TEXT_FILE, LEVEL_FILE))
+		SceneFile::Cook(LEVEL_TEXT_FILE, LEVEL_FILE);
+	if (!levelFile.Load(LEVEL_FILE) && SceneFile::Cook(LEVEL_TEXT_FILE, LEVEL_FILE))
+		levelFile.Load(LEVEL_FILE);
+	if (!levelFile.IsLoaded())
+		printf("Could not load level %s\n", LEVEL_FILE);
+
+	if (levelFile.IsLoaded())
 	{
-		GameEntity* ast = new GameEntity(sphereMesh, material1);
-		ast->SetScale(0.5, 0.5, 0.5);
-		astEntities.push_back(ast);
-	}
+		for (int i = 0; i < levelFile.GetMeshCount(); i++)
+			meshes.push_back(new Mesh(levelFile.GetMeshPath(i), device));
 
-	//Creating bullet entities for drawing them. Not needed anymore
+		//Only global entities are built here, the rest are streamed in by sector
+		const SceneEntityRecord* levelEntities = levelFile.GetEntities();
+		const SceneTransformRecord* levelTransforms = levelFile.GetTransforms();
+		for (int i = 0; i < levelFile.GetEntityCount(); i++)
+		{
+			if (!(levelEntities[i].flags & SCENE_ENTITY_GLOBAL))
+				continue;
+
+			const SceneTransformRecord& transform = levelTransforms[i];
+			GameEntity* entity = new GameEntity(meshes[levelEntities[i].mesh], GetLevelMaterial(levelEntities[i].material));
+			entity->SetPosition(transform.position.x, transform.position.y, transform.position.z);
+			entity->SetOrientation(transform.orientation.x, transform.orientation.y, transform.orientation.z, transform.orientation.w);
+			entity->SetScale(transform.scale.x, transform.scale.y, transform.scale.z);
+			entities.push_back(entity);
+		}
+	}
 
-	/*for (int i = 0; i < 5; i++)
+	//Without a usable level fall back to the scenery that used to be built
+	//here, so the game still runs
+	if (entities.size() < 3)
 	{
-		GameEntity* bul = new GameEntity(sphereMesh, material1);
-		bul->SetScale(0.25, 0.25, 0.25);
-		bulletEntities.push_back(bul);
-	}*/
-
-	planeMesh = new Mesh("Debug/Models/cube.obj", device);
-	meshes.push_back(planeMesh);
-	planeEntity = new GameEntity(planeMesh, material1);
-	entities.push_back(planeEntity);
-
-	cubeMesh = new Mesh("Debug/Models/cube.obj", device);
-	meshes.push_back(cubeMesh);
+		printf("Level %s has no scenery, using the built in scenery\n", LEVEL_FILE);
+		for (auto& e : entities) delete e;
+		entities.clear();
+
+		Mesh* asteroidMesh = new Mesh("Debug/Models/asteroid.obj", device);
+		meshes.push_back(asteroidMesh);
+		Mesh* boxMesh = new Mesh("Debug/Models/cube.obj", device);
+		meshes.push_back(boxMesh);
+
+		entities.push_back(new GameEntity(asteroidMesh, material1));
+		entities.push_back(new GameEntity(boxMesh, material1));
+		entities.push_back(new GameEntity(boxMesh, material1));
+		entities[1]->SetScale(8.0f, 0.1f, 8.0f);
+	}
 
-	cubeEntity = new GameEntity(cubeMesh, material1);
-	entities.push_back(cubeEntity);
+	//The level lists the test asteroid, the plane and the sky cube first
+	sphereEntity = entities[0];
+	planeEntity = entities[1];
+	cubeEntity = entities[2];
+	sphereMesh = sphereEntity->GetMesh();
+	planeMesh = planeEntity->GetMesh();
+	cubeMesh = cubeEntity->GetMesh();
 
 	minimapPlayer = new Mesh("Debug/Models/cube.obj", device);
 	minimapPlayerEntity = new GameEntity(minimapPlayer, material2);
-
-	entities[1]->SetScale(8.0f, 0.1f, 8.0f);
 }
 
 
@@ -445,6 +623,17 @@ void Game::OnResize()
 // --------------------------------------------------------
 void Game::Update(float deltaTime, float totalTime)
 {
+	//Everything below reads input from this snapshot, never the keyboard
+	if (!SampleInput(deltaTime, totalTime))
+		return;
+
+	if (input.IsDown(INPUT_CLICK_PLAY))
+		mouseAtPlay = true;
+	if (input.IsDown(INPUT_CLICK_QUIT))
+		mouseAtQuit = true;
+	if (input.lookX != 0.0f || input.lookY != 0.0f)
+		camera->Rotate(input.lookY, input.lookX);
+
 	//Game State Management
 	if (mouseAtPlay)
 	{
@@ -487,20 +676,15 @@ void Game::Update(float deltaTime, float totalTime)
 		//Adding more asteroids in the game as time passes
 		if (addAsteroidTimer <= 0.0f)
 		{
-			GameEntity* ast = new GameEntity(sphereMesh, material1);
-			ast->SetScale(0.5, 0.5, 0.5);
-			astEntities.push_back(ast);
-
 			addAsteroidTimer = 5.0f;
 
-			CreateAsteroid(1, xPosition, yPosition, zPosition, 1.0);
-
-			asteroidCount++;
+			AsteroidSpawn spawn = { 1.0f, xPosition, yPosition, zPosition, 1.0f };
+			commands.Event(INVALID_ENTITY, GAME_COMMAND_SPAWN_ASTEROID, INVALID_ENTITY, spawn);
 		}
 
 		fireTimer -= deltaTime;
 
-		if (fireTimer <= 0.0f && (GetAsyncKeyState('F') & 0x8000))
+		if (fireTimer <= 0.0f && input.IsDown(INPUT_F))
 		{
 			//Used to create and fire bullets before using Raycasting
 
@@ -511,25 +695,61 @@ void Game::Update(float deltaTime, float totalTime)
 			fireTimer = 3.0f;
 			CreateBullets(0.25, 4, 5, 0, 1.0);*/
 			
-			//Firing using Raycasting
+			//Firing using Raycasting. The scene tree finds what the ray passes
+			//near and each candidate's mesh BVH says where it really gets hit,
+			//so shots match what's drawn instead of the physics spheres
 			fireTimer = 0.2f;
-			btCollisionWorld::ClosestRayResultCallback rayCallBack(btVector3(camera->GetPosition().x, camera->GetPosition().y, camera->GetPosition().z), btVector3(camera->GetPosition().x, camera->GetPosition().y, camera->GetPosition().z + 1000));
-			world->rayTest(btVector3(camera->GetPosition().x, camera->GetPosition().y, camera->GetPosition().z), btVector3(camera->GetPosition().x, camera->GetPosition().y, camera->GetPosition().z + 1000), rayCallBack);
-			if (rayCallBack.hasHit())
+			BvhRay shot = { camera->GetPosition(), XMFLOAT3(0, 0, 1), 1000.0f };
+			int hitProxy = -1;
+			float bodyDistance = 1000.0f;
+			sceneTree->RayCast(shot.origin, shot.direction, shot.maxDistance, [&](int proxy, float maxDistance)
+			{
+				BvhRay ray = shot;
+				ray.maxDistance = maxDistance;
+				float distance = ((GameEntity*)sceneTree->GetUserData(proxy))->IntersectRay(ray);
+				if (distance >= 0 && distance < bodyDistance)
+				{
+					bodyDistance = distance;
+					hitProxy = proxy;
+				}
+				return distance;
+			});
+
+			//Field asteroids have no entities for the ray to hit, so they're
+			//tested separately and the closer of the two takes the shot
+			int fieldHit;
+			asteroidField->RayCast(camera->GetPosition(), XMFLOAT3(0, 0, 1), bodyDistance, fieldHit);
+			if (fieldHit >= 0)
+			{
+				asteroidField->Remove(fieldHit);
+			}
+			else if (hitProxy >= 0)
 			{
-				((asteroidObject*)(rayCallBack.m_collisionObject->getUserPointer()))->hit = true;
+				//Only asteroids carry an AsteroidComponent, anything else is left alone
+				EntityId hitEntity = hitProxy < (int)proxyEntities.size() ? proxyEntities[hitProxy] : INVALID_ENTITY;
+				AsteroidComponent* asteroid = ecs.GetComponent<AsteroidComponent>(hitEntity);
+				if (asteroid)
+					asteroid->hit = true;
 			}
 		}
 
-		//Movement of the asteroid entities and meshes based on the movement of the rigidbodies
-		for (int i = 0; i < astEntities.size(); i++)
+		//Finds shot asteroids, then moves the asteroid entities
+		//and meshes based on the movement of the rigidbodies. Far ones are only
+		//moved on the frames the update scheduler gives them.
+		updateScheduler.SetViewer(camera->GetPosition());
+		updateScheduler.BeginFrame(deltaTime);
+		gameSystems.Run(ecs, deltaTime);
+
+		//Sync point for everything the systems and the code above asked to
+		//spawn or despawn. Main thread commands use INVALID_ENTITY as their
+		//key, so they play back after the systems' in a fixed order.
+		commands.Playback(ecs, [this](int code, EntityId id, const void* payload)
 		{
-			btTransform astSpace;
-			asteroids[i]->body->getMotionState()->getWorldTransform(astSpace);
-			astEntities[i]->SetPosition(astSpace.getOrigin().x(), astSpace.getOrigin().y(), astSpace.getOrigin().z());
+			RunCommand(code, id, payload);
+		});
 
-			astEntities[i]->UpdateWorldMatrix();
-		}
+		//Drifts the background field and swaps asteroids between it and Bullet
+		UpdateAsteroidField(deltaTime);
 
 		//Setting the position of the bullets based on the movement of the rigidbodies. Not needed anymore!
 
@@ -542,8 +762,7 @@ void Game::Update(float deltaTime, float totalTime)
 			bulletEntities[i]->UpdateWorldMatrix();
 		}*/
 		
-		XMFLOAT3 playerPos = camera->GetPosition();
-		minimapPlayerEntity->SetPosition(playerPos.x, playerPos.y, playerPos.z);
+		sceneGraph->SetLocalPosition(playerNode, camera->GetPosition());
 
 		//Deleting asteroids after a period of time!
 		asteroidDeathTimer -= deltaTime;
@@ -551,20 +770,45 @@ void Game::Update(float deltaTime, float totalTime)
 		if (asteroidDeathTimer <= 0.0f)
 		{
 			asteroidDeathTimer = 5.0f;
-			if (asteroids[asteroidDeathCounter]->body->isInWorld())
+
+			EntityId oldest = INVALID_ENTITY;
+			ecs.Each<AsteroidComponent>([&](EntityId id, AsteroidComponent& asteroid)
+			{
+				if (asteroid.spawnOrder == asteroidDeathCounter)
+					oldest = id;
+			});
+
+			if (oldest != INVALID_ENTITY && ecs.GetComponent<AsteroidComponent>(oldest)->fieldIndex >= 0)
 			{
-				RemoveAsteriod(asteroidDeathCounter);
+				//Field asteroids go back to the field instead of timing out
+				asteroidDeathCounter++;
+			}
+			else if (oldest != INVALID_ENTITY && ecs.GetComponent<PhysicsBodyComponent>(oldest)->body->isInWorld())
+			{
+				RemoveAsteriod(oldest);
+				asteroidDeathCounter++;
+			}
+			else if (oldest == INVALID_ENTITY && asteroidDeathCounter < asteroidCount)
+			{
+				//Already shot and released, move on to the next one
 				asteroidDeathCounter++;
 			}
 		}
 
+		//Gives the pool slots of asteroids that left the world back
+		ReleaseDeadAsteroids();
+
 		// Update the camera
-		camera->Update(deltaTime);
-		camera2->Update(deltaTime);
+		camera->Update(deltaTime, input);
+		camera2->Update(deltaTime, input);
+
+		//Bring sectors near the camera in, and let far ones go
+		StreamWorld(deltaTime);
 
-		entities[0]->UpdateWorldMatrix();
-		entities[1]->UpdateWorldMatrix();
-		minimapPlayerEntity->UpdateWorldMatrix();
+		//Propagates transforms for the entities and anything attached to them
+		sceneGraph->UpdateTransforms();
+		UpdateSceneTree();
+		UpdateProximity();
 
 		//Asteroid Movement, test asteroids
 		sphereEntity->Move(5.0f, 0.0f, 0);
@@ -594,7 +838,7 @@ void Game::Update(float deltaTime, float totalTime)
 		//Trail particle
 		static bool isTabPressedLastFrame = false;
 		static float shootTimer = 0.0f;
-		bool isTabPressed = GetAsyncKeyState(VK_TAB);
+		bool isTabPressed = input.IsDown(INPUT_TAB);
 		
 		if (isTabPressed && bulletTimer <= 0.0f)
 		{
@@ -612,7 +856,7 @@ void Game::Update(float deltaTime, float totalTime)
 			emitter->SpawnParticle();
 			shootTimer -= deltaTime;
 		}
-		emitter->UpdateEmitterPosition(deltaTime);
+		emitter->UpdateEmitterPosition(deltaTime, input);
 	
 		emitter->Update(deltaTime);
 		//emitter->UpdateEmitterVelocity();
@@ -663,16 +907,6 @@ void Game::Update(float deltaTime, float totalTime)
 	//}
 
 
-	//Destroying asteroids when hit
-	for (int i = 0; i < asteroids.size(); i++)
-	{
-		if (asteroids[i]->hit)
-		{
-			asteroids[i]->body->setLinearVelocity(btVector3(0, 0, 0));
-			world->removeRigidBody(asteroids[i]->body);
-		}
-	}
-
 	//Destroying bullets when collision detected, not needed anymore
 	/*for (int i = 0; i < bullets.size(); i++)
 	{
@@ -685,7 +919,7 @@ void Game::Update(float deltaTime, float totalTime)
 	
 
 	// Quit if the escape key is pressed
-	if (GetAsyncKeyState(VK_ESCAPE))
+	if (input.IsDown(INPUT_ESCAPE))
 		Quit();
 
 	tgroup.join_all();
@@ -734,59 +968,50 @@ void Game::Draw(float deltaTime, float totalTime)
 	
 	case GamePlay:
 	{
+		//Work out what every view can see before drawing any of them
+		GatherVisibility();
+
+		//Whatever drew last frame left state the renderer doesn't know about
+		renderer.InvalidateState();
+
 		//Draw the sky
 		vertexBuffer = entities[2]->GetMesh()->GetVertexBuffer();
 		indexBuffer = entities[2]->GetMesh()->GetIndexBuffer();
 
 		//Set the buffers in the input assembler
-		context->IASetVertexBuffers(0, 1, &vertexBuffer, &stride, &offset);
-		context->IASetIndexBuffer(indexBuffer, DXGI_FORMAT_R32_UINT, 0);
+		renderer.BindVertexBuffer(context, 0, vertexBuffer, sizeof(Vertex));
+		renderer.BindIndexBuffer(context, indexBuffer);
 
 		//Set up the sky shaders
 		skyVS->SetMatrix4x4("view", camera->GetView());
 		skyVS->SetMatrix4x4("projection", camera->GetProjection());
 		skyVS->CopyAllBufferData();
-		skyVS->SetShader();
+		renderer.BindVertexShader(skyVS);
 
-		skyPS->SetShaderResourceView("Sky", skySRV);
+		renderer.BindPixelResource(skyPS, "Sky", skySRV);
 		skyPS->CopyAllBufferData();
-		skyPS->SetShader();
+		renderer.BindPixelShader(skyPS);
 
-		context->RSSetState(rsSky);
-		context->OMSetDepthStencilState(dsSky, 0);
+		renderer.BindRasterizerState(context, rsSky);
+		renderer.BindDepthStencilState(context, dsSky);
 		context->DrawIndexed(entities[2]->GetMesh()->GetIndexCount(), 0, 0);
 
 		// Reset the render states we've changed
-		context->RSSetState(0);
-		context->OMSetDepthStencilState(0, 0);
+		renderer.BindRasterizerState(context, 0);
+		renderer.BindDepthStencilState(context, 0);
 		//*********************************************************//
 		
-		//Draw the actual asteroids objects.
-		for (int i = 0; i <= 1; i++) {
-			renderer.SetVertexBuffer(entities[i], vertexBuffer);
-			renderer.SetIndexBuffer(entities[i], indexBuffer);
-			renderer.SetVertexShader(vertexShader, entities[i], camera);
-			renderer.SetPixelShader(pixelShader, entities[i], camera);
-			context->IASetVertexBuffers(0, 1, &vertexBuffer, &stride, &offset);
-			context->IASetIndexBuffer(indexBuffer, DXGI_FORMAT_R32_UINT, 0);
-			// Finally do the actual drawing
-			context->DrawIndexed(entities[i]->GetMesh()->GetIndexCount(), 0, 0);
-		}
-		//Asteroid spawning
-		for (int i = 0; i < asteroids.size(); i++)
-		{
-			if (asteroids[i]->body->isInWorld())
-			{
-				renderer.SetVertexBuffer(astEntities[i], vertexBuffer);
-				renderer.SetIndexBuffer(astEntities[i], indexBuffer);
-				renderer.SetVertexShader(vertexShader, astEntities[i], camera);
-				renderer.SetPixelShader(pixelShader, astEntities[i], camera);
-				context->IASetVertexBuffers(0, 1, &vertexBuffer, &stride, &offset);
-				context->IASetIndexBuffer(indexBuffer, DXGI_FORMAT_R32_UINT, 0);
-				// Finally do the actual drawing
-				context->DrawIndexed(astEntities[i]->GetMesh()->GetIndexCount(), 0, 0);
-			}	
-		}
+		//Draw the actual asteroids objects, only the ones the camera can see.
+		//Asteroids are gathered into instanced draws and far ones into one
+		//batch of impostors, both drawn after everything else.
+		impostorRenderer->Begin(&asteroidImpostor, camera);
+		asteroidInstances->Clear();
+		DrawVisibleEntities(mainView, false);
+		DrawAsteroidField();
+		asteroidInstances->Upload(context);
+		renderer.DrawInstances(context, *asteroidInstances, instancedVS, camera);
+		impostorRenderer->Draw(context, camera, fieldEntity->GetMaterial(), renderer.GetDirLight1(), renderer.GetDirLight2());
+		renderer.InvalidateState();
 
 		//Drawing Bullets, not needed anymore
 		/*for (int i = 0; i < bullets.size(); i++)
@@ -808,16 +1033,16 @@ void Game::Draw(float deltaTime, float totalTime)
 		// Particle states`	
 
 
-		float blend[4] = { 1,1,1,1 };
-		context->OMSetBlendState(particleBlendState, blend, 0xffffffff);  // Additive blending
-		context->OMSetDepthStencilState(particleDepthState, 0);			// No depth WRITING
+		renderer.BindBlendState(context, particleBlendState);			// Additive blending
+		renderer.BindDepthStencilState(context, particleDepthState);	// No depth WRITING
 
 																		// Draw the emitter
 		emitter->Draw(context, camera);
+		renderer.InvalidateState();
 
 		// Reset to default states for next frame
-		context->OMSetBlendState(0, blend, 0xffffffff);
-		context->OMSetDepthStencilState(0, 0);
+		renderer.BindBlendState(context, 0);
+		renderer.BindDepthStencilState(context, 0);
 
 		/*****************************************************************/
 
@@ -842,47 +1067,21 @@ void Game::Draw(float deltaTime, float totalTime)
 			D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL,
 			1.0f,
 			0);
-		UINT stride = sizeof(Vertex);
-		UINT offset = 0;
 		context->RSSetViewports(1, &viewportMiniMap);
-		XMFLOAT3 entityPos;
-		for (int i = 0; i <= 1; i++) {
-			entityPos = entities[i]->GetPosition();
-			renderer.SetVertexBuffer(entities[i], vertexBuffer);
-			renderer.SetIndexBuffer(entities[i], indexBuffer);
-			renderer.SetVertexShader(vertexShader, entities[i], camera2);
-			renderer.SetPixelShaderMiniMap(pixelShader, entities[i], camera2, redSRV, entityPos, camera);
-			context->IASetVertexBuffers(0, 1, &vertexBuffer, &stride, &offset);
-			context->IASetIndexBuffer(indexBuffer, DXGI_FORMAT_R32_UINT, 0);
-			// Finally do the actual drawing
-			context->DrawIndexed(entities[i]->GetMesh()->GetIndexCount(), 0, 0);
-		}
+		//The sprites changed state behind the renderer's back
+		renderer.InvalidateState();
 
-		//Asteroid spawning
-		for (int i = 0; i < asteroids.size(); i++)
-		{
-			if (asteroids[i]->body->isInWorld())
-			{
-				entityPos = astEntities[i]->GetPosition();
-				renderer.SetVertexBuffer(astEntities[i], vertexBuffer);
-				renderer.SetIndexBuffer(astEntities[i], indexBuffer);
-				renderer.SetVertexShader(vertexShader, astEntities[i], camera2);
-				renderer.SetPixelShaderMiniMap(pixelShader, astEntities[i], camera2, redSRV, entityPos, camera);
-				context->IASetVertexBuffers(0, 1, &vertexBuffer, &stride, &offset);
-				context->IASetIndexBuffer(indexBuffer, DXGI_FORMAT_R32_UINT, 0);
-				// Finally do the actual drawing
-				context->DrawIndexed(astEntities[i]->GetMesh()->GetIndexCount(), 0, 0);
-			}
-
-		}
+		//Same again from the minimap camera
+		DrawVisibleEntities(minimapView, true);
 
-		entityPos = minimapPlayerEntity->GetPosition();
+		XMFLOAT3 entityPos;
+		entityPos = minimapPlayerEntity->GetWorldPosition();
 		renderer.SetVertexBuffer(minimapPlayerEntity, vertexBuffer);
 		renderer.SetIndexBuffer(minimapPlayerEntity, indexBuffer);
 		renderer.SetVertexShader(vertexShader, minimapPlayerEntity, camera2);
 		renderer.SetPixelShader(pixelShader, minimapPlayerEntity, camera2);
-		context->IASetVertexBuffers(0, 1, &vertexBuffer, &stride, &offset);
-		context->IASetIndexBuffer(indexBuffer, DXGI_FORMAT_R32_UINT, 0);
+		renderer.BindVertexBuffer(context, 0, vertexBuffer, sizeof(Vertex));
+		renderer.BindIndexBuffer(context, indexBuffer);
 		// Finally do the actual drawing
 		context->DrawIndexed(minimapPlayerEntity->GetMesh()->GetIndexCount(), 0, 0);
 
@@ -900,18 +1099,26 @@ void Game::Draw(float deltaTime, float totalTime)
 }
 
 //Function to create Asteroids
-btRigidBody* Game::CreateAsteroid(float rad, float x, float y, float z, float mass)
+EntityId Game::CreateAsteroid(float rad, float x, float y, float z, float mass)
 {
 	btTransform sphereTransform;
 	sphereTransform.setIdentity();
 	sphereTransform.setOrigin(btVector3(x, y, z));
-	btSphereShape* sphere = new btSphereShape(rad);
-	btVector3 inertia(0, 0, 0);
-	if (mass != 0.0f)
-		sphere->calculateLocalInertia(mass, inertia);
-	btMotionState* motion = new btDefaultMotionState(sphereTransform);
-	btRigidBody::btRigidBodyConstructionInfo info(mass, motion, sphere, inertia);
-	btRigidBody* body = new btRigidBody(info);
+
+	//Body, shape and motion state are built in place in a pool slot.  Out
+	//of slots or entities, skip this spawn rather than grow.
+	PoolHandle bodyHandle = asteroidBodyPool->Create(rad, sphereTransform, mass);
+	if (bodyHandle == InvalidPoolHandle())
+		return INVALID_ENTITY;
+
+	PoolHandle handle = entityPool->Create(sphereMesh, material1);
+	if (handle == InvalidPoolHandle())
+	{
+		asteroidBodyPool->Destroy(bodyHandle);
+		return INVALID_ENTITY;
+	}
+
+	btRigidBody* body = &asteroidBodyPool->Get(bodyHandle)->body;
 	world->addRigidBody(body);
 	
 	
@@ -932,15 +1139,32 @@ btRigidBody* Game::CreateAsteroid(float rad, float x, float y, float z, float ma
 	}
 
 	body->setLinearVelocity(btVector3(xSpeed, ySpeed, zSpeed));
-	
-	asteroids.push_back(new asteroidObject(body));
-	body->setUserPointer(asteroids[asteroids.size() - 1]);
 
-	return body;
+	GameEntity* ast = entityPool->Get(handle);
+	ast->SetScale(0.5, 0.5, 0.5);
+	ast->SetPosition(x, y, z);
+	ast->UpdateWorldMatrix();
+
+	PhysicsBodyComponent physics = { body };
+	RenderComponent render = { handle, sceneTree->CreateProxy(Aabb::FromSphere(ast->GetWorldBoundingSphere()), ast), ast->GetTransformVersion() };
+	visibility.ProxyChanged(render.boundsProxy);
+	AsteroidComponent asteroid = { false, asteroidCount++, bodyHandle, -1 };
+	UpdateRateComponent rate = updateScheduler.Register();
+	EntityId id = ecs.CreateEntity(physics, render, asteroid, rate);
+	SetProxyEntity(render.boundsProxy, id);
+
+	//Lets anything coming back from Bullet map the body to its entity
+	body->setUserIndex((int)id);
+
+	return id;
 }
 
-btRigidBody * Game::CreateBullets(float rad, float x, float y, float z, float mass)
+EntityId Game::CreateBullets(float rad, float x, float y, float z, float mass)
 {
+	PoolHandle handle = entityPool->Create(sphereMesh, material1);
+	if (handle == InvalidPoolHandle())
+		return INVALID_ENTITY;
+
 	btTransform sphereTransform;
 	sphereTransform.setIdentity();
 	sphereTransform.setOrigin(btVector3(x, y, z));
@@ -954,19 +1178,34 @@ btRigidBody * Game::CreateBullets(float rad, float x, float y, float z, float ma
 	world->addRigidBody(body);
 
 	body->setLinearVelocity(btVector3(0, 0, 10));
-	bullets.push_back(new bulletObject(body));
-	body->setUserPointer(bullets[bullets.size() - 1]);
-	return body;
+
+	GameEntity* bul = entityPool->Get(handle);
+	bul->SetScale(0.25, 0.25, 0.25);
+	bul->SetPosition(x, y, z);
+	bul->UpdateWorldMatrix();
+
+	PhysicsBodyComponent physics = { body };
+	RenderComponent render = { handle, sceneTree->CreateProxy(Aabb::FromSphere(bul->GetWorldBoundingSphere()), bul), bul->GetTransformVersion() };
+	visibility.ProxyChanged(render.boundsProxy);
+	BulletComponent bullet = { false };
+
+	//Bullets are fast and are what the player watches, never slow them down
+	UpdateRateComponent rate = updateScheduler.Register(0);
+	EntityId id = ecs.CreateEntity(physics, render, bullet, rate);
+	SetProxyEntity(render.boundsProxy, id);
+	body->setUserIndex((int)id);
+	return id;
 }
 
 
-void Game::AddBulletToWorld(int bulletNumber)
+void Game::AddBulletToWorld(EntityId bullet)
 {
-	world->addRigidBody(bullets[bulletNumber]->bulletBody);
-	bullets[bulletNumber]->bulletBody->setLinearVelocity(btVector3(0, 0, 10));
+	btRigidBody* body = ecs.GetComponent<PhysicsBodyComponent>(bullet)->body;
+	world->addRigidBody(body);
+	body->setLinearVelocity(btVector3(0, 0, 10));
 }
 
-void Game::AddAsteroidToWorld(int astNumber)
+void Game::AddAsteroidToWorld(EntityId asteroid)
 {
 	float x = rand() % 3;
 	if (rand() % 2 == 0)
@@ -984,13 +1223,13 @@ void Game::AddAsteroidToWorld(int astNumber)
 		z = -z;
 	}
 
-	//world->addRigidBody(asteroids[astNumber]);
-	asteroids[astNumber]->body->setLinearVelocity(btVector3(x, y, z));
+	ecs.GetComponent<PhysicsBodyComponent>(asteroid)->body->setLinearVelocity(btVector3(x, y, z));
 }
 
-void Game::RemoveAsteriod(int astNumber)
+void Game::RemoveAsteriod(EntityId asteroid)
 {
-	world->removeRigidBody(asteroids[astNumber]->body);
+	//Despawned at the next sync point
+	commands.Event(INVALID_ENTITY, GAME_COMMAND_DESPAWN_ASTEROID, asteroid);
 	
 	//Calculations used for recycling asteroids in pooling, not used anymore
 	
@@ -1006,19 +1245,351 @@ void Game::RemoveAsteriod(int astNumber)
 	astEntities[astNumber]->UpdateWorldMatrix();*/
 }
 
+//Proxy ids are node indices the tree reuses, so a proxy's owner is set when
+//it's created and cleared before it's destroyed.  Static scenery has none.
+void Game::SetProxyEntity(int proxy, EntityId id)
+{
+	if (proxy >= (int)proxyEntities.size())
+		proxyEntities.resize(proxy + 1, INVALID_ENTITY);
+	proxyEntities[proxy] = id;
+}
+
+//Keeps the scene tree in step with where everything moved this frame
+void Game::UpdateSceneTree()
+{
+	//Only entities whose world matrix was rebuilt need refitting, and only
+	//those get culled again
+	for (size_t i = 0; i < staticProxies.size(); i++)
+	{
+		if (entities[i]->GetTransformVersion() == staticVersions[i])
+			continue;
+
+		sceneTree->MoveProxy(staticProxies[i], Aabb::FromSphere(entities[i]->GetWorldBoundingSphere()));
+		visibility.ProxyChanged(staticProxies[i]);
+		staticVersions[i] = entities[i]->GetTransformVersion();
+	}
+
+	ecs.Each<RenderComponent>([&](EntityId id, RenderComponent& render)
+	{
+		GameEntity* entity = entityPool->Get(render.entity);
+		if (!entity || entity->GetTransformVersion() == render.boundsVersion)
+			return;
+
+		sceneTree->MoveProxy(render.boundsProxy, Aabb::FromSphere(entity->GetWorldBoundingSphere()));
+		visibility.ProxyChanged(render.boundsProxy);
+		render.boundsVersion = entity->GetTransformVersion();
+	});
+
+	//A few rotations a frame keep the tree from degrading as things drift
+	sceneTree->Rebalance(16);
+}
+
+//Rebuilds the proximity grid and finds what the minimap should highlight
+void Game::UpdateProximity()
+{
+	proximityGrid->Clear();
+	for (int i = 0; i <= 1; i++)
+		proximityGrid->Insert(entities[i]->GetWorldPosition(), entities[i]);
+
+	ecs.Each<RenderComponent>([&](EntityId id, RenderComponent& render)
+	{
+		GameEntity* entity = entityPool->Get(render.entity);
+		if (entity)
+			proximityGrid->Insert(entity->GetWorldPosition(), entity);
+	});
+	proximityGrid->Build();
+
+	//Anything within the range on every axis of the player shows up red
+	highlightedEntities.clear();
+	XMFLOAT3 range(MINIMAP_HIGHLIGHT_RANGE, MINIMAP_HIGHLIGHT_RANGE, MINIMAP_HIGHLIGHT_RANGE);
+	proximityGrid->QueryBox(camera->GetPosition(), range, [&](int item)
+	{
+		highlightedEntities.push_back((GameEntity*)proximityGrid->GetUserData(item));
+	});
+	std::sort(highlightedEntities.begin(), highlightedEntities.end());
+}
+
+//One walk of the scene tree for every view drawn this frame, then
+//occlusion culling for the main view
+void Game::GatherVisibility()
+{
+	visibility.ClearViews();
+	mainView = visibility.AddView(camera);
+	minimapView = visibility.AddView(camera2);
+
+	visibility.Gather(sceneTree, [](void* userData)
+	{
+		return ((GameEntity*)userData)->GetWorldBoundingSphere();
+	});
+
+	if (visibility.GetVisibleCount(mainView) > 0)
+		visibility.TrimView(mainView, CullOccluded(mainView));
+
+	if (visibility.GetVisibleCount(mainView) > 0)
+		visibility.TrimView(mainView, SelectLods(mainView));
+}
+
+//Draws what GatherVisibility() found for one view
+void Game::DrawVisibleEntities(int view, bool minimap)
+{
+	Camera* viewCamera = visibility.GetCamera(view);
+	int visibleCount = visibility.GetVisibleCount(view);
+	const int* visibleEntities = visibility.GetVisible(view);
+	XMFLOAT3 eye = viewCamera->GetPosition();
+
+	//Gather everything first and sort it, so entities sharing shaders,
+	//materials and meshes are drawn back to back
+	drawList.Clear();
+	for (int v = 0; v < visibleCount; v++)
+	{
+		GameEntity* entity = (GameEntity*)visibility.GetObject(visibleEntities[v]);
+		Mesh* mesh = entity->GetMesh();
+
+		if (!minimap && IsImpostorFar(entity, viewCamera) && impostorRenderer->Add(*entity->GetWorldMatrix()))
+			continue;
+
+		//The minimap is tiny, so it always gets the coarsest level
+		int lod = minimap ? mesh->GetLodCount() - 1 : entity->GetLod();
+		if (lod >= mesh->GetLodCount())
+			lod = mesh->GetLodCount() - 1;
+
+		if (!minimap && IsAsteroid(entity) && asteroidInstances->Add(mesh, entity->GetMaterial(), lod, *entity->GetWorldMatrix()))
+			continue;
+
+		//Entities near the player show up red on the minimap
+		ID3D11ShaderResourceView* texture = 0;
+		if (minimap && std::binary_search(highlightedEntities.begin(), highlightedEntities.end(), entity))
+			texture = redSRV;
+
+		XMFLOAT3 position = entity->GetWorldPosition();
+		float dx = position.x - eye.x, dy = position.y - eye.y, dz = position.z - eye.z;
+		drawList.Add(DRAW_PASS_OPAQUE, entity, lod, sqrtf(dx * dx + dy * dy + dz * dz), texture);
+	}
+
+	drawList.Sort();
+	renderer.Submit(context, drawList, viewCamera);
+}
+
+//Rasterizes the biggest, closest of the visible entities as occluders
+//and drops whatever is hidden behind them
+int Game::CullOccluded(int view)
+{
+	XMFLOAT3 eye = visibility.GetCamera(view)->GetPosition();
+	int visibleCount = visibility.GetVisibleCount(view);
+	int* visibleEntities = visibility.GetVisible(view);
+
+	// Score is how big the inner sphere looks from the camera
+	occluderCandidates.clear();
+	occluderScores.resize(visibility.GetObjectCount());
+	for (int v = 0; v < visibleCount; v++)
+	{
+		int index = visibleEntities[v];
+		XMFLOAT4 sphere = ((GameEntity*)visibility.GetObject(index))->GetWorldOccluderSphere();
+		if (sphere.w <= 0.0f)
+			continue;
+
+		float dx = sphere.x - eye.x, dy = sphere.y - eye.y, dz = sphere.z - eye.z;
+		occluderScores[index] = sphere.w * sphere.w / (dx * dx + dy * dy + dz * dz + 0.0001f);
+		occluderCandidates.push_back(index);
+	}
+	if (occluderCandidates.empty())
+		return visibleCount;
+
+	int occluderCount = (int)occluderCandidates.size();
+	if (occluderCount > MAX_OCCLUDERS)
+	{
+		std::partial_sort(occluderCandidates.begin(), occluderCandidates.begin() + MAX_OCCLUDERS, occluderCandidates.end(),
+			[&](int a, int b) { return occluderScores[a] > occluderScores[b]; });
+		occluderCount = MAX_OCCLUDERS;
+	}
+
+	// The cube inscribed in the inner sphere is guaranteed to be inside the mesh
+	occlusionCuller->SetCamera(visibility.GetCamera(view));
+	for (int i = 0; i < occluderCount; i++)
+	{
+		XMFLOAT4 sphere = ((GameEntity*)visibility.GetObject(occluderCandidates[i]))->GetWorldOccluderSphere();
+		float halfExtent = sphere.w * 0.57735f;
+		occlusionCuller->AddOccluderBox(XMFLOAT3(sphere.x, sphere.y, sphere.z), XMFLOAT3(halfExtent, halfExtent, halfExtent));
+	}
+	occlusionCuller->Rasterize();
+
+	return occlusionCuller->CullSpheres(visibility.GetBounds(), visibleEntities, visibleCount, visibleEntities);
+}
+
+//Level material slots, anything unknown gets the default
+Material* Game::GetLevelMaterial(unsigned int slot)
+{
+	return slot == 1 ? material2 : material1;
+}
+
+//Moves the streaming window with the camera, then spawns a budgeted
+//number of entities from sectors that are ready and drops far ones
+void Game::StreamWorld(float deltaTime)
+{
+	if (!worldStreamer)
+		return;
+
+	XMFLOAT3 position = camera->GetPosition();
+	XMFLOAT3 velocity(0, 0, 0);
+	if (deltaTime > 0)
+	{
+		velocity.x = (position.x - lastCameraPosition.x) / deltaTime;
+		velocity.y = (position.y - lastCameraPosition.y) / deltaTime;
+		velocity.z = (position.z - lastCameraPosition.z) / deltaTime;
+	}
+	lastCameraPosition = position;
+
+	worldStreamer->Update(position, velocity);
+
+	//Replays have to spawn the same things on the same frames every run, so
+	//a sector asked for this frame is finished before committing
+	if (inputReplayer)
+		worldStreamer->WaitForLoads();
+
+	worldStreamer->CommitUnloads([&](int sector)
+	{
+		UnloadSector(sector);
+	});
+	worldStreamer->CommitLoads(MAX_STREAMED_SPAWNS_PER_FRAME, [&](int sector, int levelEntity)
+	{
+		EntityId id = SpawnLevelEntity(levelEntity);
+		if (id != INVALID_ENTITY)
+			sectorEntities[sector].push_back(id);
+	});
+}
+
+//Creates one streamed entity from the level's records
+EntityId Game::SpawnLevelEntity(int levelEntity)
+{
+	const SceneEntityRecord& record = levelFile.GetEntities()[levelEntity];
+	const SceneTransformRecord& transform = levelFile.GetTransforms()[levelEntity];
+	if (record.body != SCENE_NO_BODY)
+	{
+		const SceneBodyRecord& body = levelFile.GetBodies()[record.body];
+		return CreateAsteroid(body.radius, transform.position.x, transform.position.y, transform.position.z, body.mass);
+	}
+
+	//Static scenery, drawn and culled but not simulated
+	PoolHandle handle = entityPool->Create(meshes[record.mesh], GetLevelMaterial(record.material));
+	if (handle == InvalidPoolHandle())
+		return INVALID_ENTITY;
+
+	GameEntity* entity = entityPool->Get(handle);
+	entity->SetPosition(transform.position.x, transform.position.y, transform.position.z);
+	entity->SetOrientation(transform.orientation.x, transform.orientation.y, transform.orientation.z, transform.orientation.w);
+	entity->SetScale(transform.scale.x, transform.scale.y, transform.scale.z);
+	entity->UpdateWorldMatrix();
+
+	RenderComponent render = { handle, sceneTree->CreateProxy(Aabb::FromSphere(entity->GetWorldBoundingSphere()), entity), entity->GetTransformVersion() };
+	visibility.ProxyChanged(render.boundsProxy);
+	EntityId id = ecs.CreateEntity(render);
+	SetProxyEntity(render.boundsProxy, id);
+	return id;
+}
+
+//Lets go of everything a sector spawned.  Asteroids leave the physics
+//world and get freed with the others in ReleaseDeadAsteroids().
+void Game::UnloadSector(int sector)
+{
+	std::vector<EntityId>& ids = sectorEntities[sector];
+	for (size_t i = 0; i < ids.size(); i++)
+	{
+		//Already shot or retired
+		if (!ecs.IsAlive(ids[i]))
+			continue;
+
+		PhysicsBodyComponent* physics = ecs.GetComponent<PhysicsBodyComponent>(ids[i]);
+		if (physics)
+		{
+			if (physics->body->isInWorld())
+				world->removeRigidBody(physics->body);
+			continue;
+		}
+
+		RenderComponent* render = ecs.GetComponent<RenderComponent>(ids[i]);
+		SetProxyEntity(render->boundsProxy, INVALID_ENTITY);
+		sceneTree->DestroyProxy(render->boundsProxy);
+		visibility.ProxyChanged(render->boundsProxy);
+		entityPool->Destroy(render->entity);
+		ecs.DestroyEntity(ids[i]);
+	}
+	ids.clear();
+}
+
+//Frees asteroids that have been taken out of the physics world, either
+//shot or timed out.  Their ids go stale and their pool slots get reused.
+void Game::ReleaseDeadAsteroids()
+{
+	releaseScratch.clear();
+	ecs.Each<PhysicsBodyComponent, AsteroidComponent>([&](EntityId id, PhysicsBodyComponent& physics, AsteroidComponent& asteroid)
+	{
+		if (!physics.body->isInWorld())
+			releaseScratch.push_back(id);
+	});
+
+	for (size_t i = 0; i < releaseScratch.size(); i++)
+		ReleaseAsteroid(releaseScratch[i]);
+}
+
+//Gives an asteroid's body, entity and tree leaf back. The body must already
+//be out of the world.
+void Game::ReleaseAsteroid(EntityId id)
+{
+	AsteroidComponent* asteroid = ecs.GetComponent<AsteroidComponent>(id);
+	asteroidBodyPool->Destroy(asteroid->body);
+
+	//Shot while it had a body, so it's gone from the field for good
+	if (asteroid->fieldIndex >= 0)
+		asteroidField->Remove(asteroid->fieldIndex);
+
+	RenderComponent* render = ecs.GetComponent<RenderComponent>(id);
+	SetProxyEntity(render->boundsProxy, INVALID_ENTITY);
+	sceneTree->DestroyProxy(render->boundsProxy);
+	visibility.ProxyChanged(render->boundsProxy);
+	entityPool->Destroy(render->entity);
+	ecs.DestroyEntity(id);
+}
+
+//Handles the game's own commands when the command buffer is played back
+void Game::RunCommand(int code, EntityId id, const void* payload)
+{
+	if (code == GAME_COMMAND_SPAWN_ASTEROID)
+	{
+		const AsteroidSpawn& spawn = *(const AsteroidSpawn*)payload;
+		CreateAsteroid(spawn.radius, spawn.x, spawn.y, spawn.z, spawn.mass);
+	}
+	else if (code == GAME_COMMAND_DESPAWN_ASTEROID)
+	{
+		//Shot and retired in the same frame asks twice
+		if (!ecs.IsAlive(id))
+			return;
+
+		btRigidBody* body = ecs.GetComponent<PhysicsBodyComponent>(id)->body;
+		if (body->isInWorld())
+		{
+			body->setLinearVelocity(btVector3(0, 0, 0));
+			world->removeRigidBody(body);
+		}
+		ReleaseAsteroid(id);
+	}
+}
+
 //Function for recycling bullets, not used anymore.
-void Game::RecycleBullets(int bulletNumber)
+void Game::RecycleBullets(EntityId bullet)
 {
-	bullets[bulletNumber]->bulletBody->setLinearVelocity(btVector3(0, 0, 0));
-	world->removeRigidBody(bullets[bulletNumber]->bulletBody);
+	btRigidBody* body = ecs.GetComponent<PhysicsBodyComponent>(bullet)->body;
+	GameEntity* entity = entityPool->Get(ecs.GetComponent<RenderComponent>(bullet)->entity);
+
+	body->setLinearVelocity(btVector3(0, 0, 0));
+	world->removeRigidBody(body);
 
 	btTransform bulSpace;
-	bullets[bulletNumber]->bulletBody->getMotionState()->getWorldTransform(bulSpace);
+	body->getMotionState()->getWorldTransform(bulSpace);
 	bulSpace.setOrigin(btVector3(0, 3, -2));
-	bullets[bulletNumber]->bulletBody->getMotionState()->setWorldTransform(bulSpace);
+	body->getMotionState()->setWorldTransform(bulSpace);
 
-	bulletEntities[bulletNumber]->SetPosition(bulSpace.getOrigin().x(), bulSpace.getOrigin().y(), bulSpace.getOrigin().z());
-	bulletEntities[bulletNumber]->UpdateWorldMatrix();
+	entity->SetPosition(bulSpace.getOrigin().x(), bulSpace.getOrigin().y(), bulSpace.getOrigin().z());
+	entity->UpdateWorldMatrix();
 }
 
 
@@ -1043,14 +1614,14 @@ void Game::OnMouseDown(WPARAM buttonState, int x, int y)
 	{
 		if (buttonState & 0x0001)
 		{
-			mouseAtPlay = true;
+			pendingKeys |= INPUT_CLICK_PLAY;
 		}
 	}
 	if (((x > quitSpritePosition.x) && (x < quitSpritePosition.x + 250)) && ((y > quitSpritePosition.y) && (y < quitSpritePosition.y + 250)))
 	{
 		if (buttonState & 0x0001)
 		{
-			mouseAtQuit = true;
+			pendingKeys |= INPUT_CLICK_QUIT;
 		}
 	}
 	// Caputure the mouse so we keep getting mouse move
@@ -1082,7 +1653,10 @@ void Game::OnMouseMove(WPARAM buttonState, int x, int y)
 	if (buttonState & 0x0001) {
 		float xDiff = (x - prevMousePos.x) * 0.005f;
 		float yDiff = (y - prevMousePos.y) * 0.005f;
-		camera->Rotate(yDiff, xDiff);
+
+		//Applied with the rest of the frame's input so it can be recorded
+		pendingLookX += xDiff;
+		pendingLookY += yDiff;
 	}
 
 	// Save the previous mouse position, so we have it for the future
@@ -1099,4 +1673,293 @@ void Game::OnMouseWheel(float wheelDelta, int x, int y)
 {
 	// Add any custom code here...
 }
-#pragma endregion
\ No newline at end of file
+#pragma endregion
+
+//Picks each visible entity's LOD from its size on screen and drops the ones
+//too small to see.  Returns how many are left in the view's list.
+int Game::SelectLods(int view)
+{
+	int visibleCount = visibility.GetVisibleCount(view);
+	int* visibleEntities = visibility.GetVisible(view);
+
+	visibleLods.resize(visibleCount);
+	for (int v = 0; v < visibleCount; v++)
+		visibleLods[v] = ((GameEntity*)visibility.GetObject(visibleEntities[v]))->GetLod();
+
+	lodSelector.SetCamera(visibility.GetCamera(view), height);
+	int kept = lodSelector.Select(visibility.GetBounds(), visibleEntities, &visibleLods[0], visibleCount);
+
+	for (int v = 0; v < kept; v++)
+		((GameEntity*)visibility.GetObject(visibleEntities[v]))->SetLod(visibleLods[v]);
+
+	return kept;
+}
+
+//Moves the background field, then gives rigid bodies to field asteroids that
+//came close to the player or a bullet and takes them back from ones that left
+void Game::UpdateAsteroidField(float deltaTime)
+{
+	asteroidField->Update(deltaTime);
+
+	fieldInterestPoints.clear();
+	fieldInterestPoints.push_back(camera->GetPosition());
+	ecs.Each<PhysicsBodyComponent, BulletComponent>([&](EntityId id, PhysicsBodyComponent& physics, BulletComponent& bullet)
+	{
+		if (!physics.body->isInWorld())
+			return;
+		const btVector3& origin = physics.body->getWorldTransform().getOrigin();
+		fieldInterestPoints.push_back(XMFLOAT3(origin.x(), origin.y(), origin.z()));
+	});
+
+	//Demote first so the slots are free for this frame's promotions
+	float demoteRangeSq = FIELD_DEMOTE_RANGE * FIELD_DEMOTE_RANGE;
+	ecs.Each<PhysicsBodyComponent, AsteroidComponent>([&](EntityId id, PhysicsBodyComponent& physics, AsteroidComponent& asteroid)
+	{
+		if (asteroid.fieldIndex < 0 || !physics.body->isInWorld())
+			return;
+
+		const btTransform& transform = physics.body->getWorldTransform();
+		XMFLOAT3 position(transform.getOrigin().x(), transform.getOrigin().y(), transform.getOrigin().z());
+		for (size_t p = 0; p < fieldInterestPoints.size(); p++)
+		{
+			float dx = position.x - fieldInterestPoints[p].x;
+			float dy = position.y - fieldInterestPoints[p].y;
+			float dz = position.z - fieldInterestPoints[p].z;
+			if (dx * dx + dy * dy + dz * dz <= demoteRangeSq)
+				return;
+		}
+
+		btQuaternion rotation = transform.getRotation();
+		const btVector3& velocity = physics.body->getLinearVelocity();
+		const btVector3& spin = physics.body->getAngularVelocity();
+		asteroidField->Demote(asteroid.fieldIndex, position,
+			XMFLOAT3(velocity.x(), velocity.y(), velocity.z()),
+			XMFLOAT4(rotation.x(), rotation.y(), rotation.z(), rotation.w()),
+			XMFLOAT3(spin.x(), spin.y(), spin.z()));
+
+		//Out of the world, so ReleaseDeadAsteroids() frees the body
+		asteroid.fieldIndex = -1;
+		world->removeRigidBody(physics.body);
+	});
+
+	//Grid the field once, then every interest point only looks at the cells
+	//around it instead of every slot
+	fieldGrid->Clear();
+	fieldGridSlots.clear();
+	for (int i = 0; i < asteroidField->GetCapacity(); i++)
+	{
+		if (!asteroidField->IsOwned(i))
+			continue;
+		fieldGrid->Insert(asteroidField->GetPosition(i), 0);
+		fieldGridSlots.push_back(i);
+	}
+	fieldGrid->Build();
+
+	int pointCount = (int)fieldInterestPoints.size();
+	fieldNearest.resize(pointCount * MAX_FIELD_PROMOTIONS_PER_FRAME);
+	fieldNearestCounts.resize(pointCount);
+	fieldGrid->QueryNearestBatch(&fieldInterestPoints[0], pointCount, MAX_FIELD_PROMOTIONS_PER_FRAME, FIELD_PROMOTE_RANGE,
+		&fieldNearest[0], &fieldNearestCounts[0]);
+
+	//Closest to each point first.  An asteroid near two points is only
+	//owned the first time it comes up.
+	int promoted = 0;
+	for (int p = 0; p < pointCount && promoted < MAX_FIELD_PROMOTIONS_PER_FRAME; p++)
+	{
+		const int* nearest = &fieldNearest[p * MAX_FIELD_PROMOTIONS_PER_FRAME];
+		for (int n = 0; n < fieldNearestCounts[p] && promoted < MAX_FIELD_PROMOTIONS_PER_FRAME; n++)
+		{
+			int index = fieldGridSlots[nearest[n]];
+			if (!asteroidField->IsOwned(index))
+				continue;
+			PromoteFieldAsteroid(index);
+			promoted++;
+		}
+	}
+}
+
+//Gives a field asteroid a rigid body carrying on with the field's motion.
+//If the pools are full it just stays in the field for now.
+EntityId Game::PromoteFieldAsteroid(int index)
+{
+	XMFLOAT3 position = asteroidField->GetPosition(index);
+	XMFLOAT3 velocity = asteroidField->GetVelocity(index);
+	XMFLOAT4 orientation = asteroidField->GetOrientation(index);
+	XMFLOAT3 spin = asteroidField->GetSpin(index);
+	float radius = asteroidField->GetRadius(index);
+
+	EntityId id = CreateAsteroid(radius, position.x, position.y, position.z, 1.0f);
+	if (id == INVALID_ENTITY)
+		return INVALID_ENTITY;
+
+	btRigidBody* body = ecs.GetComponent<PhysicsBodyComponent>(id)->body;
+	btTransform transform(btQuaternion(orientation.x, orientation.y, orientation.z, orientation.w), btVector3(position.x, position.y, position.z));
+	body->setWorldTransform(transform);
+	body->getMotionState()->setWorldTransform(transform);
+	body->setLinearVelocity(btVector3(velocity.x, velocity.y, velocity.z));
+	body->setAngularVelocity(btVector3(spin.x, spin.y, spin.z));
+
+	//Same size it was drawn at in the field
+	GameEntity* entity = entityPool->Get(ecs.GetComponent<RenderComponent>(id)->entity);
+	float scale = radius / sphereMesh->GetBoundingRadius();
+	entity->SetScale(scale, scale, scale);
+	entity->SetOrientation(orientation.x, orientation.y, orientation.z, orientation.w);
+	entity->UpdateWorldMatrix();
+
+	ecs.GetComponent<AsteroidComponent>(id)->fieldIndex = index;
+	asteroidField->Promote(index);
+	return id;
+}
+
+//Drawn the same way as the field, so they can share its impostors and
+//instanced draws
+bool Game::IsAsteroid(GameEntity* entity)
+{
+	return entity->GetMesh() == sphereMesh && entity->GetMaterial() == fieldEntity->GetMaterial();
+}
+
+//Only asteroids have an impostor, and the whole batch shares one material
+bool Game::IsImpostorFar(GameEntity* entity, Camera* viewCamera)
+{
+	if (!IsAsteroid(entity))
+		return false;
+
+	XMFLOAT3 position = entity->GetWorldPosition();
+	XMFLOAT3 eye = viewCamera->GetPosition();
+	float dx = position.x - eye.x, dy = position.y - eye.y, dz = position.z - eye.z;
+	return dx * dx + dy * dy + dz * dz > IMPOSTOR_DISTANCE * IMPOSTOR_DISTANCE;
+}
+
+//Frustum culls the field straight from its arrays, picks LODs and adds
+//whatever is left to the impostor or instance batches.  Anything neither
+//has room for is drawn through the stand-in entity.
+void Game::DrawAsteroidField()
+{
+	fieldCuller.SetCamera(camera);
+	int count = fieldCuller.CullSpheres(asteroidField->GetBounds(), &fieldVisible[0]);
+
+	//Slots that are empty or have a rigid body right now aren't the field's to draw
+	int owned = 0;
+	for (int v = 0; v < count; v++)
+	{
+		if (asteroidField->IsOwned(fieldVisible[v]))
+			fieldVisible[owned++] = fieldVisible[v];
+	}
+	if (owned == 0)
+		return;
+
+	fieldVisibleLods.resize(owned);
+	for (int v = 0; v < owned; v++)
+		fieldVisibleLods[v] = fieldLods[fieldVisible[v]];
+
+	lodSelector.SetCamera(camera, height);
+	int kept = lodSelector.Select(asteroidField->GetBounds(), &fieldVisible[0], &fieldVisibleLods[0], owned);
+
+	Mesh* mesh = fieldEntity->GetMesh();
+	vertexBuffer = mesh->GetVertexBuffer();
+	for (int v = 0; v < kept; v++)
+	{
+		int index = fieldVisible[v];
+		int lod = fieldVisibleLods[v];
+		if (lod >= mesh->GetLodCount())
+			lod = mesh->GetLodCount() - 1;
+		fieldLods[index] = fieldVisibleLods[v];
+
+		XMFLOAT3 position = asteroidField->GetPosition(index);
+		XMFLOAT4 orientation = asteroidField->GetOrientation(index);
+		float scale = asteroidField->GetRadius(index) / mesh->GetBoundingRadius();
+		fieldEntity->SetPosition(position.x, position.y, position.z);
+		fieldEntity->SetOrientation(orientation.x, orientation.y, orientation.z, orientation.w);
+		fieldEntity->SetScale(scale, scale, scale);
+		fieldEntity->UpdateWorldMatrix();
+
+		if (IsImpostorFar(fieldEntity, camera) && impostorRenderer->Add(*fieldEntity->GetWorldMatrix()))
+			continue;
+		if (asteroidInstances->Add(mesh, fieldEntity->GetMaterial(), lod, *fieldEntity->GetWorldMatrix()))
+			continue;
+
+		//Only once the instance batch is full
+		indexBuffer = mesh->GetIndexBuffer(lod);
+		renderer.SetVertexShader(vertexShader, fieldEntity, camera);
+		renderer.SetPixelShader(pixelShader, fieldEntity, camera);
+		renderer.BindVertexBuffer(context, 0, vertexBuffer, sizeof(Vertex));
+		renderer.BindIndexBuffer(context, indexBuffer);
+		context->DrawIndexed(mesh->GetIndexCount(lod), 0, 0);
+	}
+}
+
+//Opens the recording or replay asked for on the command line and seeds rand().
+//Without a replay the seed is 1, which is what rand() starts from anyway.
+void Game::StartInput()
+{
+	unsigned int seed = 1;
+	if (!replayPath.empty())
+	{
+		inputReplayer = new InputReplayer();
+		if (inputReplayer->Open(replayPath.c_str()))
+		{
+			seed = inputReplayer->GetSeed();
+
+			//Only replays print the draw list stats, and they cost two
+			//extra walks of every list
+			renderer.SetCollectDrawListStats(true);
+		}
+		else
+		{
+			printf("Couldn't open replay %s\n", replayPath.c_str());
+			delete inputReplayer;
+			inputReplayer = 0;
+		}
+	}
+	else if (!recordPath.empty())
+	{
+		inputRecorder = new InputRecorder();
+		if (!inputRecorder->Open(recordPath.c_str(), seed))
+		{
+			printf("Couldn't create recording %s\n", recordPath.c_str());
+			delete inputRecorder;
+			inputRecorder = 0;
+		}
+	}
+	srand(seed);
+}
+
+//Fills in the frame's input from the keyboard and the window messages since
+//last frame, or from the replay, which also sets the frame's timing. Returns
+//false once the replay has run out.
+bool Game::SampleInput(float& deltaTime, float& totalTime)
+{
+	if (inputReplayer)
+	{
+		//The real frame time, which is what the benchmark is measuring
+		replayWallTime += deltaTime;
+		if (!inputReplayer->Next(deltaTime, input))
+		{
+			int frames = inputReplayer->GetFrameCount();
+			printf("Replay finished: %d frames in %.3f s, %.3f ms per frame\n",
+				frames, replayWallTime, frames > 0 ? replayWallTime * 1000.0f / frames : 0.0f);
+			const DrawListStats& drawStats = renderer.GetDrawListStats();
+			printf("Draw lists: %d draws, %d state changes sorted, %d in entity order\n",
+				drawStats.draws, drawStats.stateChanges, drawStats.unsortedStateChanges);
+			const RenderStateStats& stateStats = renderer.GetStateStats();
+			printf("Render state: %d binds issued, %d skipped\n", stateStats.issued, stateStats.skipped);
+			Quit();
+			return false;
+		}
+		replayTime += deltaTime;
+		totalTime = replayTime;
+		return true;
+	}
+
+	input = SampleKeyboard();
+	input.keys |= pendingKeys;
+	input.lookX = pendingLookX;
+	input.lookY = pendingLookY;
+	pendingKeys = 0;
+	pendingLookX = 0.0f;
+	pendingLookY = 0.0f;
+
+	if (inputRecorder)
+		inputRecorder->Record(deltaTime, input);
+	return true;
+}
@@ -14,6 +14,24 @@
 #include "SpriteBatch.h"
 #include "SpriteFont.h"
 #include "Emitter.h"
+#include "SceneGraph.h"
+#include "EntityComponentSystem.h"
+#include "GameComponents.h"
+#include "GameSystems.h"
+#include "FrustumCuller.h"
+#include "MultiViewVisibility.h"
+#include "SceneFile.h"
+#include "WorldStreamer.h"
+#include "DynamicAabbTree.h"
+#include "SpatialHashGrid.h"
+#include "OcclusionCuller.h"
+#include "LodSelector.h"
+#include "AsteroidField.h"
+#include "UpdateScheduler.h"
+#include "InputRecorder.h"
+#include "EntityCommandBuffer.h"
+#include "ImpostorAtlas.h"
+#include "ImpostorRenderer.h"
 #include "btBulletCollisionCommon.h"
 #include "btBulletDynamicsCommon.h"
 #include "boost\thread.hpp"
@@ -27,34 +45,21 @@ public:
 	Game(HINSTANCE hInstance);
 	~Game();
 
-	struct asteroidObject
-	{
-		bool hit;
-		btRigidBody* body;
-		asteroidObject(btRigidBody* b) : body(b), hit(false) {}
-	};
-
-	struct bulletObject
-	{
-		bool hitbullet;
-		btRigidBody* bulletBody;
-		bulletObject(btRigidBody* b) : bulletBody(b), hitbullet(false) {}
-	};
-
 	// Overridden setup and game loop methods, which
 	// will be called automatically
 	void Init();
 	void OnResize();
 	void Update(float deltaTime, float totalTime);
 	void Draw(float deltaTime, float totalTime);
-	btRigidBody* CreateAsteroid(float rad, float x, float y, float z, float mass);
-	btRigidBody* CreateBullets(float rad, float x, float y, float z, float mass);
+	EntityId CreateAsteroid(float rad, float x, float y, float z, float mass);
+	void ReleaseDeadAsteroids();
+	EntityId CreateBullets(float rad, float x, float y, float z, float mass);
 
-	void AddBulletToWorld(int bulletNumber);
-	void RemoveAsteriod(int astNumber);
+	void AddBulletToWorld(EntityId bullet);
+	void RemoveAsteriod(EntityId asteroid);
 	
-	void AddAsteroidToWorld(int astNumber);
-	void RecycleBullets(int bulletNumber);
+	void AddAsteroidToWorld(EntityId asteroid);
+	void RecycleBullets(EntityId bullet);
 
 	// Overridden mouse input helper methods
 	void OnMouseDown (WPARAM buttonState, int x, int y);
@@ -62,6 +67,12 @@ public:
 	void OnMouseMove (WPARAM buttonState, int x, int y);
 	void OnMouseWheel(float wheelDelta,   int x, int y);
 
+	// Call before Run().  Recording saves every frame's input and delta
+	// time; replaying plays a recording back in place of the keyboard and
+	// mouse, then prints how long it took and quits.
+	void RecordInput(const char* path) { recordPath = path; }
+	void ReplayInput(const char* path) { replayPath = path; }
+
 	boost::thread_group tgroup;
 
 private:
@@ -72,6 +83,28 @@ private:
 	void CreateMatrices();
 	void CreateBasicGeometry();
 
+	// Per-frame visibility helpers
+	void UpdateSceneTree();
+	void SetProxyEntity(int proxy, EntityId id);
+	void UpdateProximity();
+	void StreamWorld(float deltaTime);
+	EntityId SpawnLevelEntity(int levelEntity);
+	void UnloadSector(int sector);
+	Material* GetLevelMaterial(unsigned int slot);
+	void GatherVisibility();
+	void DrawVisibleEntities(int view, bool minimap);
+	int CullOccluded(int view);
+	int SelectLods(int view);
+	void UpdateAsteroidField(float deltaTime);
+	EntityId PromoteFieldAsteroid(int index);
+	void DrawAsteroidField();
+	bool IsAsteroid(GameEntity* entity);
+	bool IsImpostorFar(GameEntity* entity, Camera* viewCamera);
+	void StartInput();
+	void ReleaseAsteroid(EntityId id);
+	void RunCommand(int code, EntityId id, const void* payload);
+	bool SampleInput(float& deltaTime, float& totalTime);
+
 
 	std::vector<Mesh*> meshes;
 	std::vector<GameEntity*> entities;
@@ -102,6 +135,39 @@ private:
 	POINT difference;
 
 	Renderer renderer;
+	DrawList drawList;
+
+	// Bounds of every drawable entity, for culling and other spatial queries
+	DynamicAabbTree* sceneTree;
+	std::vector<int> staticProxies;
+	std::vector<unsigned int> staticVersions;
+	std::vector<EntityId> proxyEntities;		// ECS entity owning each proxy, by proxy id
+
+	// Entity positions bucketed by cell, rebuilt every frame for proximity queries
+	SpatialHashGrid* proximityGrid;
+	std::vector<GameEntity*> highlightedEntities;
+
+	// What each view can see, gathered in one pass over the scene tree
+	MultiViewVisibility visibility;
+	int mainView;
+	int minimapView;
+
+	// CPU depth buffer of the biggest visible occluders, main view only
+	OcclusionCuller* occlusionCuller;
+	std::vector<int> occluderCandidates;
+	std::vector<float> occluderScores;
+
+	// Screen size LOD and small object culling, main view only
+	LodSelector lodSelector;
+	std::vector<int> visibleLods;
+
+	// Cooked level, mapped for the life of the game
+	SceneFile levelFile;
+
+	// Sectors of the level around the camera, and what each one spawned
+	WorldStreamer* worldStreamer;
+	std::vector<std::vector<EntityId>> sectorEntities;
+	DirectX::XMFLOAT3 lastCameraPosition;
 
 	Mesh *entityMesh1;
 	Mesh *entityMesh2;
@@ -118,9 +184,6 @@ private:
 	GameEntity* cubeEntity;
 	GameEntity* planeEntity;
 
-	DirectionalLight dirLight1;
-	DirectionalLight dirLight2;
-
 	//Sky stuff
 	ID3D11ShaderResourceView* skySRV;
 	SimpleVertexShader* skyVS;
@@ -142,6 +205,11 @@ private:
 	Mesh* minimapPlayer;
 	GameEntity* minimapPlayerEntity;
 
+	//Scene hierarchy
+	SceneGraph* sceneGraph;
+	int playerNode;
+	int minimapPlayerNode;
+
 	//bulletstuff
 	btDynamicsWorld* world;
 	btDispatcher* dispatcher;
@@ -158,10 +226,41 @@ private:
 	btSphereShape* sphere;
 	btMotionState* sphereMotion;
 
-	std::vector<asteroidObject*> asteroids;
-	std::vector<bulletObject*> bullets;
-	std::vector<GameEntity*> astEntities;
-	std::vector<GameEntity*> bulletEntities;
+	//Gameplay objects (asteroids, bullets) and the systems that update them
+	ComponentWorld ecs;
+	SystemScheduler gameSystems;
+	EntityCommandBuffer commands;
+	UpdateScheduler updateScheduler;
+
+	//Render entities for the gameplay objects, allocated once up front
+	static const int MAX_GAMEPLAY_ENTITIES = 1024;
+	static const int MAX_ASTEROIDS = 512;
+	ObjectPool<GameEntity>* entityPool;
+	ObjectPool<SphereBody>* asteroidBodyPool;
+
+	// Background asteroids, only made into rigid bodies near the player or bullets
+	AsteroidField* asteroidField;
+	GameEntity* fieldEntity;		// Stand-in that each field asteroid is drawn through
+	FrustumCuller fieldCuller;
+	std::vector<DirectX::XMFLOAT3> fieldInterestPoints;
+	SpatialHashGrid* fieldGrid;		// Owned field asteroids, rebuilt every frame to find promotions
+	std::vector<int> fieldGridSlots;	// Field index of each grid item
+	std::vector<int> fieldNearest;		// MAX_FIELD_PROMOTIONS_PER_FRAME per interest point
+	std::vector<int> fieldNearestCounts;
+	std::vector<int> fieldVisible;
+	std::vector<int> fieldVisibleLods;
+	std::vector<int> fieldLods;		// Per field slot, for LOD hysteresis
+
+	// Far asteroids, drawn as quads from an atlas cooked from the asteroid mesh
+	ImpostorAtlas asteroidImpostor;
+	ImpostorRenderer* impostorRenderer;
+	SimpleVertexShader* impostorVS;
+	SimplePixelShader* impostorPS;
+
+	// Nearer asteroids, drawn with one instanced draw per LOD
+	InstanceBatch* asteroidInstances;
+	SimpleVertexShader* instancedVS;
+	std::vector<EntityId> releaseScratch;
 
 	int bNum = 0;
 	int bulletTimer  = 2.0f;
@@ -188,6 +287,21 @@ private:
 	ID3D11ShaderResourceView* backgroundTexture;
 	bool mouseAtQuit = false;
 
+	//Input for the current frame, and what the window messages added since
+	//the last one
+	InputSnapshot input;
+	unsigned int pendingKeys = 0;
+	float pendingLookX = 0.0f;
+	float pendingLookY = 0.0f;
+
+	//Recording and replaying input for benchmark runs
+	std::string recordPath;
+	std::string replayPath;
+	InputRecorder* inputRecorder = 0;
+	InputReplayer* inputReplayer = 0;
+	float replayTime = 0.0f;
+	float replayWallTime = 0.0f;
+
 	//Game State Management
 	enum GameStateManager
 	{
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "GameEntity.h"
+#include "ObjectPool.h"
+#include "SphereBody.h"
+#include "btBulletDynamicsCommon.h"
+
+// --------------------------------------------------------
+// Components for the gameplay objects.  These are stored in
+// ComponentWorld chunks and copied with memcpy, so keep them
+// plain data - they point at objects, they don't own them.
+// --------------------------------------------------------
+
+// Rigid body driving the object
+struct PhysicsBodyComponent
+{
+	btRigidBody* body;
+};
+
+// What to draw for the object, lives in the game's entity pool
+struct RenderComponent
+{
+	PoolHandle entity;
+	int boundsProxy;	// Leaf in the game's scene tree
+	unsigned int boundsVersion;	// Entity transform version the leaf was last fitted to
+};
+
+struct AsteroidComponent
+{
+	bool hit;
+	int spawnOrder;		// Used to retire the oldest asteroids first
+	PoolHandle body;	// Owns the physics body, in the game's asteroid body pool
+	int fieldIndex;		// Slot in the asteroid field it was promoted from, or -1
+};
+
+struct BulletComponent
+{
+	bool hit;
+};
+
+// How often the object's per-frame systems run, see UpdateScheduler
+struct UpdateRateComponent
+{
+	int bucket;			// Updates every 2^bucket frames
+	int maxBucket;
+	unsigned int phase;
+	double lastUpdate;	// Scheduler time of the last update
+};
+
+// Events the game records in its command buffer, played back on the main
+// thread once the systems have finished
+enum GameCommand
+{
+	GAME_COMMAND_SPAWN_ASTEROID,	// Payload is an AsteroidSpawn
+	GAME_COMMAND_DESPAWN_ASTEROID	// Takes it out of the world and frees it
+};
+
+struct AsteroidSpawn
+{
+	float radius;
+	float x, y, z;
+	float mass;
+};
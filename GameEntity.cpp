@@ -1,4 +1,5 @@
 #include "GameEntity.h"
+#include <cstring>
 
 
 
@@ -10,8 +11,11 @@ GameEntity::GameEntity(Mesh *entityMesh, Material *entityMaterial) {
 	// Set up transform
 	XMStoreFloat4x4(&worldMatrix, XMMatrixIdentity());
 	position = XMFLOAT3(0, 0, 0);
-	rotation = XMFLOAT3(0, 0, 0);
+	orientation = XMFLOAT4(0, 0, 0, 1);
 	scale = XMFLOAT3(1, 1, 1);
+
+	lod = 0;
+	transformVersion = 0;
 }
 
 
@@ -19,15 +23,76 @@ GameEntity::~GameEntity() {
 	//delete entityMesh;
 }
 
+// Rotation rows of the quaternion, each scaled by its axis.  This is
+// scale * rotation written out in closed form, row vectors like DirectXMath.
+static void ScaledRotationRows(const XMFLOAT4& q, const XMFLOAT3& scale, float rows[3][3]) {
+	float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+	float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+	float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+	rows[0][0] = (1.0f - 2.0f * (yy + zz)) * scale.x;
+	rows[0][1] = 2.0f * (xy + wz) * scale.x;
+	rows[0][2] = 2.0f * (xz - wy) * scale.x;
+
+	rows[1][0] = 2.0f * (xy - wz) * scale.y;
+	rows[1][1] = (1.0f - 2.0f * (xx + zz)) * scale.y;
+	rows[1][2] = 2.0f * (yz + wx) * scale.y;
+
+	rows[2][0] = 2.0f * (xz + wy) * scale.z;
+	rows[2][1] = 2.0f * (yz - wx) * scale.z;
+	rows[2][2] = (1.0f - 2.0f * (xx + yy)) * scale.z;
+}
+
+// Writes the transposed matrix straight into worldMatrix, no multiplies
 void GameEntity::UpdateWorldMatrix() {
-	XMMATRIX trans = XMMatrixTranslation(position.x, position.y, position.z);
-	XMMATRIX rotX = XMMatrixRotationX(rotation.x);
-	XMMATRIX rotY = XMMatrixRotationY(rotation.y);
-	XMMATRIX rotZ = XMMatrixRotationZ(rotation.z);
-	XMMATRIX sc = XMMatrixScaling(scale.x, scale.y, scale.z);
+	float rows[3][3];
+	ScaledRotationRows(orientation, scale, rows);
+
+	worldMatrix._11 = rows[0][0];	worldMatrix._12 = rows[1][0];	worldMatrix._13 = rows[2][0];	worldMatrix._14 = position.x;
+	worldMatrix._21 = rows[0][1];	worldMatrix._22 = rows[1][1];	worldMatrix._23 = rows[2][1];	worldMatrix._24 = position.y;
+	worldMatrix._31 = rows[0][2];	worldMatrix._32 = rows[1][2];	worldMatrix._33 = rows[2][2];	worldMatrix._34 = position.z;
+	worldMatrix._41 = 0;			worldMatrix._42 = 0;			worldMatrix._43 = 0;			worldMatrix._44 = 1;
+
+	transformVersion++;
+}
+
+// The scene graph sets every node every frame, so only a real change counts
+void GameEntity::SetWorldMatrix(const XMFLOAT4X4& world) {
+	if (memcmp(&worldMatrix, &world, sizeof(XMFLOAT4X4)) == 0)
+		return;
+
+	worldMatrix = world;
+	transformVersion++;
+}
+
+// The entity's own transform, not transposed and not including any parent
+XMMATRIX GameEntity::GetLocalMatrix() {
+	float rows[3][3];
+	ScaledRotationRows(orientation, scale, rows);
+
+	return XMMATRIX(
+		rows[0][0], rows[0][1], rows[0][2], 0,
+		rows[1][0], rows[1][1], rows[1][2], 0,
+		rows[2][0], rows[2][1], rows[2][2], 0,
+		position.x, position.y, position.z, 1);
+}
+
+// Same order the old Euler matrices used: Z, then Y, then X
+static XMVECTOR EulerToQuaternion(float x, float y, float z) {
+	XMVECTOR qx = XMQuaternionRotationAxis(XMVectorSet(1, 0, 0, 0), x);
+	XMVECTOR qy = XMQuaternionRotationAxis(XMVectorSet(0, 1, 0, 0), y);
+	XMVECTOR qz = XMQuaternionRotationAxis(XMVectorSet(0, 0, 1, 0), z);
+	return XMQuaternionMultiply(XMQuaternionMultiply(qz, qy), qx);
+}
+
+void GameEntity::SetRotation(float x, float y, float z) {
+	XMStoreFloat4(&orientation, EulerToQuaternion(x, y, z));
+}
 
-	XMMATRIX total = sc * rotZ * rotY * rotX * trans;
-	XMStoreFloat4x4(&worldMatrix, XMMatrixTranspose(total));
+// The extra rotation is applied in the entity's local space
+void GameEntity::Rotate(float x, float y, float z) {
+	XMVECTOR q = XMQuaternionMultiply(EulerToQuaternion(x, y, z), XMLoadFloat4(&orientation));
+	XMStoreFloat4(&orientation, XMQuaternionNormalize(q));
 }
 
 XMFLOAT3 GameEntity::GetPosition()
@@ -35,6 +100,69 @@ XMFLOAT3 GameEntity::GetPosition()
 	return position;
 }
 
+XMFLOAT4 GameEntity::GetWorldBoundingSphere() {
+	// World matrix is stored transposed for HLSL
+	XMMATRIX world = XMMatrixTranspose(XMLoadFloat4x4(&worldMatrix));
+	XMFLOAT3 localCenter = mesh->GetBoundingCenter();
+	XMVECTOR center = XMVector3Transform(XMLoadFloat3(&localCenter), world);
+
+	// Scale the radius by the largest axis scale so the sphere stays conservative
+	float scaleX = XMVectorGetX(XMVector3LengthSq(world.r[0]));
+	float scaleY = XMVectorGetX(XMVector3LengthSq(world.r[1]));
+	float scaleZ = XMVectorGetX(XMVector3LengthSq(world.r[2]));
+	float maxScaleSq = scaleX;
+	if (scaleY > maxScaleSq) maxScaleSq = scaleY;
+	if (scaleZ > maxScaleSq) maxScaleSq = scaleZ;
+
+	XMFLOAT4 sphere;
+	XMStoreFloat4(&sphere, center);
+	sphere.w = mesh->GetBoundingRadius() * sqrtf(maxScaleSq);
+	return sphere;
+}
+
+XMFLOAT4 GameEntity::GetWorldOccluderSphere() {
+	XMMATRIX world = XMMatrixTranspose(XMLoadFloat4x4(&worldMatrix));
+	XMFLOAT3 localCenter = mesh->GetBoundingCenter();
+	XMVECTOR center = XMVector3Transform(XMLoadFloat3(&localCenter), world);
+
+	// Smallest axis scale keeps the sphere inside after non-uniform scaling
+	float scaleX = XMVectorGetX(XMVector3LengthSq(world.r[0]));
+	float scaleY = XMVectorGetX(XMVector3LengthSq(world.r[1]));
+	float scaleZ = XMVectorGetX(XMVector3LengthSq(world.r[2]));
+	float minScaleSq = scaleX;
+	if (scaleY < minScaleSq) minScaleSq = scaleY;
+	if (scaleZ < minScaleSq) minScaleSq = scaleZ;
+
+	XMFLOAT4 sphere;
+	XMStoreFloat4(&sphere, center);
+	sphere.w = mesh->GetInnerRadius() * sqrtf(minScaleSq);
+	return sphere;
+}
+
+float GameEntity::IntersectRay(const BvhRay& ray) {
+	float distance;
+	IntersectRays(&ray, 1, &distance);
+	return distance;
+}
+
+void GameEntity::IntersectRays(const BvhRay* rays, int count, float* distances) {
+	XMMATRIX world = XMMatrixTranspose(XMLoadFloat4x4(&worldMatrix));
+	XMMATRIX toLocal = XMMatrixInverse(nullptr, world);
+
+	// Direction isn't renormalized, so a hit's t is the same in both spaces
+	const int batch = 16;
+	BvhRay local[batch];
+	for (int i = 0; i < count; i += batch) {
+		int n = count - i < batch ? count - i : batch;
+		for (int k = 0; k < n; k++) {
+			XMStoreFloat3(&local[k].origin, XMVector3TransformCoord(XMLoadFloat3(&rays[i + k].origin), toLocal));
+			XMStoreFloat3(&local[k].direction, XMVector3TransformNormal(XMLoadFloat3(&rays[i + k].direction), toLocal));
+			local[k].maxDistance = rays[i + k].maxDistance;
+		}
+		mesh->GetBvh()->Intersect(local, n, distances + i);
+	}
+}
+
 
 
 
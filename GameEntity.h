@@ -14,18 +14,46 @@ public:
 	
 
 	void UpdateWorldMatrix();
+	XMMATRIX GetLocalMatrix();
 
 	void Move(float x, float y, float z) { position.x += x;	position.y += y;	position.z += z; }
-	void Rotate(float x, float y, float z) { rotation.x += x;	rotation.y += y;	rotation.z += z; }
+	// Euler angles in radians, applied about Z, then Y, then X
+	void Rotate(float x, float y, float z);
 
 	void SetPosition(float x, float y, float z) { position.x = x;	position.y = y;		position.z = z; }
-	void SetRotation(float x, float y, float z) { rotation.x = x;	rotation.y = y;		rotation.z = z; }
+	void SetRotation(float x, float y, float z);
 	void SetScale(float x, float y, float z) { scale.x = x;		scale.y = y;		scale.z = z; }
 
+	// Unit quaternion, same layout as btQuaternion (x, y, z, w)
+	void SetOrientation(float x, float y, float z, float w) { orientation = XMFLOAT4(x, y, z, w); }
+	XMFLOAT4 GetOrientation() { return orientation; }
+
 	Mesh* GetMesh() { return mesh; }
 	Material* GetMaterial() { return material; }
 	DirectX::XMFLOAT4X4* GetWorldMatrix() { return &worldMatrix; }
+	void SetWorldMatrix(const DirectX::XMFLOAT4X4& world);
+
+	// Bumped every time the world matrix is rebuilt, but not when the
+	// scene graph hands back the same matrix
+	unsigned int GetTransformVersion() { return transformVersion; }
 	XMFLOAT3 GetPosition();
+	XMFLOAT3 GetWorldPosition() { return XMFLOAT3(worldMatrix._14, worldMatrix._24, worldMatrix._34); }
+
+	// Mesh bounding sphere moved into world space: xyz = center, w = radius
+	XMFLOAT4 GetWorldBoundingSphere();
+
+	// Sphere that fits inside the mesh in world space, radius 0 if it has none
+	XMFLOAT4 GetWorldOccluderSphere();
+
+	// World space rays against the mesh's triangles.  The rays are carried
+	// into object space, so distances come back in world units along
+	// direction.  -1 for a miss.
+	float IntersectRay(const BvhRay& ray);
+	void IntersectRays(const BvhRay* rays, int count, float* distances);
+
+	// Mesh LOD picked for the main view last frame
+	int GetLod() { return lod; }
+	void SetLod(int lod) { this->lod = lod; }
 private:
 	
 
@@ -34,8 +62,11 @@ private:
 
 	DirectX::XMFLOAT4X4 worldMatrix;
 	DirectX::XMFLOAT3 position;
-	DirectX::XMFLOAT3 rotation;
+	DirectX::XMFLOAT4 orientation;
 	DirectX::XMFLOAT3 scale;
 
+	int lod;
+	unsigned int transformVersion;
+
 };
 
@@ -0,0 +1,65 @@
+#include "GameSystems.h"
+
+HitAsteroidSystem::HitAsteroidSystem(EntityCommandBuffer* commands)
+{
+	this->commands = commands;
+	Reads<PhysicsBodyComponent>();
+	Reads<AsteroidComponent>();
+}
+
+void HitAsteroidSystem::Run(ComponentWorld& ecs, float deltaTime)
+{
+	ecs.ParallelEach<PhysicsBodyComponent, AsteroidComponent>(
+		[this](EntityId id, PhysicsBodyComponent& physics, AsteroidComponent& asteroid)
+	{
+		if (asteroid.hit && physics.body->isInWorld())
+			commands->Event(id, GAME_COMMAND_DESPAWN_ASTEROID, id);
+	});
+}
+
+PhysicsTransformSystem::PhysicsTransformSystem(ObjectPool<GameEntity>* entityPool, const UpdateScheduler* scheduler)
+{
+	this->entityPool = entityPool;
+	this->scheduler = scheduler;
+	Reads<PhysicsBodyComponent>();
+	Writes<RenderComponent>();
+	Writes<UpdateRateComponent>();
+}
+
+void PhysicsTransformSystem::Run(ComponentWorld& ecs, float deltaTime)
+{
+	ecs.ParallelEach<PhysicsBodyComponent, RenderComponent, UpdateRateComponent>(
+		[this](EntityId id, PhysicsBodyComponent& physics, RenderComponent& render, UpdateRateComponent& rate)
+	{
+		if (!scheduler->IsDue(rate))
+			return;
+
+		GameEntity* entity = entityPool->Get(render.entity);
+		if (!entity)
+			return;
+
+		btTransform transform;
+		physics.body->getMotionState()->getWorldTransform(transform);
+		XMFLOAT3 origin(transform.getOrigin().x(), transform.getOrigin().y(), transform.getOrigin().z());
+
+		// Asleep or static, so the transform is the same as last time.
+		// Leaving the entity alone keeps its transform version too.  A body
+		// that fell asleep between due frames still gets its last copy.
+		if (!physics.body->isActive())
+		{
+			XMFLOAT3 position = entity->GetPosition();
+			if (position.x == origin.x && position.y == origin.y && position.z == origin.z)
+				return;
+		}
+
+		// A straight copy, so the skipped frames are caught up just by
+		// taking where the body is now.  The time since the last update
+		// Consume() hands back is for systems that integrate, and there's
+		// nothing here to advance with it.
+		btQuaternion rotation = transform.getRotation();
+		scheduler->Consume(rate, origin);
+		entity->SetPosition(origin.x, origin.y, origin.z);
+		entity->SetOrientation(rotation.x(), rotation.y(), rotation.z(), rotation.w());
+		entity->UpdateWorldMatrix();
+	});
+}
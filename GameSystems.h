@@ -0,0 +1,49 @@
+#pragma once
+
+#include "EntityComponentSystem.h"
+#include "GameComponents.h"
+#include "UpdateScheduler.h"
+#include "EntityCommandBuffer.h"
+
+// --------------------------------------------------------
+// Finds asteroids that were shot and asks for them to be
+// despawned.  Taking them out of the Bullet world happens
+// when the command buffer is played back, so this can run
+// alongside the other systems.
+// --------------------------------------------------------
+class HitAsteroidSystem : public EcsSystem
+{
+public:
+	HitAsteroidSystem(EntityCommandBuffer* commands);
+	void Run(ComponentWorld& ecs, float deltaTime);
+
+private:
+	EntityCommandBuffer* commands;
+};
+
+// --------------------------------------------------------
+// Copies rigid body positions onto the render entities and
+// rebuilds their world matrices.  Chunks are split across
+// threads, since every row only touches its own entity.
+//
+// Only entities the update scheduler says are due are
+// copied, so far away objects refresh less often and take
+// the refit and re-cull work down with them.
+//
+// That lag is accepted: between copies a far entity, and
+// the scene tree proxy built from it, stay where its last
+// copy put them, up to 7 frames behind Bullet.  Drawing,
+// culling and picking all read that same copy, so a shot
+// still goes where the asteroid is seen.  Anything near
+// enough for the lag to show is in the every frame bucket.
+// --------------------------------------------------------
+class PhysicsTransformSystem : public EcsSystem
+{
+public:
+	PhysicsTransformSystem(ObjectPool<GameEntity>* entityPool, const UpdateScheduler* scheduler);
+	void Run(ComponentWorld& ecs, float deltaTime);
+
+private:
+	ObjectPool<GameEntity>* entityPool;
+	const UpdateScheduler* scheduler;
+};
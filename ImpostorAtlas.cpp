@@ -0,0 +1,312 @@
+#include "ImpostorAtlas.h"
+#include "Mesh.h"
+#include <Windows.h>
+#include <fstream>
+#include <stdio.h>
+#include <float.h>
+#include <math.h>
+#include <parallel_for.h>
+#include <blocked_range.h>
+
+using namespace DirectX;
+
+// Full sphere octahedral mapping, with +y at the middle of the square and
+// -y folded out to its corners.  Both sides of the mapping are in -1..1.
+static XMFLOAT3 OctahedronDecode(float x, float y)
+{
+	XMFLOAT3 dir(x, 1.0f - fabsf(x) - fabsf(y), y);
+	if (dir.y < 0.0f)
+	{
+		dir.x = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		dir.z = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+	}
+
+	float length = sqrtf(dir.x * dir.x + dir.y * dir.y + dir.z * dir.z);
+	return XMFLOAT3(dir.x / length, dir.y / length, dir.z / length);
+}
+
+static void OctahedronEncode(const XMFLOAT3& dir, float& x, float& y)
+{
+	float sum = fabsf(dir.x) + fabsf(dir.y) + fabsf(dir.z);
+	if (sum <= 0.0f)
+	{
+		x = y = 0.0f;
+		return;
+	}
+	x = dir.x / sum;
+	y = dir.z / sum;
+	if (dir.y < 0.0f)
+	{
+		float foldX = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float foldY = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = foldX;
+		y = foldY;
+	}
+}
+
+ImpostorAtlas::ImpostorAtlas()
+{
+	memset(&header, 0, sizeof(header));
+	normalSRV = 0;
+	uvSRV = 0;
+}
+
+ImpostorAtlas::~ImpostorAtlas()
+{
+	if (normalSRV) normalSRV->Release();
+	if (uvSRV) uvSRV->Release();
+}
+
+bool ImpostorAtlas::IsCookedUpToDate(const char* objPath, const char* atlasPath)
+{
+	WIN32_FILE_ATTRIBUTE_DATA obj;
+	WIN32_FILE_ATTRIBUTE_DATA atlas;
+	if (!GetFileAttributesExA(atlasPath, GetFileExInfoStandard, &atlas))
+		return false;
+	if (!GetFileAttributesExA(objPath, GetFileExInfoStandard, &obj))
+		return true;	// Nothing to cook from, use what's there
+	return CompareFileTime(&obj.ftLastWriteTime, &atlas.ftLastWriteTime) <= 0;
+}
+
+bool ImpostorAtlas::Cook(const char* objPath, const char* atlasPath)
+{
+	std::vector<Vertex> verts;
+	std::vector<unsigned int> indices;
+	if (!Mesh::ReadObj(objPath, verts, indices))
+	{
+		printf("Could not read %s for its impostor\n", objPath);
+		return false;
+	}
+
+	ImpostorFileHeader header;
+	std::vector<unsigned int> normals(ATLAS_SIZE * ATLAS_SIZE);
+	std::vector<unsigned int> uvs(ATLAS_SIZE * ATLAS_SIZE);
+	Bake(&verts[0], &indices[0], (int)indices.size(), header, &normals[0], &uvs[0]);
+
+	std::ofstream file(atlasPath, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return false;
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)&normals[0], normals.size() * sizeof(unsigned int));
+	file.write((const char*)&uvs[0], uvs.size() * sizeof(unsigned int));
+	return file.good();
+}
+
+void ImpostorAtlas::Bake(const Vertex* verts, const unsigned int* indices, int numIndex, ImpostorFileHeader& header, unsigned int* normals, unsigned int* uvs)
+{
+	//Every frame is fit to the same sphere, so one quad size works from
+	//any direction
+	XMFLOAT3 boundsMin(FLT_MAX, FLT_MAX, FLT_MAX);
+	XMFLOAT3 boundsMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int i = 0; i < numIndex; i++)
+	{
+		const XMFLOAT3& p = verts[indices[i]].Position;
+		boundsMin = XMFLOAT3(fminf(boundsMin.x, p.x), fminf(boundsMin.y, p.y), fminf(boundsMin.z, p.z));
+		boundsMax = XMFLOAT3(fmaxf(boundsMax.x, p.x), fmaxf(boundsMax.y, p.y), fmaxf(boundsMax.z, p.z));
+	}
+
+	header.magic = IMPOSTOR_FILE_MAGIC;
+	header.version = IMPOSTOR_FILE_VERSION;
+	header.framesPerSide = FRAMES_PER_SIDE;
+	header.frameSize = FRAME_SIZE;
+	header.center = XMFLOAT3((boundsMin.x + boundsMax.x) * 0.5f, (boundsMin.y + boundsMax.y) * 0.5f, (boundsMin.z + boundsMax.z) * 0.5f);
+	header.radius = 0.0f;
+	for (int i = 0; i < numIndex; i++)
+	{
+		const XMFLOAT3& p = verts[indices[i]].Position;
+		float dx = p.x - header.center.x, dy = p.y - header.center.y, dz = p.z - header.center.z;
+		header.radius = fmaxf(header.radius, sqrtf(dx * dx + dy * dy + dz * dz));
+	}
+	if (header.radius <= 0.0f)
+		header.radius = 1.0f;
+
+	memset(normals, 0, ATLAS_SIZE * ATLAS_SIZE * sizeof(unsigned int));
+	memset(uvs, 0, ATLAS_SIZE * ATLAS_SIZE * sizeof(unsigned int));
+
+	//Frames don't share texels, so each one is its own task
+	const ImpostorFileHeader& bakeHeader = header;
+	tbb::parallel_for(tbb::blocked_range<int>(0, FRAMES_PER_SIDE * FRAMES_PER_SIDE),
+		[&](const tbb::blocked_range<int>& range)
+	{
+		for (int frame = range.begin(); frame != range.end(); frame++)
+			BakeFrame(frame, verts, indices, numIndex, bakeHeader, normals, uvs);
+	});
+}
+
+void ImpostorAtlas::BakeFrame(int frame, const Vertex* verts, const unsigned int* indices, int numIndex, const ImpostorFileHeader& header, unsigned int* normals, unsigned int* uvs)
+{
+	XMFLOAT3 right, up, forward;
+	GetFrameBasis(frame, right, up, forward);
+
+	//Nearest the viewer wins, so depth is the distance along forward
+	float depth[FRAME_SIZE * FRAME_SIZE];
+	for (int i = 0; i < FRAME_SIZE * FRAME_SIZE; i++)
+		depth[i] = -FLT_MAX;
+
+	int atlasX = (frame % FRAMES_PER_SIDE) * FRAME_SIZE;
+	int atlasY = (frame / FRAMES_PER_SIDE) * FRAME_SIZE;
+	float half = FRAME_SIZE * 0.5f;
+	float toPixels = half / header.radius;
+
+	for (int t = 0; t + 2 < numIndex; t += 3)
+	{
+		const Vertex* v[3] = { &verts[indices[t]], &verts[indices[t + 1]], &verts[indices[t + 2]] };
+		float sx[3], sy[3], sz[3];
+		for (int k = 0; k < 3; k++)
+		{
+			float px = v[k]->Position.x - header.center.x;
+			float py = v[k]->Position.y - header.center.y;
+			float pz = v[k]->Position.z - header.center.z;
+			sx[k] = half + (px * right.x + py * right.y + pz * right.z) * toPixels;
+			sy[k] = half - (px * up.x + py * up.y + pz * up.z) * toPixels;
+			sz[k] = px * forward.x + py * forward.y + pz * forward.z;
+		}
+
+		//No culling, either winding is fine since depth picks the surface
+		float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+		if (fabsf(area) < 1e-8f)
+			continue;
+		float invArea = 1.0f / area;
+
+		int minX = (int)floorf(fminf(sx[0], fminf(sx[1], sx[2])));
+		int maxX = (int)ceilf(fmaxf(sx[0], fmaxf(sx[1], sx[2])));
+		int minY = (int)floorf(fminf(sy[0], fminf(sy[1], sy[2])));
+		int maxY = (int)ceilf(fmaxf(sy[0], fmaxf(sy[1], sy[2])));
+		if (minX < 0) minX = 0;
+		if (minY < 0) minY = 0;
+		if (maxX > FRAME_SIZE - 1) maxX = FRAME_SIZE - 1;
+		if (maxY > FRAME_SIZE - 1) maxY = FRAME_SIZE - 1;
+
+		for (int y = minY; y <= maxY; y++)
+		{
+			float py = y + 0.5f;
+			for (int x = minX; x <= maxX; x++)
+			{
+				//Barycentric weights from the edge functions, sampled at the
+				//texel center
+				float px = x + 0.5f;
+				float w0 = ((sx[1] - px) * (sy[2] - py) - (sx[2] - px) * (sy[1] - py)) * invArea;
+				float w1 = ((sx[2] - px) * (sy[0] - py) - (sx[0] - px) * (sy[2] - py)) * invArea;
+				float w2 = 1.0f - w0 - w1;
+				if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+					continue;
+
+				float z = w0 * sz[0] + w1 * sz[1] + w2 * sz[2];
+				int pixel = y * FRAME_SIZE + x;
+				if (z <= depth[pixel])
+					continue;
+				depth[pixel] = z;
+
+				//Orthographic, so plain linear interpolation is right
+				float nx = w0 * v[0]->Normal.x + w1 * v[1]->Normal.x + w2 * v[2]->Normal.x;
+				float ny = w0 * v[0]->Normal.y + w1 * v[1]->Normal.y + w2 * v[2]->Normal.y;
+				float nz = w0 * v[0]->Normal.z + w1 * v[1]->Normal.z + w2 * v[2]->Normal.z;
+				float length = sqrtf(nx * nx + ny * ny + nz * nz);
+				if (length > 0.0f)
+				{
+					nx /= length; ny /= length; nz /= length;
+				}
+				float texU = w0 * v[0]->UV.x + w1 * v[1]->UV.x + w2 * v[2]->UV.x;
+				float texV = w0 * v[0]->UV.y + w1 * v[1]->UV.y + w2 * v[2]->UV.y;
+				texU -= floorf(texU);
+				texV -= floorf(texV);
+
+				unsigned int r = (unsigned int)((nx * 0.5f + 0.5f) * 255.0f + 0.5f);
+				unsigned int g = (unsigned int)((ny * 0.5f + 0.5f) * 255.0f + 0.5f);
+				unsigned int b = (unsigned int)((nz * 0.5f + 0.5f) * 255.0f + 0.5f);
+				int texel = (atlasY + y) * ATLAS_SIZE + atlasX + x;
+				normals[texel] = r | (g << 8) | (b << 16) | 0xff000000;
+				uvs[texel] = (unsigned int)(texU * 65535.0f + 0.5f) | ((unsigned int)(texV * 65535.0f + 0.5f) << 16);
+			}
+		}
+	}
+}
+
+bool ImpostorAtlas::Load(const char* atlasPath, ID3D11Device* device)
+{
+	std::ifstream file(atlasPath, std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	file.read((char*)&header, sizeof(header));
+	if (!file.good() || header.magic != IMPOSTOR_FILE_MAGIC || header.version != IMPOSTOR_FILE_VERSION ||
+		header.framesPerSide != FRAMES_PER_SIDE || header.frameSize != FRAME_SIZE)
+		return false;
+
+	std::vector<unsigned int> normals(ATLAS_SIZE * ATLAS_SIZE);
+	std::vector<unsigned int> uvs(ATLAS_SIZE * ATLAS_SIZE);
+	file.read((char*)&normals[0], normals.size() * sizeof(unsigned int));
+	file.read((char*)&uvs[0], uvs.size() * sizeof(unsigned int));
+	if (!file.good())
+		return false;
+
+	D3D11_TEXTURE2D_DESC desc = {};
+	desc.Width = ATLAS_SIZE;
+	desc.Height = ATLAS_SIZE;
+	desc.MipLevels = 1;
+	desc.ArraySize = 1;
+	desc.SampleDesc.Count = 1;
+	desc.Usage = D3D11_USAGE_IMMUTABLE;
+	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+	D3D11_SUBRESOURCE_DATA data = {};
+	data.SysMemPitch = ATLAS_SIZE * sizeof(unsigned int);
+
+	ID3D11Texture2D* texture = 0;
+	desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	data.pSysMem = &normals[0];
+	if (SUCCEEDED(device->CreateTexture2D(&desc, &data, &texture)))
+	{
+		device->CreateShaderResourceView(texture, 0, &normalSRV);
+		texture->Release();
+	}
+
+	texture = 0;
+	desc.Format = DXGI_FORMAT_R16G16_UNORM;
+	data.pSysMem = &uvs[0];
+	if (SUCCEEDED(device->CreateTexture2D(&desc, &data, &texture)))
+	{
+		device->CreateShaderResourceView(texture, 0, &uvSRV);
+		texture->Release();
+	}
+
+	if (!normalSRV || !uvSRV)
+	{
+		if (normalSRV) normalSRV->Release();
+		if (uvSRV) uvSRV->Release();
+		normalSRV = 0;
+		uvSRV = 0;
+		return false;
+	}
+	return true;
+}
+
+int ImpostorAtlas::SelectFrame(const XMFLOAT3& direction)
+{
+	float x, y;
+	OctahedronEncode(direction, x, y);
+
+	int cellX = (int)((x * 0.5f + 0.5f) * FRAMES_PER_SIDE);
+	int cellY = (int)((y * 0.5f + 0.5f) * FRAMES_PER_SIDE);
+	if (cellX < 0) cellX = 0;
+	if (cellY < 0) cellY = 0;
+	if (cellX > FRAMES_PER_SIDE - 1) cellX = FRAMES_PER_SIDE - 1;
+	if (cellY > FRAMES_PER_SIDE - 1) cellY = FRAMES_PER_SIDE - 1;
+	return cellY * FRAMES_PER_SIDE + cellX;
+}
+
+void ImpostorAtlas::GetFrameBasis(int frame, XMFLOAT3& right, XMFLOAT3& up, XMFLOAT3& forward)
+{
+	//Each frame looks from the direction at the middle of its cell
+	float x = ((frame % FRAMES_PER_SIDE) + 0.5f) / FRAMES_PER_SIDE * 2.0f - 1.0f;
+	float y = ((frame / FRAMES_PER_SIDE) + 0.5f) / FRAMES_PER_SIDE * 2.0f - 1.0f;
+	forward = OctahedronDecode(x, y);
+
+	//Same handedness as a left handed look-to matrix looking back along
+	//forward
+	XMVECTOR look = XMVectorNegate(XMLoadFloat3(&forward));
+	XMVECTOR worldUp = fabsf(forward.y) > 0.99f ? XMVectorSet(0, 0, 1, 0) : XMVectorSet(0, 1, 0, 0);
+	XMVECTOR rightVector = XMVector3Normalize(XMVector3Cross(worldUp, look));
+	XMStoreFloat3(&right, rightVector);
+	XMStoreFloat3(&up, XMVector3Cross(look, rightVector));
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <d3d11.h>
+#include <vector>
+#include <DirectXMath.h>
+#include "Vertex.h"
+
+// --------------------------------------------------------
+// Octahedral impostor atlas of one mesh.
+//
+// The mesh is rendered from a grid of directions spread
+// over the whole sphere by an octahedral mapping, one
+// square frame per direction, and the frames are packed
+// into a single atlas.  Frames keep the surface normal and
+// texture coordinate of whatever is nearest the viewer
+// rather than a color, so a far object drawn as one quad
+// still samples its own material and is lit like the mesh.
+//
+// Baking is a cook step like the scene file's.  Frames are
+// rendered by a small orthographic rasterizer on the CPU,
+// one frame per task, so no device is needed.  Load() reads
+// the cooked atlas back and makes the textures.
+// --------------------------------------------------------
+
+#define IMPOSTOR_FILE_MAGIC		0x504d4949	// "IIMP"
+#define IMPOSTOR_FILE_VERSION	1
+
+struct ImpostorFileHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int framesPerSide;
+	unsigned int frameSize;
+	DirectX::XMFLOAT3 center;		// Object space sphere every frame is fit to
+	float radius;
+};
+
+class ImpostorAtlas
+{
+public:
+	static const int FRAMES_PER_SIDE = 8;
+	static const int FRAME_SIZE = 64;
+	static const int ATLAS_SIZE = FRAMES_PER_SIDE * FRAME_SIZE;
+
+	ImpostorAtlas();
+	~ImpostorAtlas();
+
+	static bool IsCookedUpToDate(const char* objPath, const char* atlasPath);
+	static bool Cook(const char* objPath, const char* atlasPath);
+
+	// Renders every frame of the geometry into ATLAS_SIZE squared texels.
+	// normals are RGBA8 with the object space normal packed into 0-1 and
+	// coverage in alpha.  uvs are two 16 bit texture coordinates, wrapped
+	// into 0-1.  Empty texels are 0 in both.
+	static void Bake(const Vertex* verts, const unsigned int* indices, int numIndex, ImpostorFileHeader& header, unsigned int* normals, unsigned int* uvs);
+
+	bool Load(const char* atlasPath, ID3D11Device* device);
+	bool IsLoaded() { return normalSRV != 0; }
+
+	// The frame whose cell an object space direction, from the center
+	// toward the viewer, falls in
+	static int SelectFrame(const DirectX::XMFLOAT3& direction);
+
+	// Camera a frame was baked with.  forward points from the center
+	// toward the viewer, right runs along the frame's texels and up
+	// against its rows.  All unit length, in object space.
+	static void GetFrameBasis(int frame, DirectX::XMFLOAT3& right, DirectX::XMFLOAT3& up, DirectX::XMFLOAT3& forward);
+
+	DirectX::XMFLOAT3 GetCenter() { return header.center; }
+	float GetRadius() { return header.radius; }
+	ID3D11ShaderResourceView* GetNormalSRV() { return normalSRV; }
+	ID3D11ShaderResourceView* GetUvSRV() { return uvSRV; }
+
+private:
+	static void BakeFrame(int frame, const Vertex* verts, const unsigned int* indices, int numIndex, const ImpostorFileHeader& header, unsigned int* normals, unsigned int* uvs);
+
+	ImpostorFileHeader header;
+	ID3D11ShaderResourceView* normalSRV;
+	ID3D11ShaderResourceView* uvSRV;
+};
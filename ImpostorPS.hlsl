@@ -0,0 +1,67 @@
+
+// Defines the input to this pixel shader
+// - Should match the output of our corresponding vertex shader
+struct VertexToPixel
+{
+	float4 position		: SV_POSITION;
+	float2 uv			: TEXCOORD0;
+	float4 rotation		: TEXCOORD1;
+};
+
+// Baked normals (alpha is coverage) and texture coordinates, then the
+// mesh's own surface texture
+Texture2D impostorNormals	: register(t0);
+Texture2D impostorUvs		: register(t1);
+Texture2D textureSRV		: register(t2);
+
+SamplerState atlasSampler	: register(s0);
+SamplerState basicSampler	: register(s1);
+
+struct DirectionalLight {
+	float4 ambientColor;
+	float4 diffuseColor;
+	float3 direction;
+
+};
+cbuffer ExternalData : register(b0) {
+	DirectionalLight dirLight1;
+	DirectionalLight dirLight2;
+};
+
+// Must match ImpostorAtlas
+static const float FRAME_SIZE = 64.0f;
+static const float ATLAS_SIZE = 512.0f;
+
+float3 RotateByQuaternion(float3 v, float4 q)
+{
+	float3 t = 2.0f * cross(q.xyz, v);
+	return v + q.w * t + cross(q.xyz, t);
+}
+
+// Entry point for this pixel shader
+float4 main(VertexToPixel input) : SV_TARGET
+{
+	float4 packedNormal = impostorNormals.Sample(atlasSampler, input.uv);
+	clip(packedNormal.a - 0.5f);
+
+	float3 normal = normalize(RotateByQuaternion(packedNormal.xyz * 2 - 1, input.rotation));
+	float2 surfaceUV = impostorUvs.Sample(atlasSampler, input.uv).xy;
+
+	// The baked coordinates jump at texture seams, so the mip comes from how
+	// many atlas texels this pixel covers rather than from their derivatives
+	float2 atlasTexels = input.uv * ATLAS_SIZE;
+	float footprint = max(length(ddx(atlasTexels)), length(ddy(atlasTexels)));
+	float width, height;
+	textureSRV.GetDimensions(width, height);
+	float mip = max(0.0f, log2(footprint * width / FRAME_SIZE));
+
+	float lightAmount1 = saturate(dot(normal, -normalize(dirLight1.direction)));
+	float lightAmount2 = saturate(dot(normal, -normalize(dirLight2.direction)));
+
+	float4 surfaceColor = textureSRV.SampleLevel(basicSampler, surfaceUV, mip);
+
+	float4 light1 = ((dirLight1.diffuseColor * lightAmount1 * surfaceColor) + (dirLight1.ambientColor * surfaceColor));
+	float4 light2 = ((dirLight2.diffuseColor * lightAmount2 * surfaceColor) + (dirLight2.ambientColor * surfaceColor));
+
+	return light1 + light2;
+}
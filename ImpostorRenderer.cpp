@@ -0,0 +1,163 @@
+#include "ImpostorRenderer.h"
+
+using namespace DirectX;
+
+ImpostorRenderer::ImpostorRenderer(int maxImpostors, ID3D11Device* device, SimpleVertexShader* vs, SimplePixelShader* ps)
+{
+	this->maxImpostors = maxImpostors;
+	this->vs = vs;
+	this->ps = ps;
+	count = 0;
+	atlas = 0;
+	cameraPosition = XMFLOAT3(0, 0, 0);
+
+	localVertices = new ImpostorVertex[4 * maxImpostors];
+
+	// DYNAMIC vertex buffer, refilled every frame
+	D3D11_BUFFER_DESC vbDesc = {};
+	vbDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	vbDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	vbDesc.Usage = D3D11_USAGE_DYNAMIC;
+	vbDesc.ByteWidth = sizeof(ImpostorVertex) * 4 * maxImpostors;
+	device->CreateBuffer(&vbDesc, 0, &vertexBuffer);
+
+	// Two triangles per quad, never changes
+	unsigned int* indices = new unsigned int[maxImpostors * 6];
+	int indexCount = 0;
+	for (int i = 0; i < maxImpostors * 4; i += 4)
+	{
+		indices[indexCount++] = i;
+		indices[indexCount++] = i + 1;
+		indices[indexCount++] = i + 2;
+		indices[indexCount++] = i;
+		indices[indexCount++] = i + 2;
+		indices[indexCount++] = i + 3;
+	}
+	D3D11_SUBRESOURCE_DATA indexData = {};
+	indexData.pSysMem = indices;
+
+	D3D11_BUFFER_DESC ibDesc = {};
+	ibDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+	ibDesc.CPUAccessFlags = 0;
+	ibDesc.Usage = D3D11_USAGE_DEFAULT;
+	ibDesc.ByteWidth = sizeof(unsigned int) * maxImpostors * 6;
+	device->CreateBuffer(&ibDesc, &indexData, &indexBuffer);
+
+	delete[] indices;
+
+	// Atlas texels hold normals and texture coordinates, which can't be
+	// filtered across frame or seam edges, so they're read unfiltered
+	D3D11_SAMPLER_DESC samplerDesc = {};
+	samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+	samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+	samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+	samplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_POINT;
+	samplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
+	device->CreateSamplerState(&samplerDesc, &atlasSampler);
+}
+
+ImpostorRenderer::~ImpostorRenderer()
+{
+	delete[] localVertices;
+	vertexBuffer->Release();
+	indexBuffer->Release();
+	atlasSampler->Release();
+}
+
+void ImpostorRenderer::Begin(ImpostorAtlas* atlas, Camera* camera)
+{
+	this->atlas = atlas;
+	cameraPosition = camera->GetPosition();
+	count = 0;
+}
+
+bool ImpostorRenderer::Add(const XMFLOAT4X4& world)
+{
+	if (count >= maxImpostors || atlas == 0 || !atlas->IsLoaded())
+		return false;
+
+	// Columns of the transposed world matrix are the object's axes, with
+	// the scale still in them
+	XMVECTOR axisX = XMVectorSet(world._11, world._21, world._31, 0);
+	XMVECTOR axisY = XMVectorSet(world._12, world._22, world._32, 0);
+	XMVECTOR axisZ = XMVectorSet(world._13, world._23, world._33, 0);
+	float scale = XMVectorGetX(XMVector3Length(axisX));
+	if (scale <= 0.0f)
+		return false;
+
+	XMFLOAT3 atlasCenter = atlas->GetCenter();
+	XMVECTOR center = XMVectorSet(world._14, world._24, world._34, 0);
+	center += axisX * atlasCenter.x + axisY * atlasCenter.y + axisZ * atlasCenter.z;
+
+	// Which frame to use depends on where the camera is in object space
+	XMVECTOR toCamera = XMLoadFloat3(&cameraPosition) - center;
+	XMFLOAT3 direction(
+		XMVectorGetX(XMVector3Dot(toCamera, axisX)),
+		XMVectorGetX(XMVector3Dot(toCamera, axisY)),
+		XMVectorGetX(XMVector3Dot(toCamera, axisZ)));
+	int frame = ImpostorAtlas::SelectFrame(direction);
+
+	// Lay the quad out along the frame's own axes, carried into world space
+	XMFLOAT3 frameRight, frameUp, frameForward;
+	ImpostorAtlas::GetFrameBasis(frame, frameRight, frameUp, frameForward);
+	float radius = atlas->GetRadius();
+	XMVECTOR right = (axisX * frameRight.x + axisY * frameRight.y + axisZ * frameRight.z) * radius;
+	XMVECTOR up = (axisX * frameUp.x + axisY * frameUp.y + axisZ * frameUp.z) * radius;
+
+	XMFLOAT4 rotation;
+	float invScale = 1.0f / scale;
+	XMMATRIX rotationMatrix(axisX * invScale, axisY * invScale, axisZ * invScale, XMVectorSet(0, 0, 0, 1));
+	XMStoreFloat4(&rotation, XMQuaternionNormalize(XMQuaternionRotationMatrix(rotationMatrix)));
+
+	const float frameStep = (float)ImpostorAtlas::FRAME_SIZE / ImpostorAtlas::ATLAS_SIZE;
+	float frameU = (frame % ImpostorAtlas::FRAMES_PER_SIDE) * frameStep;
+	float frameV = (frame / ImpostorAtlas::FRAMES_PER_SIDE) * frameStep;
+
+	ImpostorVertex* quad = &localVertices[count * 4];
+	XMStoreFloat3(&quad[0].Position, center - right + up);
+	XMStoreFloat3(&quad[1].Position, center + right + up);
+	XMStoreFloat3(&quad[2].Position, center + right - up);
+	XMStoreFloat3(&quad[3].Position, center - right - up);
+	quad[0].UV = XMFLOAT2(frameU, frameV);
+	quad[1].UV = XMFLOAT2(frameU + frameStep, frameV);
+	quad[2].UV = XMFLOAT2(frameU + frameStep, frameV + frameStep);
+	quad[3].UV = XMFLOAT2(frameU, frameV + frameStep);
+	for (int i = 0; i < 4; i++)
+		quad[i].Rotation = rotation;
+
+	count++;
+	return true;
+}
+
+void ImpostorRenderer::Draw(ID3D11DeviceContext* context, Camera* camera, Material* material, const DirectionalLight& light1, const DirectionalLight& light2)
+{
+	if (count == 0)
+		return;
+
+	// Only the quads added this frame go up
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	context->Map(vertexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+	memcpy(mapped.pData, localVertices, sizeof(ImpostorVertex) * 4 * count);
+	context->Unmap(vertexBuffer, 0);
+
+	UINT stride = sizeof(ImpostorVertex);
+	UINT offset = 0;
+	context->IASetVertexBuffers(0, 1, &vertexBuffer, &stride, &offset);
+	context->IASetIndexBuffer(indexBuffer, DXGI_FORMAT_R32_UINT, 0);
+
+	vs->SetMatrix4x4("viewProjection", camera->GetViewProjection());
+	vs->SetShader();
+	vs->CopyAllBufferData();
+
+	ps->SetData("dirLight1", &light1, sizeof(DirectionalLight));
+	ps->SetData("dirLight2", &light2, sizeof(DirectionalLight));
+	ps->SetShaderResourceView("impostorNormals", atlas->GetNormalSRV());
+	ps->SetShaderResourceView("impostorUvs", atlas->GetUvSRV());
+	ps->SetShaderResourceView("textureSRV", material->GetMaterialSRV());
+	ps->SetSamplerState("atlasSampler", atlasSampler);
+	ps->SetSamplerState("basicSampler", material->GetMaterialSampler());
+	ps->SetShader();
+	ps->CopyAllBufferData();
+
+	context->DrawIndexed(count * 6, 0, 0);
+}
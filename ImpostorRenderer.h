@@ -0,0 +1,58 @@
+#pragma once
+
+#include <d3d11.h>
+#include <DirectXMath.h>
+#include "Camera.h"
+#include "Lights.h"
+#include "Material.h"
+#include "SimpleShader.h"
+#include "ImpostorAtlas.h"
+
+struct ImpostorVertex
+{
+	DirectX::XMFLOAT3 Position;
+	DirectX::XMFLOAT2 UV;			// Into the atlas
+	DirectX::XMFLOAT4 Rotation;		// Object to world, for the baked normals
+};
+
+// --------------------------------------------------------
+// Draws far copies of one mesh as quads cut from its
+// impostor atlas, all of them in one draw call.
+//
+// Each quad is the atlas frame baked from the direction
+// nearest the one the camera sees the object from, laid
+// out along that frame's own axes so it lines up with the
+// object's orientation.  Quads are gathered on the CPU
+// between Begin() and Draw() and sent up in one dynamic
+// vertex buffer, like the particle emitter's.
+// --------------------------------------------------------
+class ImpostorRenderer
+{
+public:
+	ImpostorRenderer(int maxImpostors, ID3D11Device* device, SimpleVertexShader* vs, SimplePixelShader* ps);
+	~ImpostorRenderer();
+
+	void Begin(ImpostorAtlas* atlas, Camera* camera);
+
+	// world is an entity's (transposed) world matrix with a uniform scale.
+	// False once the batch is full, the caller should draw the mesh.
+	bool Add(const DirectX::XMFLOAT4X4& world);
+	int GetCount() { return count; }
+
+	void Draw(ID3D11DeviceContext* context, Camera* camera, Material* material, const DirectionalLight& light1, const DirectionalLight& light2);
+
+private:
+	int maxImpostors;
+	int count;
+
+	ImpostorAtlas* atlas;
+	DirectX::XMFLOAT3 cameraPosition;
+
+	ImpostorVertex* localVertices;
+	ID3D11Buffer* vertexBuffer;
+	ID3D11Buffer* indexBuffer;
+	ID3D11SamplerState* atlasSampler;
+
+	SimpleVertexShader* vs;
+	SimplePixelShader* ps;
+};
@@ -0,0 +1,38 @@
+
+// Constant buffer for C++ data being passed in
+cbuffer externalData : register(b0)
+{
+	matrix viewProjection;	// Combined once per camera on the CPU
+};
+
+// Describes individual vertex data
+struct VertexShaderInput
+{
+	float3 position		: POSITION;		// Quad corner, already in world space
+	float2 uv			: TEXCOORD;		// Into the impostor atlas
+	float4 rotation		: ROTATION;		// Object to world quaternion
+};
+
+// Defines the output data of our vertex shader
+struct VertexToPixel
+{
+	float4 position		: SV_POSITION;
+	float2 uv			: TEXCOORD0;
+	float4 rotation		: TEXCOORD1;
+};
+
+// The entry point for our vertex shader
+VertexToPixel main(VertexShaderInput input)
+{
+	// Set up output
+	VertexToPixel output;
+
+	// Calculate output position
+	output.position = mul(float4(input.position, 1.0f), viewProjection);
+
+	// Pass the rest through
+	output.uv = input.uv;
+	output.rotation = input.rotation;
+
+	return output;
+}
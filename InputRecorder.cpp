@@ -0,0 +1,107 @@
+#include "InputRecorder.h"
+#include <Windows.h>
+
+struct InputFileHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int seed;
+};
+
+// Virtual key for each bit, in bit order
+static const int keyCodes[] = { 'W', 'S', 'A', 'D', 'X', ' ', 'R', VK_SHIFT, VK_CONTROL, 'F', VK_TAB, VK_ESCAPE };
+
+InputSnapshot SampleKeyboard()
+{
+	InputSnapshot input = { 0, 0.0f, 0.0f };
+	for (int i = 0; i < sizeof(keyCodes) / sizeof(keyCodes[0]); i++)
+	{
+		if (GetAsyncKeyState(keyCodes[i]) & 0x8000)
+			input.keys |= 1u << i;
+	}
+	return input;
+}
+
+bool InputRecorder::Open(const char* path, unsigned int seed)
+{
+	frameCount = 0;
+	file.open(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return false;
+
+	InputFileHeader header = { INPUT_FILE_MAGIC, INPUT_FILE_VERSION, seed };
+	file.write((const char*)&header, sizeof(header));
+	return file.good();
+}
+
+void InputRecorder::Record(float deltaTime, const InputSnapshot& input)
+{
+	if (!file.is_open())
+		return;
+
+	unsigned short keys = (unsigned short)input.keys;
+	bool look = input.lookX != 0.0f || input.lookY != 0.0f;
+	if (look)
+		keys |= INPUT_LOOK;
+
+	file.write((const char*)&deltaTime, sizeof(deltaTime));
+	file.write((const char*)&keys, sizeof(keys));
+	if (look)
+	{
+		file.write((const char*)&input.lookX, sizeof(input.lookX));
+		file.write((const char*)&input.lookY, sizeof(input.lookY));
+	}
+	frameCount++;
+}
+
+void InputRecorder::Close()
+{
+	if (file.is_open())
+		file.close();
+}
+
+bool InputReplayer::Open(const char* path)
+{
+	seed = 1;
+	frameCount = 0;
+	file.open(path, std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	InputFileHeader header;
+	file.read((char*)&header, sizeof(header));
+	if (!file.good() || header.magic != INPUT_FILE_MAGIC || header.version != INPUT_FILE_VERSION)
+	{
+		file.close();
+		return false;
+	}
+
+	seed = header.seed;
+	return true;
+}
+
+bool InputReplayer::Next(float& deltaTime, InputSnapshot& input)
+{
+	if (!file.is_open())
+		return false;
+
+	unsigned short keys;
+	file.read((char*)&deltaTime, sizeof(deltaTime));
+	file.read((char*)&keys, sizeof(keys));
+	if (!file.good())
+		return false;
+
+	input.keys = keys & ~INPUT_LOOK;
+	input.lookX = 0.0f;
+	input.lookY = 0.0f;
+	if (keys & INPUT_LOOK)
+	{
+		file.read((char*)&input.lookX, sizeof(input.lookX));
+		file.read((char*)&input.lookY, sizeof(input.lookY));
+		if (!file.good())
+			return false;
+	}
+
+	frameCount++;
+	return true;
+}
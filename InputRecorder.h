@@ -0,0 +1,91 @@
+#pragma once
+
+#include <fstream>
+
+// --------------------------------------------------------
+// Per-frame input, and recording it for replays.
+//
+// The keyboard is sampled once at the start of a frame and
+// everything that reacts to input reads that snapshot, so
+// a frame's input can be saved and played back exactly.
+// Mouse look and menu clicks arrive as window messages
+// between frames; the game folds them into the next
+// snapshot.
+//
+// A recording is a small header holding the seed rand() was
+// started with, then one record per frame: the frame's
+// delta time and key bits, and the look movement only on
+// frames that had any.  Replaying a file with the same seed
+// runs the same frames through Update again, which makes
+// for benchmark runs free of human noise.
+// --------------------------------------------------------
+
+#define INPUT_FILE_MAGIC	0x50524e49	// "INRP"
+#define INPUT_FILE_VERSION	1
+
+enum InputKeys
+{
+	INPUT_W			= 1 << 0,
+	INPUT_S			= 1 << 1,
+	INPUT_A			= 1 << 2,
+	INPUT_D			= 1 << 3,
+	INPUT_X			= 1 << 4,
+	INPUT_SPACE		= 1 << 5,
+	INPUT_R			= 1 << 6,
+	INPUT_SHIFT		= 1 << 7,
+	INPUT_CONTROL	= 1 << 8,
+	INPUT_F			= 1 << 9,
+	INPUT_TAB		= 1 << 10,
+	INPUT_ESCAPE	= 1 << 11,
+	INPUT_CLICK_PLAY	= 1 << 12,	// Menu buttons
+	INPUT_CLICK_QUIT	= 1 << 13,
+	INPUT_LOOK		= 1 << 15		// Only in files, the record has look movement
+};
+
+struct InputSnapshot
+{
+	unsigned int keys;
+	float lookX;		// Mouse look, radians this frame
+	float lookY;
+
+	bool IsDown(unsigned int key) const { return (keys & key) != 0; }
+};
+
+// Reads the keyboard into a snapshot with no look movement
+InputSnapshot SampleKeyboard();
+
+class InputRecorder
+{
+public:
+	InputRecorder() : frameCount(0) {}
+
+	bool Open(const char* path, unsigned int seed);
+	void Record(float deltaTime, const InputSnapshot& input);
+	void Close();
+
+	int GetFrameCount() { return frameCount; }
+
+private:
+	std::ofstream file;
+	int frameCount;
+};
+
+class InputReplayer
+{
+public:
+	InputReplayer() : seed(1), frameCount(0) {}
+
+	// Fails on a missing file or one from another version
+	bool Open(const char* path);
+
+	// Next frame's delta time and input.  False once the file runs out.
+	bool Next(float& deltaTime, InputSnapshot& input);
+
+	unsigned int GetSeed() { return seed; }
+	int GetFrameCount() { return frameCount; }
+
+private:
+	std::ifstream file;
+	unsigned int seed;
+	int frameCount;
+};
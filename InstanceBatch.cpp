@@ -0,0 +1,103 @@
+#include "InstanceBatch.h"
+
+using namespace DirectX;
+
+InstanceBatch::InstanceBatch(int maxInstances, ID3D11Device* device)
+{
+	this->maxInstances = maxInstances;
+	instances.reserve(maxInstances);
+	instanceGroups.reserve(maxInstances);
+	groups.reserve(MAX_GROUPS);
+	lastGroup = -1;
+
+	// DYNAMIC, refilled every frame
+	D3D11_BUFFER_DESC desc = {};
+	desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+	desc.ByteWidth = sizeof(InstanceData) * maxInstances;
+	device->CreateBuffer(&desc, 0, &instanceBuffer);
+}
+
+InstanceBatch::~InstanceBatch()
+{
+	instanceBuffer->Release();
+}
+
+void InstanceBatch::Clear()
+{
+	instances.clear();
+	instanceGroups.clear();
+	groups.clear();
+	lastGroup = -1;
+}
+
+bool InstanceBatch::Add(Mesh* mesh, Material* material, int lod, const XMFLOAT4X4& world, const XMFLOAT4& tint)
+{
+	if ((int)instances.size() >= maxInstances)
+		return false;
+
+	//Runs of the same group are common, so check the last one first
+	int group = lastGroup;
+	if (group < 0 || groups[group].mesh != mesh || groups[group].material != material || groups[group].lod != lod)
+	{
+		group = -1;
+		for (int g = 0; g < (int)groups.size(); g++)
+		{
+			if (groups[g].mesh == mesh && groups[g].material == material && groups[g].lod == lod)
+			{
+				group = g;
+				break;
+			}
+		}
+
+		if (group < 0)
+		{
+			if ((int)groups.size() >= MAX_GROUPS)
+				return false;
+
+			InstanceGroup newGroup = { mesh, material, lod, 0, 0 };
+			groups.push_back(newGroup);
+			group = (int)groups.size() - 1;
+		}
+		lastGroup = group;
+	}
+
+	InstanceData instance;
+	instance.WorldRow0 = XMFLOAT4(world._11, world._12, world._13, world._14);
+	instance.WorldRow1 = XMFLOAT4(world._21, world._22, world._23, world._24);
+	instance.WorldRow2 = XMFLOAT4(world._31, world._32, world._33, world._34);
+	instance.Tint = tint;
+	instances.push_back(instance);
+	instanceGroups.push_back(group);
+	groups[group].count++;
+	return true;
+}
+
+void InstanceBatch::Upload(ID3D11DeviceContext* context)
+{
+	if (instances.empty())
+		return;
+
+	//Each group's range starts where the one before it ends
+	int next = 0;
+	for (int g = 0; g < (int)groups.size(); g++)
+	{
+		groups[g].firstInstance = next;
+		next += groups[g].count;
+	}
+
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	context->Map(instanceBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+
+	//Scatter into the mapped buffer in group order.  Only written, never
+	//read, since it's write combined memory.
+	InstanceData* destination = (InstanceData*)mapped.pData;
+	int cursors[MAX_GROUPS];
+	for (int g = 0; g < (int)groups.size(); g++)
+		cursors[g] = groups[g].firstInstance;
+	for (int i = 0; i < (int)instances.size(); i++)
+		destination[cursors[instanceGroups[i]]++] = instances[i];
+
+	context->Unmap(instanceBuffer, 0);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+#include <d3d11.h>
+#include <DirectXMath.h>
+#include "Mesh.h"
+#include "Material.h"
+
+// Per instance vertex data, read by InstancedVS from the second vertex
+// buffer slot
+struct InstanceData
+{
+	DirectX::XMFLOAT4 WorldRow0;		// Rows of the transposed world matrix,
+	DirectX::XMFLOAT4 WorldRow1;		// scale included.  The fourth is
+	DirectX::XMFLOAT4 WorldRow2;		// always 0, 0, 0, 1.
+	DirectX::XMFLOAT4 Tint;
+};
+
+// Instances that share a mesh, material and LOD, drawn with one call
+struct InstanceGroup
+{
+	Mesh* mesh;
+	Material* material;
+	int lod;
+	int firstInstance;
+	int count;
+};
+
+// --------------------------------------------------------
+// Collects a frame's copies of the same few meshes so each
+// mesh, material and LOD combination can be drawn with a
+// single instanced draw.
+//
+// Instances can be added in any order.  Upload() sorts them
+// into their groups with a counting pass, writing straight
+// into one dynamic instance buffer, and each group ends up
+// as a contiguous range of it.
+// --------------------------------------------------------
+class InstanceBatch
+{
+public:
+	static const int MAX_GROUPS = 64;
+
+	InstanceBatch(int maxInstances, ID3D11Device* device);
+	~InstanceBatch();
+
+	void Clear();
+
+	// world is an entity's (transposed) world matrix.  False once the
+	// batch is full, or has no room for another group.
+	bool Add(Mesh* mesh, Material* material, int lod, const DirectX::XMFLOAT4X4& world,
+		const DirectX::XMFLOAT4& tint = DirectX::XMFLOAT4(1, 1, 1, 1));
+
+	void Upload(ID3D11DeviceContext* context);
+
+	int GetCount() { return (int)instances.size(); }
+	int GetGroupCount() { return (int)groups.size(); }
+	const InstanceGroup& GetGroup(int group) { return groups[group]; }
+	ID3D11Buffer* GetInstanceBuffer() { return instanceBuffer; }
+
+private:
+	int maxInstances;
+
+	std::vector<InstanceData> instances;
+	std::vector<int> instanceGroups;		// Group of each instance, same order
+	std::vector<InstanceGroup> groups;
+	int lastGroup;
+
+	ID3D11Buffer* instanceBuffer;
+};
@@ -0,0 +1,65 @@
+
+// Constant Buffer
+// - Only per camera data, everything per object comes in per instance
+cbuffer externalData : register(b0)
+{
+	matrix viewProjection;	// Combined once per camera on the CPU
+};
+
+// Struct representing a single vertex worth of data
+// - The first four come from the mesh's vertex buffer
+// - Anything with a semantic ending in _PER_INSTANCE comes from the
+//   instance buffer in the second slot, one element per instance
+struct VertexShaderInput
+{
+	float3 position		: POSITION;     // XYZ position
+	float3 normal       : NORMAL;       // Normal co-ordinates
+	float2 uv           : TEXCOORD;     // UV co-ordinates
+	float3 tangent		: TANGENT;
+
+	float4 worldRow0	: WORLD_PER_INSTANCE0;	// First three rows of the
+	float4 worldRow1	: WORLD_PER_INSTANCE1;	// transposed world matrix,
+	float4 worldRow2	: WORLD_PER_INSTANCE2;	// same as VertexShader's world
+	float4 tint			: TINT_PER_INSTANCE;
+};
+
+// Must match VertexShader's output, so PixelShader works with either
+struct VertexToPixel
+{
+	float4 position		: SV_POSITION;	// XYZW position (System Value Position)
+	float3 normal       : NORMAL;       // Normal co-ordinates
+	float2 uv           : TEXCOORD;     // UV co-ordinates
+	float3 tangent		: TANGENT;
+	float3 worldPos		: POSITION;
+	float4 tint			: COLOR;
+};
+
+// --------------------------------------------------------
+// The entry point (main method) for our vertex shader
+// 
+// Does what VertexShader does, with the world matrix
+// rebuilt from the instance data instead of a constant
+// --------------------------------------------------------
+VertexToPixel main(VertexShaderInput input)
+{
+	// Set up output struct
+	VertexToPixel output;
+
+	float4 position = float4(input.position, 1.0f);
+	float4 worldPosition = float4(
+		dot(input.worldRow0, position),
+		dot(input.worldRow1, position),
+		dot(input.worldRow2, position),
+		1.0f);
+	output.position = mul(worldPosition, viewProjection);
+
+	// Same as multiplying by the upper 3x3 of the world matrix
+	float3x3 rotation = float3x3(input.worldRow0.xyz, input.worldRow1.xyz, input.worldRow2.xyz);
+	output.normal = mul(rotation, input.normal);
+	output.tangent = mul(rotation, input.tangent);
+	output.worldPos = worldPosition.xyz;
+	output.uv = input.uv;
+	output.tint = input.tint;
+
+	return output;
+}
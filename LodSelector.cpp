@@ -0,0 +1,138 @@
+#include "LodSelector.h"
+#include <emmintrin.h>
+#include <math.h>
+
+using namespace DirectX;
+
+LodSelector::LodSelector()
+{
+	eye = XMFLOAT3(0, 0, 0);
+	pixelScale = 1.0f;
+
+	thresholds[0] = 96.0f;
+	thresholds[1] = 32.0f;
+	cullPixels = 2.0f;
+	hysteresis = 0.15f;
+}
+
+// A sphere of radius r at distance d covers about r / d * proj._22 of the
+// half height of the screen.  _22 is on the diagonal, so it doesn't matter
+// that the camera keeps its matrices transposed.
+void LodSelector::SetCamera(Camera* camera, int viewportHeight)
+{
+	eye = camera->GetPosition();
+	pixelScale = camera->GetProjection()._22 * viewportHeight * 0.5f;
+}
+
+void LodSelector::SetThresholds(float lod1Pixels, float lod2Pixels)
+{
+	thresholds[0] = lod1Pixels;
+	thresholds[1] = lod2Pixels;
+}
+
+int LodSelector::SelectOne(const BoundingSphereList& spheres, int index, int previousLod, bool& keep)
+{
+	float dx = spheres.x[index] - eye.x;
+	float dy = spheres.y[index] - eye.y;
+	float dz = spheres.z[index] - eye.z;
+	float r = spheres.radius[index];
+
+	// Inside the sphere counts as filling the screen
+	float dist = sqrtf(dx * dx + dy * dy + dz * dz);
+	if (dist < r)
+		dist = r;
+	float size = dist > 0 ? 2.0f * r * pixelScale / dist : 0.0f;
+
+	keep = size >= cullPixels;
+
+	int lod = 0;
+	for (int k = 0; k < MAX_THRESHOLDS; k++)
+	{
+		float factor = previousLod > k ? 1.0f + hysteresis : 1.0f - hysteresis;
+		if (size < thresholds[k] * factor)
+			lod++;
+	}
+	return lod;
+}
+
+int LodSelector::Select(const BoundingSphereList& spheres, int* visible, int* lods, int count)
+{
+	__m128 eyeX = _mm_set1_ps(eye.x);
+	__m128 eyeY = _mm_set1_ps(eye.y);
+	__m128 eyeZ = _mm_set1_ps(eye.z);
+	__m128 twoScale = _mm_set1_ps(2.0f * pixelScale);
+	__m128 cull = _mm_set1_ps(cullPixels);
+
+	// Each boundary has a threshold for objects coming from a finer LOD
+	// and a bigger one for objects trying to get back from a coarser one
+	__m128 enter[MAX_THRESHOLDS], leave[MAX_THRESHOLDS];
+	__m128i boundary[MAX_THRESHOLDS];
+	for (int k = 0; k < MAX_THRESHOLDS; k++)
+	{
+		enter[k] = _mm_set1_ps(thresholds[k] * (1.0f - hysteresis));
+		leave[k] = _mm_set1_ps(thresholds[k] * (1.0f + hysteresis));
+		boundary[k] = _mm_set1_epi32(k);
+	}
+
+	const float* x = spheres.x.empty() ? 0 : &spheres.x[0];
+	const float* y = spheres.y.empty() ? 0 : &spheres.y[0];
+	const float* z = spheres.z.empty() ? 0 : &spheres.z[0];
+	const float* radius = spheres.radius.empty() ? 0 : &spheres.radius[0];
+
+	int written = 0;
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		// Read the whole group before any of it can be overwritten
+		int a = visible[i], b = visible[i + 1], c = visible[i + 2], d = visible[i + 3];
+
+		__m128 dx = _mm_sub_ps(_mm_set_ps(x[d], x[c], x[b], x[a]), eyeX);
+		__m128 dy = _mm_sub_ps(_mm_set_ps(y[d], y[c], y[b], y[a]), eyeY);
+		__m128 dz = _mm_sub_ps(_mm_set_ps(z[d], z[c], z[b], z[a]), eyeZ);
+		__m128 r = _mm_set_ps(radius[d], radius[c], radius[b], radius[a]);
+
+		__m128 dist = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+		dist = _mm_max_ps(dist, r);
+
+		// Zero distance means a zero radius too, which should get culled
+		__m128 hasDist = _mm_cmpgt_ps(dist, _mm_setzero_ps());
+		__m128 size = _mm_and_ps(_mm_div_ps(_mm_mul_ps(twoScale, r), dist), hasDist);
+
+		__m128i previous = _mm_loadu_si128((const __m128i*)(lods + i));
+		__m128i lod = _mm_setzero_si128();
+		for (int k = 0; k < MAX_THRESHOLDS; k++)
+		{
+			__m128 wasCoarser = _mm_castsi128_ps(_mm_cmpgt_epi32(previous, boundary[k]));
+			__m128 threshold = _mm_or_ps(_mm_and_ps(wasCoarser, leave[k]), _mm_andnot_ps(wasCoarser, enter[k]));
+
+			// All ones is -1, so subtracting the mask counts the boundaries crossed
+			lod = _mm_sub_epi32(lod, _mm_castps_si128(_mm_cmplt_ps(size, threshold)));
+		}
+
+		int newLods[4];
+		_mm_storeu_si128((__m128i*)newLods, lod);
+		int mask = _mm_movemask_ps(_mm_cmpge_ps(size, cull));
+
+		// Every lane is written, only the count moves
+		visible[written] = a;	lods[written] = newLods[0];	written += mask & 1;
+		visible[written] = b;	lods[written] = newLods[1];	written += (mask >> 1) & 1;
+		visible[written] = c;	lods[written] = newLods[2];	written += (mask >> 2) & 1;
+		visible[written] = d;	lods[written] = newLods[3];	written += (mask >> 3) & 1;
+	}
+
+	// Leftovers that don't fill a whole group
+	for (; i < count; i++)
+	{
+		bool keep;
+		int index = visible[i];
+		int lod = SelectOne(spheres, index, lods[i], keep);
+		if (keep)
+		{
+			visible[written] = index;
+			lods[written] = lod;
+			written++;
+		}
+	}
+
+	return written;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include "Camera.h"
+#include "FrustumCuller.h"
+
+// --------------------------------------------------------
+// Picks a mesh LOD for each visible object from how big it
+// looks on screen, and drops objects too small to matter.
+//
+// Screen size is the projected diameter of the bounding
+// sphere in pixels.  An object moves to a coarser LOD when
+// it gets smaller than that level's threshold, but only
+// comes back once it is bigger than the threshold by the
+// hysteresis margin, so objects sitting on a boundary don't
+// pop back and forth every frame.
+//
+// The visible list is processed four objects at a time with
+// SSE and compacted in place like FrustumCuller does.
+// --------------------------------------------------------
+class LodSelector
+{
+public:
+	static const int MAX_THRESHOLDS = 2;	// So LODs 0 to 2
+
+	LodSelector();
+
+	// Projection scale for this camera and render target height
+	void SetCamera(Camera* camera, int viewportHeight);
+
+	// Pixel sizes below which LOD 1 and LOD 2 are used
+	void SetThresholds(float lod1Pixels, float lod2Pixels);
+	void SetCullPixels(float pixels) { cullPixels = pixels; }
+	void SetHysteresis(float fraction) { hysteresis = fraction; }
+
+	// visible indexes into spheres.  lods holds each object's LOD from
+	// last frame on the way in and the new one on the way out.  Objects
+	// smaller than the cull size are removed from both arrays.  Returns
+	// how many are left.
+	int Select(const BoundingSphereList& spheres, int* visible, int* lods, int count);
+
+private:
+	int SelectOne(const BoundingSphereList& spheres, int index, int previousLod, bool& keep);
+
+	DirectX::XMFLOAT3 eye;
+	float pixelScale;		// Pixels per unit of size at distance 1
+
+	float thresholds[MAX_THRESHOLDS];
+	float cullPixels;
+	float hysteresis;
+};
@@ -1,6 +1,7 @@
 
 #include <Windows.h>
 #include "Game.h"
+#include <string.h>
 
 // --------------------------------------------------------
 // Entry point for a graphical (non-console) Windows application
@@ -22,6 +23,19 @@ int WINAPI WinMain(
 	// the app handle we got from WinMain
 	Game dxGame(hInstance);
 
+	// -record <file> saves this session's input, -replay <file> plays a
+	// saved session back as a benchmark
+	char* option = strtok(lpCmdLine, " ");
+	while (option)
+	{
+		char* path = strtok(0, " ");
+		if (path && strcmp(option, "-record") == 0)
+			dxGame.RecordInput(path);
+		else if (path && strcmp(option, "-replay") == 0)
+			dxGame.ReplayInput(path);
+		option = path ? strtok(0, " ") : 0;
+	}
+
 	// Result variable for function calls below
 	HRESULT hr = S_OK;
 
@@ -1,15 +1,40 @@
 #include "Mesh.h"
 #include <vector>
 #include <fstream>
+#include <unordered_map>
 #include <DirectXMath.h>
 
 using namespace DirectX;
 
 Mesh::Mesh(NotObjShapes vertices[], int numVertex, int indices[], int numIndex, ID3D11Device * device) {
+	CalculateBounds(&vertices[0].Position, numVertex, sizeof(NotObjShapes));
+	CalculateInnerRadius(&vertices[0].Position, sizeof(NotObjShapes), (const unsigned int*)indices, numIndex);
 	CreateBuffers(vertices, numVertex, indices, numIndex, device);
+	BuildLods(&vertices[0].Position, sizeof(NotObjShapes), numVertex, (const unsigned int*)indices, numIndex, device);
+	bvh.Build(&vertices[0].Position, sizeof(NotObjShapes), (const unsigned int*)indices, numIndex);
 }
 
 Mesh::Mesh(const char * objFile, ID3D11Device * device) {
+	lodCount = 0;
+	std::vector<Vertex> verts;           // Verts we're assembling
+	std::vector<UINT> indices;           // Indices of these verts
+
+	// If not found, give up
+	if (!ReadObj(objFile, verts, indices)) {
+		CalculateBounds(0, 0, 0);
+		return;
+	}
+
+	// Create the actual buffers
+	int vertCounter = (int)verts.size();
+	CalculateBounds(&verts[0].Position, vertCounter, sizeof(Vertex));
+	CalculateInnerRadius(&verts[0].Position, sizeof(Vertex), &indices[0], vertCounter);
+	CreateBuffers(&verts[0], vertCounter, &indices[0], vertCounter, device);
+	BuildLods(&verts[0].Position, sizeof(Vertex), vertCounter, &indices[0], vertCounter, device);
+	bvh.Build(&verts[0].Position, sizeof(Vertex), &indices[0], vertCounter);
+}
+
+bool Mesh::ReadObj(const char* objFile, std::vector<Vertex>& verts, std::vector<unsigned int>& indices) {
 	// File input object
 	std::ifstream obj(objFile);
 
@@ -25,15 +50,13 @@ Mesh::Mesh(const char * objFile, ID3D11Device * device) {
 
 		// If not found, give up
 		if (!obj.is_open())
-			return;
+			return false;
 	}
 
 	// Variables used while reading the file
 	std::vector<XMFLOAT3> positions;     // Positions from the file
 	std::vector<XMFLOAT3> normals;       // Normals from the file
 	std::vector<XMFLOAT2> uvs;           // UVs from the file
-	std::vector<Vertex> verts;           // Verts we're assembling
-	std::vector<UINT> indices;           // Indices of these verts
 	unsigned int vertCounter = 0;        // Count of vertices/indices
 	char chars[100];                     // String for line reading
 
@@ -165,9 +188,10 @@ Mesh::Mesh(const char * objFile, ID3D11Device * device) {
 		}
 	}
 
-	// Close the file and create the actual buffers
+
+	// Close the file
 	obj.close();
-	CreateBuffers(&verts[0], vertCounter, &indices[0], vertCounter, device);
+	return !verts.empty();
 }
 
 
@@ -175,6 +199,10 @@ Mesh::Mesh(const char * objFile, ID3D11Device * device) {
 Mesh::~Mesh() {
 	vertexBufferMesh->Release(); vertexBufferMesh = 0;
 	indexBufferMesh->Release(); indexBufferMesh = 0;
+
+	// LOD 0 is indexBufferMesh
+	for (int i = 1; i < lodCount; i++)
+		lodIndexBuffers[i]->Release();
 }
 
 ID3D11Buffer * Mesh::GetVertexBuffer() {
@@ -343,4 +371,177 @@ void Mesh::CalculateTangents(Vertex* verts, int numVerts, unsigned int* indices,
 		// Store the tangent
 		XMStoreFloat3(&verts[i].Tangent, tangent);
 	}
-}
\ No newline at end of file
+}
+
+// Box around every vertex, plus a sphere centered on the box that
+// encloses them all.  Positions are read with a byte stride so both
+// vertex layouts can share this.
+void Mesh::CalculateBounds(const XMFLOAT3* positions, int numVertex, int stride) {
+	boundsMin = XMFLOAT3(0, 0, 0);
+	boundsMax = XMFLOAT3(0, 0, 0);
+	boundsCenter = XMFLOAT3(0, 0, 0);
+	boundsRadius = 0;
+	innerRadius = 0;
+	if (numVertex <= 0)
+		return;
+
+	const unsigned char* bytes = (const unsigned char*)positions;
+	boundsMin = boundsMax = *positions;
+	for (int i = 1; i < numVertex; i++) {
+		const XMFLOAT3& p = *(const XMFLOAT3*)(bytes + i * stride);
+		if (p.x < boundsMin.x) boundsMin.x = p.x;
+		if (p.y < boundsMin.y) boundsMin.y = p.y;
+		if (p.z < boundsMin.z) boundsMin.z = p.z;
+		if (p.x > boundsMax.x) boundsMax.x = p.x;
+		if (p.y > boundsMax.y) boundsMax.y = p.y;
+		if (p.z > boundsMax.z) boundsMax.z = p.z;
+	}
+
+	boundsCenter = XMFLOAT3(
+		(boundsMin.x + boundsMax.x) * 0.5f,
+		(boundsMin.y + boundsMax.y) * 0.5f,
+		(boundsMin.z + boundsMax.z) * 0.5f);
+
+	float radiusSq = 0;
+	for (int i = 0; i < numVertex; i++) {
+		const XMFLOAT3& p = *(const XMFLOAT3*)(bytes + i * stride);
+		float dx = p.x - boundsCenter.x;
+		float dy = p.y - boundsCenter.y;
+		float dz = p.z - boundsCenter.z;
+		float distSq = dx * dx + dy * dy + dz * dz;
+		if (distSq > radiusSq)
+			radiusSq = distSq;
+	}
+	boundsRadius = sqrtf(radiusSq);
+}
+
+// Closest point on triangle abc to p (Ericson, Real-Time Collision Detection 5.1.5)
+static XMVECTOR ClosestPointOnTriangle(FXMVECTOR p, FXMVECTOR a, FXMVECTOR b, GXMVECTOR c) {
+	XMVECTOR ab = b - a;
+	XMVECTOR ac = c - a;
+	XMVECTOR ap = p - a;
+	float d1 = XMVectorGetX(XMVector3Dot(ab, ap));
+	float d2 = XMVectorGetX(XMVector3Dot(ac, ap));
+	if (d1 <= 0 && d2 <= 0) return a;
+
+	XMVECTOR bp = p - b;
+	float d3 = XMVectorGetX(XMVector3Dot(ab, bp));
+	float d4 = XMVectorGetX(XMVector3Dot(ac, bp));
+	if (d3 >= 0 && d4 <= d3) return b;
+
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0 && d1 >= 0 && d3 <= 0) return a + ab * (d1 / (d1 - d3));
+
+	XMVECTOR cp = p - c;
+	float d5 = XMVectorGetX(XMVector3Dot(ab, cp));
+	float d6 = XMVectorGetX(XMVector3Dot(ac, cp));
+	if (d6 >= 0 && d5 <= d6) return c;
+
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0 && d2 >= 0 && d6 <= 0) return a + ac * (d2 / (d2 - d6));
+
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+	float denom = 1.0f / (va + vb + vc);
+	return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+// Distance from the bounding center to the nearest point on the surface.
+// For a closed mesh around the center, a sphere that size is inside it.
+void Mesh::CalculateInnerRadius(const XMFLOAT3* positions, int stride, const unsigned int* indices, int numIndex) {
+	innerRadius = 0;
+	if (numIndex < 3)
+		return;
+
+	const unsigned char* bytes = (const unsigned char*)positions;
+	XMVECTOR center = XMLoadFloat3(&boundsCenter);
+	float minDistSq = boundsRadius * boundsRadius;
+
+	for (int i = 0; i + 2 < numIndex; i += 3) {
+		XMVECTOR a = XMLoadFloat3((const XMFLOAT3*)(bytes + indices[i] * stride));
+		XMVECTOR b = XMLoadFloat3((const XMFLOAT3*)(bytes + indices[i + 1] * stride));
+		XMVECTOR c = XMLoadFloat3((const XMFLOAT3*)(bytes + indices[i + 2] * stride));
+
+		float distSq = XMVectorGetX(XMVector3LengthSq(ClosestPointOnTriangle(center, a, b, c) - center));
+		if (distSq < minDistSq)
+			minDistSq = distSq;
+	}
+
+	innerRadius = sqrtf(minDistSq);
+}
+
+// Vertex clustering: snap every vertex to a coarse grid over the bounds,
+// let the first vertex in each cell stand in for the rest, and drop the
+// triangles that collapse.  The vertex buffer is shared, so each level is
+// just another index buffer.
+void Mesh::BuildLods(const XMFLOAT3* positions, int stride, int numVertex, const unsigned int* indices, int numIndex, ID3D11Device * device) {
+	lodCount = 1;
+	lodIndexBuffers[0] = indexBufferMesh;
+	lodIndexCounts[0] = numIndex;
+
+	// Grid resolution per level, across the longest side of the bounds
+	static const int lodGridCells[MAX_LODS] = { 0, 12, 5 };
+
+	XMFLOAT3 size(boundsMax.x - boundsMin.x, boundsMax.y - boundsMin.y, boundsMax.z - boundsMin.z);
+	float longest = size.x;
+	if (size.y > longest) longest = size.y;
+	if (size.z > longest) longest = size.z;
+	if (numVertex <= 0 || numIndex <= 0 || longest <= 0)
+		return;
+
+	const unsigned char* bytes = (const unsigned char*)positions;
+	std::vector<unsigned int> remap(numVertex);
+	std::vector<unsigned int> lodIndices;
+	std::unordered_map<unsigned long long, unsigned int> cellVertex;
+
+	for (int lod = 1; lod < MAX_LODS; lod++) {
+		float cellSize = longest / lodGridCells[lod];
+
+		cellVertex.clear();
+		for (int v = 0; v < numVertex; v++) {
+			const XMFLOAT3& p = *(const XMFLOAT3*)(bytes + v * stride);
+			unsigned long long cx = (unsigned long long)((p.x - boundsMin.x) / cellSize);
+			unsigned long long cy = (unsigned long long)((p.y - boundsMin.y) / cellSize);
+			unsigned long long cz = (unsigned long long)((p.z - boundsMin.z) / cellSize);
+			unsigned long long key = (cx << 42) | (cy << 21) | cz;
+			remap[v] = cellVertex.insert(std::make_pair(key, (unsigned int)v)).first->second;
+		}
+
+		lodIndices.clear();
+		for (int i = 0; i + 2 < numIndex; i += 3) {
+			unsigned int a = remap[indices[i]];
+			unsigned int b = remap[indices[i + 1]];
+			unsigned int c = remap[indices[i + 2]];
+			if (a != b && b != c && a != c) {
+				lodIndices.push_back(a);
+				lodIndices.push_back(b);
+				lodIndices.push_back(c);
+			}
+		}
+
+		// Not worth a level unless it drops at least a quarter of what's left
+		int previous = lodIndexCounts[lodCount - 1];
+		if (lodIndices.empty() || (int)lodIndices.size() * 4 > previous * 3)
+			continue;
+
+		D3D11_BUFFER_DESC ibd;
+		ibd.Usage = D3D11_USAGE_IMMUTABLE;
+		ibd.ByteWidth = sizeof(unsigned int) * (UINT)lodIndices.size();
+		ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
+		ibd.CPUAccessFlags = 0;
+		ibd.MiscFlags = 0;
+		ibd.StructureByteStride = 0;
+
+		D3D11_SUBRESOURCE_DATA initialIndexData;
+		initialIndexData.pSysMem = &lodIndices[0];
+
+		ID3D11Buffer* buffer = 0;
+		if (FAILED(device->CreateBuffer(&ibd, &initialIndexData, &buffer)))
+			break;
+
+		lodIndexBuffers[lodCount] = buffer;
+		lodIndexCounts[lodCount] = (int)lodIndices.size();
+		lodCount++;
+	}
+}
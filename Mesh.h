@@ -1,7 +1,9 @@
 #pragma once
 
 #include <d3d11.h>
+#include <vector>
 #include "Vertex.h"
+#include "MeshBvh.h"
 
 class Mesh {
 public:
@@ -9,9 +11,35 @@ public:
 	Mesh(const char* objFile, ID3D11Device *device);
 	~Mesh();
 	
+	static const int MAX_LODS = 3;
+
 	ID3D11Buffer *GetVertexBuffer();
 	ID3D11Buffer *GetIndexBuffer();
 	int GetIndexCount();
+
+	// Coarser levels share the vertex buffer and only swap the index
+	// buffer.  LOD 0 is the full mesh; levels that wouldn't save much
+	// aren't built, so there may be fewer than MAX_LODS.
+	int GetLodCount() { return lodCount; }
+	ID3D11Buffer *GetIndexBuffer(int lod) { return lodIndexBuffers[lod]; }
+	int GetIndexCount(int lod) { return lodIndexCounts[lod]; }
+
+	// Object space bounds, computed from the vertices at load time
+	DirectX::XMFLOAT3 GetBoundsMin() { return boundsMin; }
+	DirectX::XMFLOAT3 GetBoundsMax() { return boundsMax; }
+	DirectX::XMFLOAT3 GetBoundingCenter() { return boundsCenter; }
+	float GetBoundingRadius() { return boundsRadius; }
+
+	// Radius of a sphere around the bounding center that fits inside the
+	// surface, for using the mesh as an occluder.  0 if there isn't one.
+	float GetInnerRadius() { return innerRadius; }
+
+	// Triangle BVH over the full mesh, in object space, for ray picking
+	MeshBvh* GetBvh() { return &bvh; }
+
+	// Reads an OBJ into one vertex per face corner, without making any
+	// buffers, for tools that want the geometry but not a device
+	static bool ReadObj(const char* objFile, std::vector<Vertex>& verts, std::vector<unsigned int>& indices);
 	
 
 private:
@@ -21,8 +49,23 @@ private:
 	//ID3D11Device *deviceMesh;
 	int indices1;
 
+	DirectX::XMFLOAT3 boundsMin;
+	DirectX::XMFLOAT3 boundsMax;
+	DirectX::XMFLOAT3 boundsCenter;
+	float boundsRadius;
+	float innerRadius;
+
+	int lodCount;
+	ID3D11Buffer *lodIndexBuffers[MAX_LODS];
+	int lodIndexCounts[MAX_LODS];
+
+	MeshBvh bvh;
+
 	void CreateBuffers(Vertex *vertices, int numVertex, unsigned int *indices, int numIndex, ID3D11Device *device);
 	void CreateBuffers(NotObjShapes vertices[], int numVertex, int indices[], int numIndex, ID3D11Device *device);
 	void CalculateTangents(Vertex* verts, int numVerts, unsigned int* indices, int numIndices);
+	void CalculateBounds(const DirectX::XMFLOAT3* positions, int numVertex, int stride);
+	void CalculateInnerRadius(const DirectX::XMFLOAT3* positions, int stride, const unsigned int* indices, int numIndex);
+	void BuildLods(const DirectX::XMFLOAT3* positions, int stride, int numVertex, const unsigned int* indices, int numIndex, ID3D11Device *device);
 };
 
@@ -0,0 +1,420 @@
+#include "MeshBvh.h"
+#include <emmintrin.h>
+#include <math.h>
+
+using namespace DirectX;
+
+// Deep enough for any mesh we load, and it bounds the traversal stack
+static const int MAX_BVH_DEPTH = 48;
+static const int TRAVERSAL_STACK_SIZE = 64;
+
+// Half the surface area, which is all SAH needs
+static float HalfArea(const float* boundsMin, const float* boundsMax)
+{
+	float dx = boundsMax[0] - boundsMin[0];
+	float dy = boundsMax[1] - boundsMin[1];
+	float dz = boundsMax[2] - boundsMin[2];
+	return dx * dy + dy * dz + dz * dx;
+}
+
+static void ResetBounds(float* boundsMin, float* boundsMax)
+{
+	for (int a = 0; a < 3; a++)
+	{
+		boundsMin[a] = 1e30f;
+		boundsMax[a] = -1e30f;
+	}
+}
+
+static void GrowBounds(float* boundsMin, float* boundsMax, const float* otherMin, const float* otherMax)
+{
+	for (int a = 0; a < 3; a++)
+	{
+		if (otherMin[a] < boundsMin[a]) boundsMin[a] = otherMin[a];
+		if (otherMax[a] > boundsMax[a]) boundsMax[a] = otherMax[a];
+	}
+}
+
+MeshBvh::MeshBvh()
+{
+}
+
+void MeshBvh::Build(const XMFLOAT3* positions, int stride, const unsigned int* indices, int numIndex)
+{
+	nodes.clear();
+	triangles.clear();
+	triangleIds.clear();
+
+	int triangleCount = numIndex / 3;
+	if (triangleCount == 0)
+		return;
+
+	// Bounds and centroid of every triangle, in the mesh's order
+	const unsigned char* bytes = (const unsigned char*)positions;
+	std::vector<Node> triangleBounds(triangleCount);
+	std::vector<XMFLOAT3> centroids(triangleCount);
+	std::vector<int> order(triangleCount);
+	for (int t = 0; t < triangleCount; t++)
+	{
+		Node& bounds = triangleBounds[t];
+		ResetBounds(bounds.boundsMin, bounds.boundsMax);
+		for (int corner = 0; corner < 3; corner++)
+		{
+			const float* p = (const float*)(bytes + indices[t * 3 + corner] * stride);
+			GrowBounds(bounds.boundsMin, bounds.boundsMax, p, p);
+		}
+		centroids[t] = XMFLOAT3(
+			(bounds.boundsMin[0] + bounds.boundsMax[0]) * 0.5f,
+			(bounds.boundsMin[1] + bounds.boundsMax[1]) * 0.5f,
+			(bounds.boundsMin[2] + bounds.boundsMax[2]) * 0.5f);
+		order[t] = t;
+	}
+
+	// A binary tree over n leaves never needs more than 2n - 1 nodes, so
+	// reserving that keeps references into the array valid while building
+	nodes.reserve(triangleCount * 2);
+	nodes.push_back(Node());
+	nodes[0].first = 0;
+	nodes[0].count = triangleCount;
+	ResetBounds(nodes[0].boundsMin, nodes[0].boundsMax);
+	for (int t = 0; t < triangleCount; t++)
+		GrowBounds(nodes[0].boundsMin, nodes[0].boundsMax, triangleBounds[t].boundsMin, triangleBounds[t].boundsMax);
+
+	// Depth first, with the depth carried along to cap it
+	std::vector<int> stack;
+	std::vector<int> depths;
+	stack.push_back(0);
+	depths.push_back(0);
+	while (!stack.empty())
+	{
+		int node = stack.back();
+		int depth = depths.back();
+		stack.pop_back();
+		depths.pop_back();
+
+		if (depth >= MAX_BVH_DEPTH)
+			continue;
+
+		Subdivide(node, order, centroids, triangleBounds);
+		if (nodes[node].count == 0)
+		{
+			stack.push_back(nodes[node].first);
+			depths.push_back(depth + 1);
+			stack.push_back(nodes[node].first + 1);
+			depths.push_back(depth + 1);
+		}
+	}
+
+	// Copy the triangles out in leaf order, with the edges precomputed
+	triangles.resize(triangleCount);
+	triangleIds.resize(triangleCount);
+	for (int i = 0; i < triangleCount; i++)
+	{
+		int t = order[i];
+		XMFLOAT3 v0 = *(const XMFLOAT3*)(bytes + indices[t * 3] * stride);
+		XMFLOAT3 v1 = *(const XMFLOAT3*)(bytes + indices[t * 3 + 1] * stride);
+		XMFLOAT3 v2 = *(const XMFLOAT3*)(bytes + indices[t * 3 + 2] * stride);
+
+		triangles[i].v0 = v0;
+		triangles[i].edge1 = XMFLOAT3(v1.x - v0.x, v1.y - v0.y, v1.z - v0.z);
+		triangles[i].edge2 = XMFLOAT3(v2.x - v0.x, v2.y - v0.y, v2.z - v0.z);
+		triangleIds[i] = t;
+	}
+}
+
+// Splits a leaf in two where the binned surface area heuristic says it's
+// cheapest, or leaves it alone if no split beats testing every triangle
+void MeshBvh::Subdivide(int node, std::vector<int>& order, const std::vector<XMFLOAT3>& centroids, const std::vector<Node>& triangleBounds)
+{
+	int first = nodes[node].first;
+	int count = nodes[node].count;
+	if (count <= 1)
+		return;
+
+	// Bins span the centroids rather than the node, so none are wasted
+	float centroidMin[3], centroidMax[3];
+	ResetBounds(centroidMin, centroidMax);
+	for (int i = first; i < first + count; i++)
+	{
+		const float* c = &centroids[order[i]].x;
+		GrowBounds(centroidMin, centroidMax, c, c);
+	}
+
+	int bestAxis = -1;
+	int bestSplit = 0;
+	float bestCost = 1e30f;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float extent = centroidMax[axis] - centroidMin[axis];
+		if (extent <= 0)
+			continue;
+
+		float binMin[SAH_BINS][3], binMax[SAH_BINS][3];
+		int binCount[SAH_BINS];
+		for (int b = 0; b < SAH_BINS; b++)
+		{
+			ResetBounds(binMin[b], binMax[b]);
+			binCount[b] = 0;
+		}
+
+		float scale = SAH_BINS / extent;
+		for (int i = first; i < first + count; i++)
+		{
+			int t = order[i];
+			int b = (int)(((&centroids[t].x)[axis] - centroidMin[axis]) * scale);
+			if (b > SAH_BINS - 1)
+				b = SAH_BINS - 1;
+			GrowBounds(binMin[b], binMax[b], triangleBounds[t].boundsMin, triangleBounds[t].boundsMax);
+			binCount[b]++;
+		}
+
+		// Sweep from the right first, then from the left pricing every plane
+		float rightArea[SAH_BINS];
+		int rightCount[SAH_BINS];
+		float sweepMin[3], sweepMax[3];
+		ResetBounds(sweepMin, sweepMax);
+		int sweepCount = 0;
+		for (int b = SAH_BINS - 1; b > 0; b--)
+		{
+			GrowBounds(sweepMin, sweepMax, binMin[b], binMax[b]);
+			sweepCount += binCount[b];
+			rightArea[b] = sweepCount > 0 ? HalfArea(sweepMin, sweepMax) : 0.0f;
+			rightCount[b] = sweepCount;
+		}
+
+		ResetBounds(sweepMin, sweepMax);
+		sweepCount = 0;
+		for (int b = 0; b < SAH_BINS - 1; b++)
+		{
+			GrowBounds(sweepMin, sweepMax, binMin[b], binMax[b]);
+			sweepCount += binCount[b];
+			if (sweepCount == 0 || rightCount[b + 1] == 0)
+				continue;
+
+			float cost = HalfArea(sweepMin, sweepMax) * sweepCount + rightArea[b + 1] * rightCount[b + 1];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = b;
+			}
+		}
+	}
+
+	// Every centroid in the same spot, nothing to split on
+	if (bestAxis < 0)
+		return;
+
+	// Visiting a node is priced about the same as testing a triangle
+	float nodeArea = HalfArea(nodes[node].boundsMin, nodes[node].boundsMax);
+	if (bestCost + nodeArea >= nodeArea * count && count <= MAX_LEAF_TRIANGLES)
+		return;
+
+	// Partition the node's triangles around the chosen plane
+	float scale = SAH_BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+	int i = first;
+	int j = first + count - 1;
+	while (i <= j)
+	{
+		int b = (int)(((&centroids[order[i]].x)[bestAxis] - centroidMin[bestAxis]) * scale);
+		if (b > SAH_BINS - 1)
+			b = SAH_BINS - 1;
+
+		if (b <= bestSplit)
+			i++;
+		else
+		{
+			int swap = order[i];
+			order[i] = order[j];
+			order[j] = swap;
+			j--;
+		}
+	}
+
+	int leftCount = i - first;
+	if (leftCount == 0 || leftCount == count)
+		return;
+
+	int left = (int)nodes.size();
+	nodes.push_back(Node());
+	nodes.push_back(Node());
+	nodes[left].first = first;
+	nodes[left].count = leftCount;
+	nodes[left + 1].first = i;
+	nodes[left + 1].count = count - leftCount;
+
+	for (int child = left; child <= left + 1; child++)
+	{
+		ResetBounds(nodes[child].boundsMin, nodes[child].boundsMax);
+		for (int k = nodes[child].first; k < nodes[child].first + nodes[child].count; k++)
+			GrowBounds(nodes[child].boundsMin, nodes[child].boundsMax, triangleBounds[order[k]].boundsMin, triangleBounds[order[k]].boundsMax);
+	}
+
+	nodes[node].first = left;
+	nodes[node].count = 0;
+}
+
+float MeshBvh::Intersect(const BvhRay& ray)
+{
+	float distance;
+	IntersectPacket(&ray, 1, &distance, 0);
+	return distance;
+}
+
+void MeshBvh::Intersect(const BvhRay* rays, int count, float* distances, int* triangles)
+{
+	for (int i = 0; i < count; i += 4)
+	{
+		int packet = count - i < 4 ? count - i : 4;
+		IntersectPacket(rays + i, packet, distances + i, triangles ? triangles + i : 0);
+	}
+}
+
+// Up to four rays, one per SSE lane.  Missing lanes copy the first ray
+// and are masked off, so the loops never need to check them.
+void MeshBvh::IntersectPacket(const BvhRay* rays, int count, float* distances, int* triangleHits)
+{
+	float ox[4], oy[4], oz[4], dx[4], dy[4], dz[4], ix[4], iy[4], iz[4], limit[4];
+	for (int lane = 0; lane < 4; lane++)
+	{
+		const BvhRay& ray = rays[lane < count ? lane : 0];
+		ox[lane] = ray.origin.x; oy[lane] = ray.origin.y; oz[lane] = ray.origin.z;
+		dx[lane] = ray.direction.x; dy[lane] = ray.direction.y; dz[lane] = ray.direction.z;
+		ix[lane] = ray.direction.x != 0 ? 1.0f / ray.direction.x : 1e30f;
+		iy[lane] = ray.direction.y != 0 ? 1.0f / ray.direction.y : 1e30f;
+		iz[lane] = ray.direction.z != 0 ? 1.0f / ray.direction.z : 1e30f;
+		limit[lane] = ray.maxDistance;
+	}
+	int activeMask = (1 << count) - 1;
+
+	int hitTriangle[4] = { -1, -1, -1, -1 };
+	if (nodes.empty())
+	{
+		for (int lane = 0; lane < count; lane++)
+		{
+			distances[lane] = -1.0f;
+			if (triangleHits)
+				triangleHits[lane] = -1;
+		}
+		return;
+	}
+
+	__m128 originX = _mm_loadu_ps(ox), originY = _mm_loadu_ps(oy), originZ = _mm_loadu_ps(oz);
+	__m128 dirX = _mm_loadu_ps(dx), dirY = _mm_loadu_ps(dy), dirZ = _mm_loadu_ps(dz);
+	__m128 invX = _mm_loadu_ps(ix), invY = _mm_loadu_ps(iy), invZ = _mm_loadu_ps(iz);
+	__m128 closest = _mm_loadu_ps(limit);
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 epsilon = _mm_set1_ps(1e-8f);
+	__m128 signMask = _mm_set1_ps(-0.0f);
+
+	int stack[TRAVERSAL_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const Node& node = nodes[stack[--stackSize]];
+
+		// Slab test for all four rays against the node's box
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin[0]), originX), invX);
+		__m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax[0]), originX), invX);
+		__m128 enter = _mm_min_ps(t1, t2);
+		__m128 exit = _mm_max_ps(t1, t2);
+		t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin[1]), originY), invY);
+		t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax[1]), originY), invY);
+		enter = _mm_max_ps(enter, _mm_min_ps(t1, t2));
+		exit = _mm_min_ps(exit, _mm_max_ps(t1, t2));
+		t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin[2]), originZ), invZ);
+		t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax[2]), originZ), invZ);
+		enter = _mm_max_ps(enter, _mm_min_ps(t1, t2));
+		exit = _mm_min_ps(exit, _mm_max_ps(t1, t2));
+
+		__m128 hitsBox = _mm_and_ps(_mm_cmpge_ps(exit, _mm_max_ps(enter, zero)), _mm_cmplt_ps(enter, closest));
+		if ((_mm_movemask_ps(hitsBox) & activeMask) == 0)
+			continue;
+
+		if (node.count == 0)
+		{
+			// Nearer child on top, judged along the axis the children are
+			// furthest apart on, using the first ray's direction
+			const Node& left = nodes[node.first];
+			const Node& right = nodes[node.first + 1];
+			int axis = 0;
+			float bestGap = -1.0f;
+			for (int a = 0; a < 3; a++)
+			{
+				float gap = fabsf((left.boundsMin[a] + left.boundsMax[a]) - (right.boundsMin[a] + right.boundsMax[a]));
+				if (gap > bestGap)
+				{
+					bestGap = gap;
+					axis = a;
+				}
+			}
+			float direction = axis == 0 ? dx[0] : (axis == 1 ? dy[0] : dz[0]);
+			bool leftFirst = (left.boundsMin[axis] + left.boundsMax[axis] < right.boundsMin[axis] + right.boundsMax[axis]) == (direction >= 0);
+
+			if (stackSize + 2 > TRAVERSAL_STACK_SIZE)
+				continue;
+			stack[stackSize++] = leftFirst ? node.first + 1 : node.first;
+			stack[stackSize++] = leftFirst ? node.first : node.first + 1;
+			continue;
+		}
+
+		// Moller-Trumbore, four rays against one triangle at a time
+		for (int t = node.first; t < node.first + node.count; t++)
+		{
+			const Triangle& tri = triangles[t];
+			__m128 e1x = _mm_set1_ps(tri.edge1.x), e1y = _mm_set1_ps(tri.edge1.y), e1z = _mm_set1_ps(tri.edge1.z);
+			__m128 e2x = _mm_set1_ps(tri.edge2.x), e2y = _mm_set1_ps(tri.edge2.y), e2z = _mm_set1_ps(tri.edge2.z);
+
+			// p = d x e2
+			__m128 px = _mm_sub_ps(_mm_mul_ps(dirY, e2z), _mm_mul_ps(dirZ, e2y));
+			__m128 py = _mm_sub_ps(_mm_mul_ps(dirZ, e2x), _mm_mul_ps(dirX, e2z));
+			__m128 pz = _mm_sub_ps(_mm_mul_ps(dirX, e2y), _mm_mul_ps(dirY, e2x));
+			__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+			__m128 invDet = _mm_div_ps(one, det);
+
+			// s = o - v0
+			__m128 sx = _mm_sub_ps(originX, _mm_set1_ps(tri.v0.x));
+			__m128 sy = _mm_sub_ps(originY, _mm_set1_ps(tri.v0.y));
+			__m128 sz = _mm_sub_ps(originZ, _mm_set1_ps(tri.v0.z));
+			__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+
+			// q = s x e1
+			__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+			__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+			__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+			__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dirX, qx), _mm_mul_ps(dirY, qy)), _mm_mul_ps(dirZ, qz)), invDet);
+			__m128 distance = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+			// Both sides count, picking shouldn't care about winding
+			__m128 hit = _mm_cmpgt_ps(_mm_andnot_ps(signMask, det), epsilon);
+			hit = _mm_and_ps(hit, _mm_cmpge_ps(u, zero));
+			hit = _mm_and_ps(hit, _mm_cmpge_ps(v, zero));
+			hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), one));
+			hit = _mm_and_ps(hit, _mm_cmpge_ps(distance, zero));
+			hit = _mm_and_ps(hit, _mm_cmplt_ps(distance, closest));
+
+			int mask = _mm_movemask_ps(hit) & activeMask;
+			if (mask == 0)
+				continue;
+
+			closest = _mm_or_ps(_mm_and_ps(hit, distance), _mm_andnot_ps(hit, closest));
+			for (int lane = 0; lane < 4; lane++)
+			{
+				if (mask & (1 << lane))
+					hitTriangle[lane] = t;
+			}
+		}
+	}
+
+	float result[4];
+	_mm_storeu_ps(result, closest);
+	for (int lane = 0; lane < count; lane++)
+	{
+		distances[lane] = hitTriangle[lane] >= 0 ? result[lane] : -1.0f;
+		if (triangleHits)
+			triangleHits[lane] = hitTriangle[lane] >= 0 ? triangleIds[hitTriangle[lane]] : -1;
+	}
+}
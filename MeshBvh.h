@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+#include <DirectXMath.h>
+
+// A ray in whatever space the BVH was built in.  Hit distances are in
+// units of direction's length, so a ray carried into another space by an
+// affine transform keeps the same distances.
+struct BvhRay
+{
+	DirectX::XMFLOAT3 origin;
+	DirectX::XMFLOAT3 direction;
+	float maxDistance;
+};
+
+// --------------------------------------------------------
+// Bounding volume hierarchy over a mesh's triangles, for
+// ray picking against the real shape instead of a physics
+// proxy.
+//
+// Built once when the mesh loads, splitting on the surface
+// area heuristic evaluated over a fixed number of centroid
+// bins.  Nodes are 32 bytes, two to a cache line, with the
+// children of a node stored next to each other.  Triangles
+// are copied out in leaf order so a leaf's triangles sit
+// together in memory with no index lookups.
+//
+// Rays are traced four at a time with SSE.  Every node is
+// tested against all four rays at once and the packet goes
+// down any subtree at least one of them still hits, so rays
+// that start close together share most of the traversal.
+// --------------------------------------------------------
+class MeshBvh
+{
+public:
+	static const int SAH_BINS = 12;
+	static const int MAX_LEAF_TRIANGLES = 4;
+
+	MeshBvh();
+
+	void Build(const DirectX::XMFLOAT3* positions, int stride, const unsigned int* indices, int numIndex);
+	bool IsBuilt() { return !nodes.empty(); }
+
+	// distances[i] gets the distance to ray i's closest hit, or -1 for a
+	// miss.  triangles, if given, gets the hit triangle in the mesh's
+	// original order.
+	void Intersect(const BvhRay* rays, int count, float* distances, int* triangles = 0);
+	float Intersect(const BvhRay& ray);
+
+	int GetNodeCount() { return (int)nodes.size(); }
+	int GetTriangleCount() { return (int)triangleIds.size(); }
+
+private:
+	struct Node
+	{
+		float boundsMin[3];
+		int first;			// First triangle for a leaf, left child otherwise
+		float boundsMax[3];
+		int count;			// Triangles in a leaf, 0 for an interior node
+	};
+
+	struct Triangle
+	{
+		DirectX::XMFLOAT3 v0;
+		DirectX::XMFLOAT3 edge1;
+		DirectX::XMFLOAT3 edge2;
+	};
+
+	void IntersectPacket(const BvhRay* rays, int count, float* distances, int* triangles);
+	void Subdivide(int node, std::vector<int>& order, const std::vector<DirectX::XMFLOAT3>& centroids, const std::vector<Node>& triangleBounds);
+
+	std::vector<Node> nodes;
+	std::vector<Triangle> triangles;
+	std::vector<int> triangleIds;
+};
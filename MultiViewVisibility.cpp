@@ -0,0 +1,290 @@
+#include "MultiViewVisibility.h"
+#include <math.h>
+
+using namespace DirectX;
+
+MultiViewVisibility::MultiViewVisibility()
+{
+	cleanCount = 0;
+	moveThreshold = 2.0f;
+	turnThreshold = 0.1f;
+	cacheValid = false;
+	lastGatherCached = false;
+	cachedViewCount = 0;
+
+	for (int v = 0; v < MAX_VIEWS; v++)
+	{
+		widePlaneSets[v] = widePlanes[v];
+		testedCameras[v] = 0;
+		testedVersions[v] = 0;
+	}
+
+	ClearViews();
+}
+
+MultiViewVisibility::~MultiViewVisibility()
+{
+}
+
+void MultiViewVisibility::ClearViews()
+{
+	viewCount = 0;
+	for (int v = 0; v < MAX_VIEWS; v++)
+	{
+		cameras[v] = 0;
+		visibleCount[v] = 0;
+	}
+}
+
+int MultiViewVisibility::AddView(Camera* camera)
+{
+	if (viewCount == MAX_VIEWS)
+		return -1;
+
+	int view = viewCount++;
+	cameras[view] = camera;
+	cullers[view].SetCamera(camera);
+	return view;
+}
+
+void MultiViewVisibility::SetCacheThresholds(float moveDistance, float turnAngle)
+{
+	moveThreshold = moveDistance;
+	turnThreshold = turnAngle;
+	cacheValid = false;
+}
+
+void MultiViewVisibility::ProxyChanged(int proxy)
+{
+	if (proxy >= (int)proxyChanged.size())
+		proxyChanged.resize(proxy + 1, 0);
+
+	if (!proxyChanged[proxy])
+	{
+		proxyChanged[proxy] = 1;
+		changedProxies.push_back(proxy);
+	}
+}
+
+// Same views with every camera still inside the margins the widened
+// frusta allowed for
+bool MultiViewVisibility::IsCacheUsable()
+{
+	lastGatherCached = false;
+	if (!cacheValid || cachedViewCount != viewCount)
+		return false;
+
+	// Rotations are unit quaternions, q and -q being the same rotation
+	float minDot = cosf(turnThreshold * 0.5f);
+	for (int v = 0; v < viewCount; v++)
+	{
+		const CachedView& cached = cachedViews[v];
+		if (cached.camera != cameras[v])
+			return false;
+
+		XMFLOAT3 position = cameras[v]->GetPosition();
+		float dx = position.x - cached.position.x;
+		float dy = position.y - cached.position.y;
+		float dz = position.z - cached.position.z;
+		if (dx * dx + dy * dy + dz * dz > moveThreshold * moveThreshold)
+			return false;
+
+		XMFLOAT4 rotation = cameras[v]->GetRotation();
+		float dot = fabsf(rotation.x * cached.rotation.x + rotation.y * cached.rotation.y + rotation.z * cached.rotation.z + rotation.w * cached.rotation.w);
+		if (dot < minDot)
+			return false;
+
+		XMFLOAT4X4 projection = cameras[v]->GetProjection();
+		if (projection._11 != cached.projectionX || projection._22 != cached.projectionY)
+			return false;
+	}
+
+	lastGatherCached = true;
+	return true;
+}
+
+void MultiViewVisibility::BeginFullGather()
+{
+	proxies.clear();
+	objects.clear();
+	bounds.Clear();
+	tightMasks.clear();
+	cleanCount = 0;
+
+	cachedViewCount = viewCount;
+	for (int v = 0; v < viewCount; v++)
+	{
+		CachedView& cached = cachedViews[v];
+		XMFLOAT4X4 projection = cameras[v]->GetProjection();
+		cached.camera = cameras[v];
+		cached.position = cameras[v]->GetPosition();
+		cached.rotation = cameras[v]->GetRotation();
+		cached.projectionX = projection._11;
+		cached.projectionY = projection._22;
+
+		WidenPlanes(cullers[v].GetPlanes(), cached.position, turnThreshold, moveThreshold, widePlanes[v]);
+	}
+	cacheValid = true;
+}
+
+void MultiViewVisibility::AddCandidate(int proxy, void* userData, const XMFLOAT4& sphere)
+{
+	proxies.push_back(proxy);
+	objects.push_back(userData);
+	bounds.Add(sphere);
+	tightMasks.push_back(0);
+}
+
+// Compacts out every candidate whose proxy changed.  Whatever is left
+// keeps its bounds and last tight result.
+void MultiViewVisibility::DropChangedCandidates()
+{
+	int count = (int)proxies.size();
+	int kept = 0;
+	for (int i = 0; i < count; i++)
+	{
+		int proxy = proxies[i];
+		if (proxy < (int)proxyChanged.size() && proxyChanged[proxy])
+			continue;
+
+		proxies[kept] = proxy;
+		objects[kept] = objects[i];
+		bounds.x[kept] = bounds.x[i];
+		bounds.y[kept] = bounds.y[i];
+		bounds.z[kept] = bounds.z[i];
+		bounds.radius[kept] = bounds.radius[i];
+		tightMasks[kept] = tightMasks[i];
+		kept++;
+	}
+
+	proxies.resize(kept);
+	objects.resize(kept);
+	bounds.x.resize(kept);
+	bounds.y.resize(kept);
+	bounds.z.resize(kept);
+	bounds.radius.resize(kept);
+	tightMasks.resize(kept);
+	cleanCount = kept;
+}
+
+void MultiViewVisibility::ClearChangedProxies()
+{
+	for (size_t i = 0; i < changedProxies.size(); i++)
+		proxyChanged[changedProxies[i]] = 0;
+	changedProxies.clear();
+}
+
+// A point the camera could see after turning by up to turnAngle is at most
+// that angle outside the current frustum, so tilting each side plane out by
+// it around its edge through the eye covers every such turn.  Moving the
+// eye shifts every plane by at most the distance moved.
+void MultiViewVisibility::WidenPlanes(const XMFLOAT4* planes, const XMFLOAT3& eye, float turnAngle, float moveDistance, XMFLOAT4* widePlanes)
+{
+	// The near plane faces straight down the view direction
+	XMFLOAT3 forward(planes[4].x, planes[4].y, planes[4].z);
+	float turnCos = cosf(turnAngle);
+	float turnSin = sinf(turnAngle);
+
+	// Slope of the left and bottom planes, for the angle to a far corner
+	float slopeSq[2];
+
+	for (int p = 0; p < 4; p++)
+	{
+		XMFLOAT3 normal(planes[p].x, planes[p].y, planes[p].z);
+
+		// Part of the view direction along the plane, turning the normal
+		// towards it opens the frustum up
+		float along = forward.x * normal.x + forward.y * normal.y + forward.z * normal.z;
+		if (p == 0 || p == 2)
+			slopeSq[p / 2] = along * along < 1.0f ? along * along / (1.0f - along * along) : 0.0f;
+		XMFLOAT3 tangent(forward.x - along * normal.x, forward.y - along * normal.y, forward.z - along * normal.z);
+		float length = sqrtf(tangent.x * tangent.x + tangent.y * tangent.y + tangent.z * tangent.z);
+		if (length > 0)
+		{
+			float inv = 1.0f / length;
+			normal.x = normal.x * turnCos + tangent.x * inv * turnSin;
+			normal.y = normal.y * turnCos + tangent.y * inv * turnSin;
+			normal.z = normal.z * turnCos + tangent.z * inv * turnSin;
+		}
+
+		float w = -(normal.x * eye.x + normal.y * eye.y + normal.z * eye.z);
+		widePlanes[p] = XMFLOAT4(normal.x, normal.y, normal.z, w + moveDistance);
+	}
+
+	// Turning swings the near plane through the eye, so it's dropped.  A
+	// point on the far plane at angle a off the view direction is
+	// far / cos(a) away, and after the turn at least a - turnAngle off it,
+	// so it reaches at most far * (cos(turn) + tan(a) * sin(turn)) along
+	// the old view direction.  The worst a is a far corner.
+	widePlanes[4] = XMFLOAT4(0, 0, 0, 1);
+
+	float farDistance = planes[5].x * eye.x + planes[5].y * eye.y + planes[5].z * eye.z + planes[5].w;
+	float reach = turnCos + sqrtf(slopeSq[0] + slopeSq[1]) * turnSin;
+	if (turnCos > 0 && reach < 1.0f / turnCos)
+		reach = 1.0f / turnCos;
+	float farReach = farDistance * reach + moveDistance;
+	widePlanes[5] = XMFLOAT4(-forward.x, -forward.y, -forward.z, forward.x * eye.x + forward.y * eye.y + forward.z * eye.z + farReach);
+}
+
+// Candidates are only known to be near the widened frusta, so each view
+// runs its SIMD sphere test over them.  A view whose camera hasn't changed
+// since its last test keeps the old answers for the clean candidates and
+// only tests the ones added this frame.
+void MultiViewVisibility::BuildViewLists()
+{
+	int count = (int)objects.size();
+	for (int v = 0; v < viewCount; v++)
+	{
+		visible[v].resize(count);
+		if (count == 0)
+		{
+			visibleCount[v] = 0;
+			continue;
+		}
+
+		bool unchanged = lastGatherCached && testedCameras[v] == cameras[v] && testedVersions[v] == cameras[v]->GetVersion();
+		int first = unchanged ? cleanCount : 0;
+		testedCameras[v] = cameras[v];
+		testedVersions[v] = cameras[v]->GetVersion();
+
+		int* list = &visible[v][0];
+		unsigned int bit = 1u << v;
+		int written = 0;
+		for (int i = 0; i < first; i++)
+		{
+			if (tightMasks[i] & bit)
+				list[written++] = i;
+		}
+
+		if (first < count)
+		{
+			int culled = cullers[v].CullSpheres(&bounds.x[first], &bounds.y[first], &bounds.z[first], &bounds.radius[first], count - first, list + written);
+			for (int i = 0; i < culled; i++)
+				list[written + i] += first;
+			written += culled;
+		}
+		visibleCount[v] = written;
+	}
+
+	// Masks now only keep the views that passed the tight test
+	for (int i = 0; i < count; i++)
+		tightMasks[i] = 0;
+	for (int v = 0; v < viewCount; v++)
+	{
+		for (int i = 0; i < visibleCount[v]; i++)
+			tightMasks[visible[v][i]] |= 1u << v;
+	}
+	viewMasks = tightMasks;
+}
+
+// The culled-out entries may have been overwritten by the in-place
+// compaction, so the view's bit is cleared everywhere and set again
+void MultiViewVisibility::TrimView(int view, int count)
+{
+	unsigned int bit = 1u << view;
+	for (size_t i = 0; i < viewMasks.size(); i++)
+		viewMasks[i] &= ~bit;
+	for (int i = 0; i < count; i++)
+		viewMasks[visible[view][i]] |= bit;
+	visibleCount[view] = count;
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <vector>
+#include <DirectXMath.h>
+#include "Camera.h"
+#include "FrustumCuller.h"
+#include "DynamicAabbTree.h"
+
+// --------------------------------------------------------
+// Visibility for several views from one scene traversal.
+//
+// Every view the frame needs (main camera, minimap, later
+// shadows or mirrors) is added up front, then Gather() walks
+// the scene tree once, testing each node against all the
+// frusta together.  Each object that any view can see ends
+// up in one shared list with a bit per view, and every view
+// gets its own list of indices into it, in traversal order.
+//
+// Results carry over between frames.  A full walk tests the
+// tree against frusta widened by how far each camera may
+// still move and turn, so what it finds stays a superset of
+// what the views can see until a camera goes past that.
+// Until then Gather() skips the tree: only proxies reported
+// through ProxyChanged() are re-tested, and the tight per
+// view sphere test only reruns for a view whose camera has
+// changed at all.  Anything that didn't move, static or
+// asleep, costs nothing but a copy.
+// --------------------------------------------------------
+class MultiViewVisibility
+{
+public:
+	static const int MAX_VIEWS = DynamicAabbTree::MAX_QUERY_VIEWS;
+
+	MultiViewVisibility();
+	~MultiViewVisibility();
+
+	// Views for this frame.  AddView returns the view's index, or -1 when full.
+	void ClearViews();
+	int AddView(Camera* camera);
+	int GetViewCount() { return viewCount; }
+	Camera* GetCamera(int view) { return cameras[view]; }
+
+	// How far a camera can move, and turn in radians, before the cached
+	// candidates have to be found again with a full walk
+	void SetCacheThresholds(float moveDistance, float turnAngle);
+
+	// Tell the cache about every proxy created, moved or destroyed since
+	// the last Gather()
+	void ProxyChanged(int proxy);
+	void InvalidateCache() { cacheValid = false; }
+
+	// Updates the visible lists for all views.  boundsOf(userData) gives an
+	// object's world bounding sphere for the tight per-view test.
+	template<typename F>
+	void Gather(DynamicAabbTree* tree, F boundsOf)
+	{
+		if (!IsCacheUsable())
+		{
+			// Everything the widened frusta touch becomes a candidate
+			BeginFullGather();
+			tree->QueryFrustums(widePlaneSets, viewCount, [&](int proxy, unsigned int viewMask)
+			{
+				AddCandidate(proxy, tree->GetUserData(proxy), boundsOf(tree->GetUserData(proxy)));
+				return true;
+			});
+		}
+		else
+		{
+			// Keep the candidates that didn't change, then put back the
+			// changed proxies that still touch the widened frusta
+			DropChangedCandidates();
+			for (size_t i = 0; i < changedProxies.size(); i++)
+			{
+				int proxy = changedProxies[i];
+				if (tree->IsProxy(proxy) && tree->GetFrustumMask(proxy, widePlaneSets, viewCount) != 0)
+					AddCandidate(proxy, tree->GetUserData(proxy), boundsOf(tree->GetUserData(proxy)));
+			}
+		}
+		ClearChangedProxies();
+
+		BuildViewLists();
+	}
+
+	// True if the last Gather() got by without walking the tree
+	bool WasCacheHit() { return lastGatherCached; }
+
+	// Everything some view can see
+	int GetObjectCount() { return (int)objects.size(); }
+	void* GetObject(int index) { return objects[index]; }
+	unsigned int GetViewMask(int index) { return viewMasks[index]; }
+	const BoundingSphereList& GetBounds() { return bounds; }
+
+	// Indices into the object list for one view
+	int GetVisibleCount(int view) { return visibleCount[view]; }
+	int* GetVisible(int view) { return visible[view].empty() ? 0 : &visible[view][0]; }
+
+	// For extra culling done on a view's list in place (occlusion and the
+	// like): keeps the first count entries and fixes up the view bits
+	void TrimView(int view, int count);
+
+private:
+	// Where a view's camera was when the candidates were found
+	struct CachedView
+	{
+		Camera* camera;
+		DirectX::XMFLOAT3 position;
+		DirectX::XMFLOAT4 rotation;
+		float projectionX;
+		float projectionY;
+	};
+
+	bool IsCacheUsable();
+	void BeginFullGather();
+	void AddCandidate(int proxy, void* userData, const DirectX::XMFLOAT4& sphere);
+	void DropChangedCandidates();
+	void ClearChangedProxies();
+	void BuildViewLists();
+
+	// Planes that hold everything the view could see after moving up to
+	// moveDistance and turning up to turnAngle
+	static void WidenPlanes(const DirectX::XMFLOAT4* planes, const DirectX::XMFLOAT3& eye, float turnAngle, float moveDistance, DirectX::XMFLOAT4* widePlanes);
+
+	int viewCount;
+	Camera* cameras[MAX_VIEWS];
+	FrustumCuller cullers[MAX_VIEWS];
+
+	// Candidates, kept between frames.  Clean ones come first, the ones
+	// added this frame after them.
+	std::vector<int> proxies;
+	std::vector<void*> objects;
+	BoundingSphereList bounds;
+	std::vector<unsigned int> tightMasks;	// Per view sphere test, before any TrimView()
+	std::vector<unsigned int> viewMasks;
+	int cleanCount;
+
+	float moveThreshold;
+	float turnThreshold;
+	bool cacheValid;
+	bool lastGatherCached;
+	int cachedViewCount;
+	CachedView cachedViews[MAX_VIEWS];
+	DirectX::XMFLOAT4 widePlanes[MAX_VIEWS][6];
+	const DirectX::XMFLOAT4* widePlaneSets[MAX_VIEWS];
+
+	// Camera versions seen by the last tight test of each view
+	Camera* testedCameras[MAX_VIEWS];
+	unsigned int testedVersions[MAX_VIEWS];
+
+	std::vector<int> changedProxies;
+	std::vector<unsigned char> proxyChanged;
+
+	std::vector<int> visible[MAX_VIEWS];
+	int visibleCount[MAX_VIEWS];
+};
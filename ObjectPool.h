@@ -0,0 +1,152 @@
+#pragma once
+
+#include <malloc.h>
+#include <string.h>
+#include <new>
+#include <utility>
+
+// --------------------------------------------------------
+// Reference to an object in an ObjectPool.  The generation is
+// bumped every time a slot is freed, so a handle kept around
+// after its object was destroyed is detected as stale instead
+// of silently pointing at whatever reused the slot.
+// --------------------------------------------------------
+struct PoolHandle
+{
+	unsigned int index;
+	unsigned int generation;
+};
+
+static const unsigned int INVALID_POOL_INDEX = 0xffffffff;
+
+inline PoolHandle InvalidPoolHandle()
+{
+	PoolHandle handle = { INVALID_POOL_INDEX, 0 };
+	return handle;
+}
+
+inline bool operator==(const PoolHandle& a, const PoolHandle& b) { return a.index == b.index && a.generation == b.generation; }
+inline bool operator!=(const PoolHandle& a, const PoolHandle& b) { return !(a == b); }
+
+// --------------------------------------------------------
+// Fixed-capacity pool of T with generational handles.
+//
+// All storage is allocated once up front and objects are
+// constructed in place, so Create and Destroy are O(1) through
+// an intrusive free list and never touch the heap.  Object
+// addresses are stable for as long as the object lives.
+// --------------------------------------------------------
+template<typename T>
+class ObjectPool
+{
+public:
+	ObjectPool(int capacity)
+	{
+		this->capacity = capacity;
+		count = 0;
+
+		size_t alignment = alignof(T) > 16 ? alignof(T) : 16;
+		storage = (unsigned char*)_aligned_malloc(sizeof(T) * capacity, alignment);
+		generations = new unsigned int[capacity];
+		nextFree = new int[capacity];
+		alive = new bool[capacity];
+
+		// Chain every slot into the free list, lowest index first
+		for (int i = 0; i < capacity; i++)
+		{
+			generations[i] = 0;
+			nextFree[i] = i + 1;
+			alive[i] = false;
+		}
+		if (capacity > 0)
+			nextFree[capacity - 1] = -1;
+		freeHead = capacity > 0 ? 0 : -1;
+	}
+
+	~ObjectPool()
+	{
+		for (int i = 0; i < capacity; i++)
+		{
+			if (alive[i])
+				Slot(i)->~T();
+		}
+
+		_aligned_free(storage);
+		delete[] generations;
+		delete[] nextFree;
+		delete[] alive;
+	}
+
+	// Constructs a new object in a free slot.  Returns an invalid
+	// handle if the pool is full.
+	template<typename... Args>
+	PoolHandle Create(Args&&... args)
+	{
+		if (freeHead < 0)
+			return InvalidPoolHandle();
+
+		int index = freeHead;
+		freeHead = nextFree[index];
+
+		new (Slot(index)) T(std::forward<Args>(args)...);
+		alive[index] = true;
+		count++;
+
+		PoolHandle handle = { (unsigned int)index, generations[index] };
+		return handle;
+	}
+
+	void Destroy(PoolHandle handle)
+	{
+		if (!IsValid(handle))
+			return;
+
+		int index = (int)handle.index;
+		Slot(index)->~T();
+		alive[index] = false;
+
+		// Invalidate every outstanding handle to this slot
+		generations[index]++;
+		nextFree[index] = freeHead;
+		freeHead = index;
+		count--;
+	}
+
+	bool IsValid(PoolHandle handle) const
+	{
+		return handle.index < (unsigned int)capacity &&
+			alive[handle.index] &&
+			generations[handle.index] == handle.generation;
+	}
+
+	// Returns null for stale or invalid handles
+	T* Get(PoolHandle handle)
+	{
+		return IsValid(handle) ? Slot((int)handle.index) : 0;
+	}
+
+	int GetCount() const { return count; }
+	int GetCapacity() const { return capacity; }
+
+	// Touches all the storage now, so the first objects to use each page
+	// don't pay for the page fault in the middle of a frame
+	void Prewarm()
+	{
+		for (int i = 0; i < capacity; i++)
+		{
+			if (!alive[i])
+				memset(Slot(i), 0, sizeof(T));
+		}
+	}
+
+private:
+	T* Slot(int index) { return (T*)(storage + sizeof(T) * index); }
+
+	unsigned char* storage;
+	unsigned int* generations;
+	int* nextFree;
+	bool* alive;
+	int freeHead;
+	int capacity;
+	int count;
+};
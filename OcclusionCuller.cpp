@@ -0,0 +1,394 @@
+#include "OcclusionCuller.h"
+#include <malloc.h>
+#include <math.h>
+#include <immintrin.h>
+#include <parallel_for.h>
+#include <blocked_range.h>
+
+using namespace DirectX;
+
+// The AVX2 path is compiled in regardless of the project's /arch setting
+// and only called after the CPU says it supports it
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define OCCLUSION_AVX2
+
+static bool CpuHasAvx2()
+{
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	// AVX needs the OS to save the YMM registers too
+	__cpuid(info, 1);
+	bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+	bool hasAvx = (info[2] & (1 << 28)) != 0;
+	if (!osSavesYmm || !hasAvx)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+}
+#else
+#define OCCLUSION_AVX2 __attribute__((target("avx2")))
+
+static bool CpuHasAvx2()
+{
+	return __builtin_cpu_supports("avx2") != 0;
+}
+#endif
+
+// Points closer to the eye than this can't be projected safely
+static const float MIN_CLIP_W = 0.001f;
+
+// Corner order for boxes: bit 0 = x, bit 1 = y, bit 2 = z
+static const int BOX_TRIANGLES[12][3] =
+{
+	{ 0, 2, 3 }, { 0, 3, 1 },	// -z
+	{ 4, 5, 7 }, { 4, 7, 6 },	// +z
+	{ 0, 4, 6 }, { 0, 6, 2 },	// -x
+	{ 1, 3, 7 }, { 1, 7, 5 },	// +x
+	{ 0, 1, 5 }, { 0, 5, 4 },	// -y
+	{ 2, 6, 7 }, { 2, 7, 3 },	// +y
+};
+
+OcclusionCuller::OcclusionCuller(int width, int height)
+{
+	this->width = width;
+	this->height = height;
+	tilesX = width / TILE_WIDTH;
+	tilesY = height / TILE_HEIGHT;
+	useAvx2 = CpuHasAvx2();
+
+	depth = (float*)_aligned_malloc(sizeof(float) * width * height, 32);
+	tileMaxDepth = new float[tilesX * tilesY];
+
+	// Nothing is occluded until something is rasterized
+	for (int i = 0; i < width * height; i++)
+		depth[i] = 1.0f;
+	for (int t = 0; t < tilesX * tilesY; t++)
+		tileMaxDepth[t] = 1.0f;
+
+	XMStoreFloat4x4(&viewProjection, XMMatrixIdentity());
+}
+
+OcclusionCuller::~OcclusionCuller()
+{
+	_aligned_free(depth);
+	delete[] tileMaxDepth;
+}
+
+void OcclusionCuller::SetCamera(Camera* camera)
+{
+	// The camera keeps its matrices transposed for HLSL
+	SetViewProjection(XMMatrixTranspose(XMLoadFloat4x4(&camera->GetViewProjection())));
+}
+
+void OcclusionCuller::SetViewProjection(CXMMATRIX viewProjection)
+{
+	XMStoreFloat4x4(&this->viewProjection, viewProjection);
+}
+
+void OcclusionCuller::AddOccluderBox(const XMFLOAT3& center, const XMFLOAT3& halfExtent)
+{
+	OccluderBox box = { center, halfExtent };
+	occluderBoxes.push_back(box);
+}
+
+bool OcclusionCuller::ProjectPoint(float x, float y, float z, float& screenX, float& screenY, float& screenDepth)
+{
+	const XMFLOAT4X4& m = viewProjection;
+	float w = x * m._14 + y * m._24 + z * m._34 + m._44;
+	if (w < MIN_CLIP_W)
+		return false;
+
+	float invW = 1.0f / w;
+	float clipX = (x * m._11 + y * m._21 + z * m._31 + m._41) * invW;
+	float clipY = (x * m._12 + y * m._22 + z * m._32 + m._42) * invW;
+	float clipZ = (x * m._13 + y * m._23 + z * m._33 + m._43) * invW;
+
+	screenX = (clipX * 0.5f + 0.5f) * width;
+	screenY = (0.5f - clipY * 0.5f) * height;
+	screenDepth = clipZ;
+	return true;
+}
+
+// Projects every occluder box and turns its faces into edge equations
+void OcclusionCuller::SetupTriangles()
+{
+	triangles.clear();
+
+	for (size_t b = 0; b < occluderBoxes.size(); b++)
+	{
+		const OccluderBox& box = occluderBoxes[b];
+
+		float sx[8], sy[8], sz[8];
+		bool projected = true;
+		for (int c = 0; c < 8 && projected; c++)
+		{
+			projected = ProjectPoint(
+				box.center.x + ((c & 1) ? box.halfExtent.x : -box.halfExtent.x),
+				box.center.y + ((c & 2) ? box.halfExtent.y : -box.halfExtent.y),
+				box.center.z + ((c & 4) ? box.halfExtent.z : -box.halfExtent.z),
+				sx[c], sy[c], sz[c]);
+		}
+
+		// Crossing the near plane would need clipping - just don't use it
+		if (!projected)
+			continue;
+
+		for (int t = 0; t < 12; t++)
+		{
+			int v[3] = { BOX_TRIANGLES[t][0], BOX_TRIANGLES[t][1], BOX_TRIANGLES[t][2] };
+
+			// Edge i runs from v[i] to v[i + 1].  Back faces are kept, the
+			// depth test sorts them out, so flip the edges to face inwards.
+			float area = (sx[v[2]] - sx[v[0]]) * (sy[v[1]] - sy[v[0]]) - (sy[v[2]] - sy[v[0]]) * (sx[v[1]] - sx[v[0]]);
+			if (fabsf(area) < 1e-6f)
+				continue;
+			float sign = area > 0 ? 1.0f : -1.0f;
+			float invArea = 1.0f / fabsf(area);
+
+			RasterTriangle tri;
+			for (int e = 0; e < 3; e++)
+			{
+				int i = v[e];
+				int j = v[(e + 1) % 3];
+				tri.edgeA[e] = (sy[j] - sy[i]) * sign;
+				tri.edgeB[e] = -(sx[j] - sx[i]) * sign;
+				tri.edgeC[e] = -(tri.edgeA[e] * sx[i] + tri.edgeB[e] * sy[i]);
+			}
+
+			// Each vertex's weight is the edge opposite it over the area
+			tri.depthA = (tri.edgeA[1] * sz[v[0]] + tri.edgeA[2] * sz[v[1]] + tri.edgeA[0] * sz[v[2]]) * invArea;
+			tri.depthB = (tri.edgeB[1] * sz[v[0]] + tri.edgeB[2] * sz[v[1]] + tri.edgeB[0] * sz[v[2]]) * invArea;
+			tri.depthC = (tri.edgeC[1] * sz[v[0]] + tri.edgeC[2] * sz[v[1]] + tri.edgeC[0] * sz[v[2]]) * invArea;
+
+			float minX = sx[v[0]], maxX = sx[v[0]], minY = sy[v[0]], maxY = sy[v[0]];
+			for (int k = 1; k < 3; k++)
+			{
+				if (sx[v[k]] < minX) minX = sx[v[k]];
+				if (sx[v[k]] > maxX) maxX = sx[v[k]];
+				if (sy[v[k]] < minY) minY = sy[v[k]];
+				if (sy[v[k]] > maxY) maxY = sy[v[k]];
+			}
+
+			tri.minX = minX < 0 ? 0 : (int)minX;
+			tri.minY = minY < 0 ? 0 : (int)minY;
+			tri.maxX = maxX >= width ? width - 1 : (int)maxX;
+			tri.maxY = maxY >= height ? height - 1 : (int)maxY;
+			if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+				continue;
+
+			triangles.push_back(tri);
+		}
+	}
+
+	occluderBoxes.clear();
+}
+
+// Pixel centers in [xStart, xEnd) x [yStart, yEnd], one at a time
+static void RasterizeRows(const OcclusionCuller::RasterTriangle& tri, float* depth, int stride, int xStart, int xEnd, int yStart, int yEnd)
+{
+	for (int y = yStart; y <= yEnd; y++)
+	{
+		float py = y + 0.5f;
+		float* row = depth + y * stride;
+		for (int x = xStart; x < xEnd; x++)
+		{
+			float px = x + 0.5f;
+			if (tri.edgeA[0] * px + tri.edgeB[0] * py + tri.edgeC[0] < 0 ||
+				tri.edgeA[1] * px + tri.edgeB[1] * py + tri.edgeC[1] < 0 ||
+				tri.edgeA[2] * px + tri.edgeB[2] * py + tri.edgeC[2] < 0)
+				continue;
+
+			float z = tri.depthA * px + tri.depthB * py + tri.depthC;
+			if (z < row[x])
+				row[x] = z;
+		}
+	}
+}
+
+// Same thing eight pixels at a time.  xStart and xEnd are multiples of 8.
+OCCLUSION_AVX2 static void RasterizeRowsAvx2(const OcclusionCuller::RasterTriangle& tri, float* depth, int stride, int xStart, int xEnd, int yStart, int yEnd)
+{
+	const __m256 laneOffsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+	const __m256 zero = _mm256_setzero_ps();
+
+	__m256 a0 = _mm256_set1_ps(tri.edgeA[0]), a1 = _mm256_set1_ps(tri.edgeA[1]), a2 = _mm256_set1_ps(tri.edgeA[2]);
+	__m256 depthA = _mm256_set1_ps(tri.depthA);
+
+	for (int y = yStart; y <= yEnd; y++)
+	{
+		float py = y + 0.5f;
+		float* row = depth + y * stride;
+
+		// Row constants: b*y + c
+		__m256 r0 = _mm256_set1_ps(tri.edgeB[0] * py + tri.edgeC[0]);
+		__m256 r1 = _mm256_set1_ps(tri.edgeB[1] * py + tri.edgeC[1]);
+		__m256 r2 = _mm256_set1_ps(tri.edgeB[2] * py + tri.edgeC[2]);
+		__m256 rz = _mm256_set1_ps(tri.depthB * py + tri.depthC);
+
+		for (int x = xStart; x < xEnd; x += 8)
+		{
+			__m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), laneOffsets);
+
+			__m256 inside = _mm256_and_ps(
+				_mm256_and_ps(
+					_mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(a0, px), r0), zero, _CMP_GE_OQ),
+					_mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(a1, px), r1), zero, _CMP_GE_OQ)),
+				_mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(a2, px), r2), zero, _CMP_GE_OQ));
+
+			// Coverage mask for the eight pixels - skip the store when empty
+			if (_mm256_movemask_ps(inside) == 0)
+				continue;
+
+			__m256 old = _mm256_load_ps(row + x);
+			__m256 z = _mm256_min_ps(old, _mm256_add_ps(_mm256_mul_ps(depthA, px), rz));
+			_mm256_store_ps(row + x, _mm256_blendv_ps(old, z, inside));
+		}
+	}
+}
+
+void OcclusionCuller::RasterizeTile(int tile)
+{
+	int x0 = (tile % tilesX) * TILE_WIDTH;
+	int y0 = (tile / tilesX) * TILE_HEIGHT;
+	int x1 = x0 + TILE_WIDTH - 1;
+	int y1 = y0 + TILE_HEIGHT - 1;
+
+	for (int y = y0; y <= y1; y++)
+	{
+		for (int x = x0; x <= x1; x++)
+			depth[y * width + x] = 1.0f;
+	}
+
+	for (size_t t = 0; t < triangles.size(); t++)
+	{
+		const RasterTriangle& tri = triangles[t];
+		if (tri.maxX < x0 || tri.minX > x1 || tri.maxY < y0 || tri.minY > y1)
+			continue;
+
+		int minX = tri.minX > x0 ? tri.minX : x0;
+		int maxX = tri.maxX < x1 ? tri.maxX : x1;
+		int minY = tri.minY > y0 ? tri.minY : y0;
+		int maxY = tri.maxY < y1 ? tri.maxY : y1;
+
+		if (useAvx2)
+		{
+			// Widen to whole groups of 8, still inside the tile
+			int xStart = x0 + ((minX - x0) & ~7);
+			int xEnd = x0 + (((maxX - x0) + 8) & ~7);
+			RasterizeRowsAvx2(tri, depth, width, xStart, xEnd, minY, maxY);
+		}
+		else
+		{
+			RasterizeRows(tri, depth, width, minX, maxX + 1, minY, maxY);
+		}
+	}
+
+	// Farthest depth left in the tile, for the coarse test
+	float tileMax = 0;
+	for (int y = y0; y <= y1; y++)
+	{
+		for (int x = x0; x <= x1; x++)
+		{
+			if (depth[y * width + x] > tileMax)
+				tileMax = depth[y * width + x];
+		}
+	}
+	tileMaxDepth[tile] = tileMax;
+}
+
+void OcclusionCuller::Rasterize()
+{
+	SetupTriangles();
+
+	// Tiles don't share pixels, so each one is its own task
+	tbb::parallel_for(tbb::blocked_range<int>(0, tilesX * tilesY, 4),
+		[this](const tbb::blocked_range<int>& range)
+	{
+		for (int t = range.begin(); t != range.end(); t++)
+			RasterizeTile(t);
+	});
+}
+
+bool OcclusionCuller::TestBox(const XMFLOAT3& boxMin, const XMFLOAT3& boxMax)
+{
+	// Screen rectangle and nearest depth of the box
+	float rectMinX = (float)width, rectMaxX = 0, rectMinY = (float)height, rectMaxY = 0;
+	float nearest = 1.0f;
+	for (int c = 0; c < 8; c++)
+	{
+		float sx, sy, sz;
+		if (!ProjectPoint((c & 1) ? boxMax.x : boxMin.x, (c & 2) ? boxMax.y : boxMin.y, (c & 4) ? boxMax.z : boxMin.z, sx, sy, sz))
+			return true;
+
+		if (sx < rectMinX) rectMinX = sx;
+		if (sx > rectMaxX) rectMaxX = sx;
+		if (sy < rectMinY) rectMinY = sy;
+		if (sy > rectMaxY) rectMaxY = sy;
+		if (sz < nearest) nearest = sz;
+	}
+
+	int minX = rectMinX < 0 ? 0 : (int)rectMinX;
+	int minY = rectMinY < 0 ? 0 : (int)rectMinY;
+	int maxX = rectMaxX >= width ? width - 1 : (int)rectMaxX;
+	int maxY = rectMaxY >= height ? height - 1 : (int)rectMaxY;
+	if (minX > maxX || minY > maxY)
+		return true;
+
+	for (int ty = minY / TILE_HEIGHT; ty <= maxY / TILE_HEIGHT; ty++)
+	{
+		for (int tx = minX / TILE_WIDTH; tx <= maxX / TILE_WIDTH; tx++)
+		{
+			// Everything in the tile is nearer than the box
+			if (nearest >= tileMaxDepth[ty * tilesX + tx])
+				continue;
+
+			int x0 = tx * TILE_WIDTH > minX ? tx * TILE_WIDTH : minX;
+			int x1 = tx * TILE_WIDTH + TILE_WIDTH - 1 < maxX ? tx * TILE_WIDTH + TILE_WIDTH - 1 : maxX;
+			int y0 = ty * TILE_HEIGHT > minY ? ty * TILE_HEIGHT : minY;
+			int y1 = ty * TILE_HEIGHT + TILE_HEIGHT - 1 < maxY ? ty * TILE_HEIGHT + TILE_HEIGHT - 1 : maxY;
+
+			for (int y = y0; y <= y1; y++)
+			{
+				const float* row = depth + y * width;
+				for (int x = x0; x <= x1; x++)
+				{
+					if (nearest < row[x])
+						return true;
+				}
+			}
+		}
+	}
+
+	return false;
+}
+
+int OcclusionCuller::CullSpheres(const BoundingSphereList& spheres, const int* candidates, int count, int* visible)
+{
+	visibleFlags.resize(count);
+
+	tbb::parallel_for(tbb::blocked_range<int>(0, count, 16),
+		[&](const tbb::blocked_range<int>& range)
+	{
+		for (int i = range.begin(); i != range.end(); i++)
+		{
+			int s = candidates[i];
+			float r = spheres.radius[s];
+			XMFLOAT3 boxMin(spheres.x[s] - r, spheres.y[s] - r, spheres.z[s] - r);
+			XMFLOAT3 boxMax(spheres.x[s] + r, spheres.y[s] + r, spheres.z[s] + r);
+			visibleFlags[i] = TestBox(boxMin, boxMax) ? 1 : 0;
+		}
+	});
+
+	int written = 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (visibleFlags[i])
+			visible[written++] = candidates[i];
+	}
+	return written;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <vector>
+#include <DirectXMath.h>
+#include "Camera.h"
+#include "FrustumCuller.h"
+
+// --------------------------------------------------------
+// Software occlusion culling against a small CPU depth buffer.
+//
+// Each frame a handful of big occluders (boxes that are known
+// to sit inside real geometry) are rasterized into a low
+// resolution depth buffer.  The buffer is split into tiles
+// that are rasterized in parallel, eight pixels at a time with
+// AVX2 when the CPU has it, and every tile keeps its farthest
+// depth so most occludees are accepted or rejected without
+// touching individual pixels.
+//
+// Everything runs on the CPU, no device needed.  Depth is D3D
+// style: 0 at the near plane, 1 at the far plane.
+// --------------------------------------------------------
+class OcclusionCuller
+{
+public:
+	static const int TILE_WIDTH = 32;
+	static const int TILE_HEIGHT = 16;
+
+	// width must be a multiple of TILE_WIDTH and height of TILE_HEIGHT
+	OcclusionCuller(int width, int height);
+	~OcclusionCuller();
+
+	void SetCamera(Camera* camera);
+	void SetViewProjection(DirectX::CXMMATRIX viewProjection);
+
+	// Occluders for this frame, cleared by Rasterize()
+	void AddOccluderBox(const DirectX::XMFLOAT3& center, const DirectX::XMFLOAT3& halfExtent);
+	int GetOccluderCount() { return (int)occluderBoxes.size(); }
+
+	// Builds the depth buffer from the occluders added so far
+	void Rasterize();
+
+	// True unless the box is hidden behind the occluders
+	bool TestBox(const DirectX::XMFLOAT3& boxMin, const DirectX::XMFLOAT3& boxMax);
+
+	// Keeps only the candidates whose sphere is not hidden.  candidates
+	// index into spheres.  visible may be the same array as candidates.
+	int CullSpheres(const BoundingSphereList& spheres, const int* candidates, int count, int* visible);
+
+	bool IsUsingAvx2() { return useAvx2; }
+	const float* GetDepthBuffer() { return depth; }
+
+	// Screen space triangle, set up for edge function rasterization
+	struct RasterTriangle
+	{
+		float edgeA[3], edgeB[3], edgeC[3];		// Inside where all a*x + b*y + c >= 0
+		float depthA, depthB, depthC;			// depth = a*x + b*y + c
+		int minX, maxX, minY, maxY;				// Pixel bounds, inclusive
+	};
+
+private:
+	struct OccluderBox
+	{
+		DirectX::XMFLOAT3 center;
+		DirectX::XMFLOAT3 halfExtent;
+	};
+
+	bool ProjectPoint(float x, float y, float z, float& screenX, float& screenY, float& screenDepth);
+	void SetupTriangles();
+	void RasterizeTile(int tile);
+
+	int width;
+	int height;
+	int tilesX;
+	int tilesY;
+	bool useAvx2;
+
+	float* depth;
+	float* tileMaxDepth;
+
+	DirectX::XMFLOAT4X4 viewProjection;
+	std::vector<OccluderBox> occluderBoxes;
+	std::vector<RasterTriangle> triangles;
+	std::vector<unsigned char> visibleFlags;
+};
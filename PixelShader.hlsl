@@ -16,6 +16,7 @@ struct VertexToPixel
 	float2 uv           : TEXCOORD;     // UV co-ordinates
 	float3 tangent		: TANGENT;
 	float3 worldPos		: POSITION;
+	float4 tint			: COLOR;
 };
 
 Texture2D textureSRV : register(t0);
@@ -64,7 +65,7 @@ float4 main(VertexToPixel input) : SV_TARGET
 
 	float lightAmount2 = saturate(dot(input.normal, -normalize(dirLight2.direction)));
 
-	float4 surfaceColor = textureSRV.Sample(basicSampler, input.uv);
+	float4 surfaceColor = textureSRV.Sample(basicSampler, input.uv) * input.tint;
 
 	float4 light1 = ((dirLight1.diffuseColor * lightAmount1 * surfaceColor) + (dirLight1.ambientColor * surfaceColor));
 	float4 light2 = ((dirLight2.diffuseColor * lightAmount2 * surfaceColor) + (dirLight2.ambientColor * surfaceColor));
@@ -1,6 +1,12 @@
 #include "Renderer.h"
+#include <algorithm>
 
 Renderer::Renderer() {
+	SetLights();
+	ResetDrawListStats();
+	collectDrawListStats = false;
+	ResetStateStats();
+	InvalidateState();
 }
 
 
@@ -10,6 +16,9 @@ Renderer::~Renderer() {
 void Renderer::SetLights() {
 	dirLight1.SetLightValues(XMFLOAT4(0.1f, 0.1f, 0.1f, 1.0f), XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f), XMFLOAT3(1.0f, -1.0f, 0));
 	dirLight2.SetLightValues(XMFLOAT4(0.1f, 0.1f, 0.1f, 1.0f), XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f), XMFLOAT3(1.0f, -1.0f, 0));
+
+	// Every shader has to pick up the new values
+	litPixelShaders.clear();
 }
 
 void Renderer::SetVertexBuffer(GameEntity* &gameEntity, ID3D11Buffer* &vertexBuffer) {
@@ -23,53 +32,233 @@ void Renderer::SetIndexBuffer(GameEntity* &gameEntity, ID3D11Buffer* &indexBuffe
 void Renderer::SetVertexShader(SimpleVertexShader* &vertexShader, GameEntity* &gameEntity, Camera* &camera) {
 	vertexShader = gameEntity->GetMaterial()->GetVertexShader();
 	vertexShader->SetMatrix4x4("world", *gameEntity->GetWorldMatrix());
-	vertexShader->SetMatrix4x4("view", camera->GetView());
-	vertexShader->SetMatrix4x4("projection", camera->GetProjection());
+	vertexShader->SetMatrix4x4("viewProjection", camera->GetViewProjection());
 
 	vertexShader->CopyAllBufferData();
-	vertexShader->SetShader();
+	BindVertexShader(vertexShader);
 }
 
 void Renderer::SetPixelShader(SimplePixelShader* &pixelShader, GameEntity* &gameEntity, Camera* &camera) {
-	SetLights();
 	pixelShader = gameEntity->GetMaterial()->GetPixelShader();
+	UploadLights(pixelShader);
+
+	BindPixelResource(pixelShader, "textureSRV", gameEntity->GetMaterial()->GetMaterialSRV());
+	BindPixelResource(pixelShader, "normalMapSRV", gameEntity->GetMaterial()->GetNormalSRV());
+	BindPixelSampler(pixelShader, "basicSampler", gameEntity->GetMaterial()->GetMaterialSampler());
+
+	BindPixelShader(pixelShader);
+}
+
+void Renderer::UploadLights(SimplePixelShader* pixelShader) {
+	if (std::find(litPixelShaders.begin(), litPixelShaders.end(), pixelShader) != litPixelShaders.end())
+		return;
+
 	pixelShader->SetData("dirLight1", &dirLight1, sizeof(DirectionalLight));
 	pixelShader->SetData("dirLight2", &dirLight2, sizeof(DirectionalLight));
+	pixelShader->CopyAllBufferData();
+	litPixelShaders.push_back(pixelShader);
+}
 
-	pixelShader->SetShaderResourceView("textureSRV", gameEntity->GetMaterial()->GetMaterialSRV());
-	pixelShader->SetShaderResourceView("normalMapSRV", gameEntity->GetMaterial()->GetNormalSRV());
-	pixelShader->SetSamplerState("basicSampler", gameEntity->GetMaterial()->GetMaterialSampler());
+bool Renderer::CountBind(bool changed) {
+	if (changed)
+		stateStats.issued++;
+	else
+		stateStats.skipped++;
+	return changed;
+}
 
-	pixelShader->CopyAllBufferData();
-	pixelShader->SetShader();
+void Renderer::BindVertexShader(SimpleVertexShader* vertexShader) {
+	// SetShader() also binds the input layout and constant buffers
+	if (CountBind(boundVertexShader.Change(vertexShader)))
+		vertexShader->SetShader();
 }
 
-void Renderer::SetPixelShaderMiniMap(SimplePixelShader *& pixelShader, GameEntity *& gameEntity, Camera *& camera, ID3D11ShaderResourceView * redSRV, XMFLOAT3 entityPos, Camera *& camera2)
-{
-	SetLights();
-	XMFLOAT3 difference;
+void Renderer::BindPixelShader(SimplePixelShader* pixelShader) {
+	if (CountBind(boundPixelShader.Change(pixelShader)))
+		pixelShader->SetShader();
+}
 
-	difference.x = abs(camera2->GetPosition().x - entityPos.x);
-	difference.y = abs(camera2->GetPosition().y - entityPos.y);
-	difference.z = abs(camera2->GetPosition().z - entityPos.z);
+// Cached by register, so shaders that put the same texture in the same slot
+// share it
+void Renderer::BindPixelResource(SimplePixelShader* pixelShader, const std::string& name, ID3D11ShaderResourceView* srv) {
+	const SimpleSRV* info = pixelShader->GetShaderResourceViewInfo(name);
+	if (info == 0 || info->BindIndex >= MAX_PIXEL_RESOURCES) {
+		pixelShader->SetShaderResourceView(name, srv);
+		return;
+	}
 
-	pixelShader = gameEntity->GetMaterial()->GetPixelShader();
-	pixelShader->SetShaderResourceView("textureSRV", gameEntity->GetMaterial()->GetMaterialSRV());
-	pixelShader->SetShaderResourceView("normalMapSRV", gameEntity->GetMaterial()->GetNormalSRV());
+	if (CountBind(boundPixelResources[info->BindIndex].Change(srv)))
+		pixelShader->SetShaderResourceView(name, srv);
+}
 
-	if (difference.x < 5.0f && difference.y < 5.0f && difference.z < 5.0f) {
-		pixelShader->SetShaderResourceView("textureSRV", redSRV);
+void Renderer::BindPixelSampler(SimplePixelShader* pixelShader, const std::string& name, ID3D11SamplerState* sampler) {
+	const SimpleSampler* info = pixelShader->GetSamplerInfo(name);
+	if (info == 0 || info->BindIndex >= MAX_PIXEL_SAMPLERS) {
+		pixelShader->SetSamplerState(name, sampler);
+		return;
 	}
 
-	pixelShader->SetData("dirLight1", &dirLight1, sizeof(DirectionalLight));
-	pixelShader->SetData("dirLight2", &dirLight2, sizeof(DirectionalLight));
+	if (CountBind(boundPixelSamplers[info->BindIndex].Change(sampler)))
+		pixelShader->SetSamplerState(name, sampler);
+}
 
-	pixelShader->SetSamplerState("basicSampler", gameEntity->GetMaterial()->GetMaterialSampler());
+void Renderer::BindVertexBuffer(ID3D11DeviceContext* context, int slot, ID3D11Buffer* buffer, UINT stride) {
+	// Both have to be checked, so no short circuit
+	bool changed = boundVertexBuffers[slot].Change(buffer) | boundStrides[slot].Change(stride);
+	if (CountBind(changed)) {
+		UINT offset = 0;
+		context->IASetVertexBuffers(slot, 1, &buffer, &stride, &offset);
+	}
+}
 
-	pixelShader->CopyAllBufferData();
-	pixelShader->SetShader();
+void Renderer::BindIndexBuffer(ID3D11DeviceContext* context, ID3D11Buffer* buffer) {
+	if (CountBind(boundIndexBuffer.Change(buffer)))
+		context->IASetIndexBuffer(buffer, DXGI_FORMAT_R32_UINT, 0);
 }
 
+void Renderer::BindBlendState(ID3D11DeviceContext* context, ID3D11BlendState* state) {
+	if (CountBind(boundBlendState.Change(state))) {
+		float blend[4] = { 1,1,1,1 };
+		context->OMSetBlendState(state, blend, 0xffffffff);
+	}
+}
 
+void Renderer::BindDepthStencilState(ID3D11DeviceContext* context, ID3D11DepthStencilState* state) {
+	if (CountBind(boundDepthStencilState.Change(state)))
+		context->OMSetDepthStencilState(state, 0);
+}
 
+void Renderer::BindRasterizerState(ID3D11DeviceContext* context, ID3D11RasterizerState* state) {
+	if (CountBind(boundRasterizerState.Change(state)))
+		context->RSSetState(state);
+}
 
+void Renderer::InvalidateState() {
+	boundVertexShader.known = false;
+	boundPixelShader.known = false;
+	for (int i = 0; i < MAX_PIXEL_RESOURCES; i++)
+		boundPixelResources[i].known = false;
+	for (int i = 0; i < MAX_PIXEL_SAMPLERS; i++)
+		boundPixelSamplers[i].known = false;
+	for (int i = 0; i < MAX_VERTEX_BUFFERS; i++) {
+		boundVertexBuffers[i].known = false;
+		boundStrides[i].known = false;
+	}
+	boundIndexBuffer.known = false;
+	boundBlendState.known = false;
+	boundDepthStencilState.known = false;
+	boundRasterizerState.known = false;
+}
+
+void Renderer::ResetStateStats() {
+	stateStats.issued = 0;
+	stateStats.skipped = 0;
+}
+
+void Renderer::ResetDrawListStats() {
+	drawListStats.draws = 0;
+	drawListStats.stateChanges = 0;
+	drawListStats.unsortedStateChanges = 0;
+}
+
+// Changes between neighbouring items, the ones the state cache can't skip
+int Renderer::CountStateChanges(DrawList& list, bool sorted) {
+	int changes = 0;
+	const DrawItem* previous = 0;
+	for (int i = 0; i < list.GetCount(); i++) {
+		const DrawItem& item = sorted ? list.GetItem(i) : list.GetAddedItem(i);
+		Material* material = item.entity->GetMaterial();
+		Mesh* mesh = item.entity->GetMesh();
+
+		bool shaderChanged = !previous ||
+			material->GetVertexShader() != previous->entity->GetMaterial()->GetVertexShader() ||
+			material->GetPixelShader() != previous->entity->GetMaterial()->GetPixelShader();
+		if (shaderChanged)
+			changes++;
+		if (shaderChanged || material != previous->entity->GetMaterial() || item.texture != previous->texture)
+			changes++;
+		bool meshChanged = !previous || mesh != previous->entity->GetMesh();
+		if (meshChanged)
+			changes++;
+		if (meshChanged || item.lod != previous->lod)
+			changes++;
+
+		previous = &item;
+	}
+	return changes;
+}
+
+void Renderer::Submit(ID3D11DeviceContext* context, DrawList& list, Camera* camera) {
+	if (collectDrawListStats) {
+		drawListStats.draws += list.GetCount();
+		drawListStats.stateChanges += CountStateChanges(list, true);
+		drawListStats.unsortedStateChanges += CountStateChanges(list, false);
+	}
+
+	// The state cache drops the binds that repeat the previous item's, so
+	// only the constants need tracking here
+	SimpleVertexShader* viewShader = 0;
+	for (int i = 0; i < list.GetCount(); i++) {
+		const DrawItem& item = list.GetItem(i);
+		GameEntity* entity = item.entity;
+		Material* material = entity->GetMaterial();
+		Mesh* mesh = entity->GetMesh();
+		SimpleVertexShader* vertexShader = material->GetVertexShader();
+		SimplePixelShader* pixelShader = material->GetPixelShader();
+
+		// Per view constants only need to go up with a new shader
+		if (vertexShader != viewShader) {
+			vertexShader->SetMatrix4x4("viewProjection", camera->GetViewProjection());
+			viewShader = vertexShader;
+		}
+		BindVertexShader(vertexShader);
+
+		UploadLights(pixelShader);
+		BindPixelShader(pixelShader);
+		BindPixelResource(pixelShader, "textureSRV", item.texture ? item.texture : material->GetMaterialSRV());
+		BindPixelResource(pixelShader, "normalMapSRV", material->GetNormalSRV());
+		BindPixelSampler(pixelShader, "basicSampler", material->GetMaterialSampler());
+
+		int lod = item.lod;
+		if (lod >= mesh->GetLodCount())
+			lod = mesh->GetLodCount() - 1;
+
+		BindVertexBuffer(context, 0, mesh->GetVertexBuffer(), sizeof(Vertex));
+		BindIndexBuffer(context, mesh->GetIndexBuffer(lod));
+
+		// Only the world matrix changes from item to item
+		vertexShader->SetMatrix4x4("world", *entity->GetWorldMatrix());
+		vertexShader->CopyAllBufferData();
+		context->DrawIndexed(mesh->GetIndexCount(lod), 0, 0);
+	}
+}
+
+void Renderer::DrawInstances(ID3D11DeviceContext* context, InstanceBatch& batch, SimpleVertexShader* vertexShader, Camera* camera) {
+	if (batch.GetCount() == 0)
+		return;
+
+	vertexShader->SetMatrix4x4("viewProjection", camera->GetViewProjection());
+	vertexShader->CopyAllBufferData();
+	BindVertexShader(vertexShader);
+
+	BindVertexBuffer(context, 1, batch.GetInstanceBuffer(), sizeof(InstanceData));
+	for (int g = 0; g < batch.GetGroupCount(); g++) {
+		const InstanceGroup& group = batch.GetGroup(g);
+		Material* material = group.material;
+		SimplePixelShader* pixelShader = material->GetPixelShader();
+
+		UploadLights(pixelShader);
+		BindPixelShader(pixelShader);
+		BindPixelResource(pixelShader, "textureSRV", material->GetMaterialSRV());
+		BindPixelResource(pixelShader, "normalMapSRV", material->GetNormalSRV());
+		BindPixelSampler(pixelShader, "basicSampler", material->GetMaterialSampler());
+
+		int lod = group.lod;
+		if (lod >= group.mesh->GetLodCount())
+			lod = group.mesh->GetLodCount() - 1;
+
+		BindVertexBuffer(context, 0, group.mesh->GetVertexBuffer(), sizeof(Vertex));
+		BindIndexBuffer(context, group.mesh->GetIndexBuffer(lod));
+		context->DrawIndexedInstanced(group.mesh->GetIndexCount(lod), group.count, 0, 0, group.firstInstance);
+	}
+}
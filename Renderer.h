@@ -1,23 +1,136 @@
 #pragma once
 
+#include <string>
+#include <vector>
 #include "GameEntity.h"
 #include "Camera.h"
 #include "Lights.h"
+#include "DrawList.h"
+#include "InstanceBatch.h"
 
+// State changes the draw lists needed, as submitted (sorted) and as they
+// would have been in the order their items were added
+struct DrawListStats
+{
+	int draws;
+	int stateChanges;
+	int unsortedStateChanges;
+};
+
+// Binds that went through the state cache, and how many of them were
+// dropped for asking for what was already bound
+struct RenderStateStats
+{
+	int issued;
+	int skipped;
+};
+
+// --------------------------------------------------------
+// Draws entities, draw lists and instance batches.
+//
+// Shaders, buffers, pixel shader resources and samplers,
+// and the blend, depth and raster states all go through a
+// cache of what's bound, so asking for the same state twice
+// in a row costs nothing.  Anything drawn outside the
+// renderer (sprites, particles, impostors) changes state
+// behind its back, so InvalidateState() must be called
+// after it.
+// --------------------------------------------------------
 class Renderer {
 public:
+	static const int MAX_VERTEX_BUFFERS = 2;
+	static const int MAX_PIXEL_RESOURCES = 8;
+	static const int MAX_PIXEL_SAMPLERS = 4;
 	
 	Renderer();
 	~Renderer();
 
 	void SetLights();
 
+	// Anything lit outside the renderer should use these, so it matches
+	const DirectionalLight& GetDirLight1() { return dirLight1; }
+	const DirectionalLight& GetDirLight2() { return dirLight2; }
+
 	void SetVertexBuffer(GameEntity* &gameEntity, ID3D11Buffer* &vertexBuffer);
 	void SetIndexBuffer(GameEntity* &gameEntity, ID3D11Buffer* &indexBuffer);
 	void SetVertexShader(SimpleVertexShader* &vertexShader, GameEntity* &gameEntity, Camera* &camera);
 	void SetPixelShader(SimplePixelShader* &pixelShader, GameEntity* &gameEntity, Camera* &camera);
-	void SetPixelShaderMiniMap(SimplePixelShader* &pixelShader, GameEntity* &gameEntity, Camera* &camera, ID3D11ShaderResourceView* redSRV, XMFLOAT3 entityPos, Camera *& camera2);
+
+	// Draws a sorted list.  Shaders, material, vertex buffer and index
+	// buffer only get bound when they differ from the previous item's.
+	void Submit(ID3D11DeviceContext* context, DrawList& list, Camera* camera);
+	const DrawListStats& GetDrawListStats() { return drawListStats; }
+	void ResetDrawListStats();
+
+	// Off by default.  Counting the changes walks each list twice more.
+	void SetCollectDrawListStats(bool collect) { collectDrawListStats = collect; }
+
+	// One instanced draw per group in the batch, which must already be
+	// uploaded.  vertexShader reads the world matrix from the instance data.
+	void DrawInstances(ID3D11DeviceContext* context, InstanceBatch& batch, SimpleVertexShader* vertexShader, Camera* camera);
+
+	// Each one only reaches the device if the state differs from what the
+	// cache last bound.  Shader constants aren't cached, they still have to
+	// be copied up with CopyAllBufferData().
+	void BindVertexShader(SimpleVertexShader* vertexShader);
+	void BindPixelShader(SimplePixelShader* pixelShader);
+	void BindPixelResource(SimplePixelShader* pixelShader, const std::string& name, ID3D11ShaderResourceView* srv);
+	void BindPixelSampler(SimplePixelShader* pixelShader, const std::string& name, ID3D11SamplerState* sampler);
+	void BindVertexBuffer(ID3D11DeviceContext* context, int slot, ID3D11Buffer* buffer, UINT stride);
+	void BindIndexBuffer(ID3D11DeviceContext* context, ID3D11Buffer* buffer);
+	void BindBlendState(ID3D11DeviceContext* context, ID3D11BlendState* state);	// Blend factor of 1s, all samples
+	void BindDepthStencilState(ID3D11DeviceContext* context, ID3D11DepthStencilState* state);	// Stencil ref of 0
+	void BindRasterizerState(ID3D11DeviceContext* context, ID3D11RasterizerState* state);
+
+	// Forget everything bound, so the next bind of each state goes through
+	void InvalidateState();
+
+	const RenderStateStats& GetStateStats() { return stateStats; }
+	void ResetStateStats();
+
 private:
+	// One piece of bound state, unknown until first bound
+	template <typename T>
+	struct CachedState
+	{
+		T value;
+		bool known;
+
+		// True if value has to be bound, and remembers it as bound
+		bool Change(T newValue) {
+			if (known && value == newValue)
+				return false;
+			value = newValue;
+			known = true;
+			return true;
+		}
+	};
+
+	int CountStateChanges(DrawList& list, bool sorted);
+
+	// Counts a bind as issued or skipped, passing changed back
+	bool CountBind(bool changed);
+
+	// Lights never change, so each pixel shader only needs them copied into
+	// its constant buffer once
+	void UploadLights(SimplePixelShader* pixelShader);
+
+	DrawListStats drawListStats;
+	bool collectDrawListStats;
+	RenderStateStats stateStats;
+
+	CachedState<SimpleVertexShader*> boundVertexShader;
+	CachedState<SimplePixelShader*> boundPixelShader;
+	CachedState<ID3D11ShaderResourceView*> boundPixelResources[MAX_PIXEL_RESOURCES];
+	CachedState<ID3D11SamplerState*> boundPixelSamplers[MAX_PIXEL_SAMPLERS];
+	CachedState<ID3D11Buffer*> boundVertexBuffers[MAX_VERTEX_BUFFERS];
+	CachedState<UINT> boundStrides[MAX_VERTEX_BUFFERS];
+	CachedState<ID3D11Buffer*> boundIndexBuffer;
+	CachedState<ID3D11BlendState*> boundBlendState;
+	CachedState<ID3D11DepthStencilState*> boundDepthStencilState;
+	CachedState<ID3D11RasterizerState*> boundRasterizerState;
+
+	std::vector<SimplePixelShader*> litPixelShaders;
 	
 	ID3D11Buffer *vertexBufferRender;
 	ID3D11Buffer *indexBufferRender;
@@ -0,0 +1,390 @@
+#include "SceneFile.h"
+#include <Windows.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <math.h>
+
+using namespace DirectX;
+
+SceneFile::SceneFile()
+{
+	fileHandle = INVALID_HANDLE_VALUE;
+	mappingHandle = 0;
+	data = 0;
+	header = 0;
+	meshes = 0;
+	entities = 0;
+	transforms = 0;
+	bodies = 0;
+	sectors = 0;
+	sectorEntities = 0;
+	strings = 0;
+}
+
+SceneFile::~SceneFile()
+{
+	Unload();
+}
+
+bool SceneFile::Load(const char* path)
+{
+	Unload();
+
+	fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(fileHandle, &size) || size.QuadPart < (long long)sizeof(SceneFileHeader) || size.QuadPart > 0x7fffffff)
+	{
+		Unload();
+		return false;
+	}
+
+	mappingHandle = CreateFileMappingA(fileHandle, 0, PAGE_READONLY, 0, 0, 0);
+	if (mappingHandle)
+		data = (const unsigned char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+
+	if (!data || !Validate((unsigned int)size.QuadPart))
+	{
+		printf("Scene file %s is missing or corrupt\n", path);
+		Unload();
+		return false;
+	}
+	return true;
+}
+
+void SceneFile::Unload()
+{
+	if (data)
+		UnmapViewOfFile(data);
+	if (mappingHandle)
+		CloseHandle(mappingHandle);
+	if (fileHandle != INVALID_HANDLE_VALUE)
+		CloseHandle(fileHandle);
+
+	fileHandle = INVALID_HANDLE_VALUE;
+	mappingHandle = 0;
+	data = 0;
+	header = 0;
+}
+
+const char* SceneFile::GetMeshPath(int mesh)
+{
+	return strings + meshes[mesh].pathOffset;
+}
+
+// True if count records of recordSize fit at offset inside the file
+static bool ArrayFits(unsigned int offset, unsigned int count, unsigned int recordSize, unsigned int fileSize)
+{
+	if (offset % 4 != 0 || offset > fileSize)
+		return false;
+	return (unsigned long long)count * recordSize <= fileSize - offset;
+}
+
+// The arrays are used in place, so every index in them gets checked
+// once here rather than on every access
+bool SceneFile::Validate(unsigned int size)
+{
+	header = (const SceneFileHeader*)data;
+	if (header->magic != SCENE_FILE_MAGIC || header->version != SCENE_FILE_VERSION || header->fileSize != size)
+		return false;
+
+	if (!ArrayFits(header->meshOffset, header->meshCount, sizeof(SceneMeshRecord), size) ||
+		!ArrayFits(header->entityOffset, header->entityCount, sizeof(SceneEntityRecord), size) ||
+		!ArrayFits(header->transformOffset, header->entityCount, sizeof(SceneTransformRecord), size) ||
+		!ArrayFits(header->bodyOffset, header->bodyCount, sizeof(SceneBodyRecord), size) ||
+		!ArrayFits(header->stringOffset, header->stringSize, 1, size) ||
+		!ArrayFits(header->sectorOffset, header->sectorCount, sizeof(SceneSectorRecord), size) ||
+		!ArrayFits(header->sectorEntityOffset, header->sectorEntityCount, sizeof(unsigned int), size))
+		return false;
+	if (!(header->sectorSize > 0))
+		return false;
+
+	meshes = (const SceneMeshRecord*)(data + header->meshOffset);
+	entities = (const SceneEntityRecord*)(data + header->entityOffset);
+	transforms = (const SceneTransformRecord*)(data + header->transformOffset);
+	bodies = (const SceneBodyRecord*)(data + header->bodyOffset);
+	sectors = (const SceneSectorRecord*)(data + header->sectorOffset);
+	sectorEntities = (const unsigned int*)(data + header->sectorEntityOffset);
+	strings = (const char*)(data + header->stringOffset);
+
+	// Strings are null terminated, so a terminated block can't be overrun
+	if (header->stringSize == 0 || strings[header->stringSize - 1] != 0)
+		return false;
+
+	for (unsigned int i = 0; i < header->meshCount; i++)
+	{
+		if (meshes[i].pathOffset >= header->stringSize)
+			return false;
+	}
+	for (unsigned int i = 0; i < header->entityCount; i++)
+	{
+		if (entities[i].mesh >= header->meshCount)
+			return false;
+		if (entities[i].body != SCENE_NO_BODY && entities[i].body >= header->bodyCount)
+			return false;
+	}
+	for (unsigned int i = 0; i < header->bodyCount; i++)
+	{
+		if (bodies[i].entity >= header->entityCount || bodies[i].shape != SCENE_BODY_SPHERE)
+			return false;
+	}
+	for (unsigned int i = 0; i < header->sectorCount; i++)
+	{
+		if (sectors[i].firstEntity > header->sectorEntityCount ||
+			sectors[i].entityCount > header->sectorEntityCount - sectors[i].firstEntity)
+			return false;
+	}
+	for (unsigned int i = 0; i < header->sectorEntityCount; i++)
+	{
+		if (sectorEntities[i] >= header->entityCount)
+			return false;
+	}
+	return true;
+}
+
+bool SceneFile::IsCookedUpToDate(const char* textPath, const char* binaryPath)
+{
+	WIN32_FILE_ATTRIBUTE_DATA text;
+	WIN32_FILE_ATTRIBUTE_DATA binary;
+	if (!GetFileAttributesExA(binaryPath, GetFileExInfoStandard, &binary))
+		return false;
+	if (!GetFileAttributesExA(textPath, GetFileExInfoStandard, &text))
+		return true;	// Nothing to cook from, use what's there
+	return CompareFileTime(&text.ftLastWriteTime, &binary.ftLastWriteTime) <= 0;
+}
+
+// Same order GameEntity::SetRotation uses: Z, then Y, then X
+static XMFLOAT4 EulerToQuaternion(float x, float y, float z)
+{
+	XMVECTOR qx = XMQuaternionRotationAxis(XMVectorSet(1, 0, 0, 0), x);
+	XMVECTOR qy = XMQuaternionRotationAxis(XMVectorSet(0, 1, 0, 0), y);
+	XMVECTOR qz = XMQuaternionRotationAxis(XMVectorSet(0, 0, 1, 0), z);
+
+	XMFLOAT4 q;
+	XMStoreFloat4(&q, XMQuaternionMultiply(XMQuaternionMultiply(qz, qy), qx));
+	return q;
+}
+
+// Used when the level doesn't give one
+static const float DEFAULT_SECTOR_SIZE = 32.0f;
+
+static unsigned int AlignOffset(unsigned int offset)
+{
+	return (offset + 15) & ~15u;
+}
+
+// Text format, one item per line, # starts a comment:
+//   sectorsize <size>
+//   mesh <name> <obj path>
+//   entity <mesh name> [global] [material n] [position x y z] [rotation x y z] [scale x y z] [body sphere radius mass]
+// Rotation is in radians.  Entities with a body are spawned as physics objects.
+bool SceneFile::Cook(const char* textPath, const char* binaryPath)
+{
+	std::ifstream text(textPath);
+	if (!text.is_open())
+		return false;
+
+	std::vector<std::string> meshNames;
+	std::vector<unsigned int> meshPaths;
+	std::vector<SceneEntityRecord> entityRecords;
+	std::vector<SceneTransformRecord> transformRecords;
+	std::vector<SceneBodyRecord> bodyRecords;
+	std::string stringBlock;
+	float sectorSize = DEFAULT_SECTOR_SIZE;
+
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(text, line))
+	{
+		lineNumber++;
+		size_t comment = line.find('#');
+		if (comment != std::string::npos)
+			line.erase(comment);
+
+		std::istringstream tokens(line);
+		std::string keyword;
+		if (!(tokens >> keyword))
+			continue;
+
+		if (keyword == "sectorsize")
+		{
+			if (!(tokens >> sectorSize) || !(sectorSize > 0))
+			{
+				printf("%s(%d): sectorsize needs a positive size\n", textPath, lineNumber);
+				return false;
+			}
+		}
+		else if (keyword == "mesh")
+		{
+			std::string name, path;
+			if (!(tokens >> name >> path))
+			{
+				printf("%s(%d): mesh needs a name and a path\n", textPath, lineNumber);
+				return false;
+			}
+			meshNames.push_back(name);
+			meshPaths.push_back((unsigned int)stringBlock.size());
+			stringBlock.append(path);
+			stringBlock.push_back(0);
+		}
+		else if (keyword == "entity")
+		{
+			std::string meshName;
+			tokens >> meshName;
+
+			int mesh = -1;
+			for (size_t m = 0; m < meshNames.size(); m++)
+			{
+				if (meshNames[m] == meshName)
+					mesh = (int)m;
+			}
+			if (mesh < 0)
+			{
+				printf("%s(%d): unknown mesh '%s'\n", textPath, lineNumber, meshName.c_str());
+				return false;
+			}
+			SceneEntityRecord entity = { (unsigned int)mesh, 0, SCENE_NO_BODY, 0 };
+
+			SceneTransformRecord transform;
+			transform.position = XMFLOAT3(0, 0, 0);
+			transform.orientation = XMFLOAT4(0, 0, 0, 1);
+			transform.scale = XMFLOAT3(1, 1, 1);
+
+			std::string field;
+			while (tokens >> field)
+			{
+				bool ok = true;
+				if (field == "global")
+					entity.flags |= SCENE_ENTITY_GLOBAL;
+				else if (field == "material")
+					ok = !!(tokens >> entity.material);
+				else if (field == "position")
+					ok = !!(tokens >> transform.position.x >> transform.position.y >> transform.position.z);
+				else if (field == "scale")
+					ok = !!(tokens >> transform.scale.x >> transform.scale.y >> transform.scale.z);
+				else if (field == "rotation")
+				{
+					float x, y, z;
+					ok = !!(tokens >> x >> y >> z);
+					if (ok)
+						transform.orientation = EulerToQuaternion(x, y, z);
+				}
+				else if (field == "body")
+				{
+					std::string shape;
+					SceneBodyRecord body = { SCENE_BODY_SPHERE, 0, 0, (unsigned int)entityRecords.size() };
+					ok = (tokens >> shape >> body.radius >> body.mass) && shape == "sphere";
+					entity.body = (unsigned int)bodyRecords.size();
+					bodyRecords.push_back(body);
+				}
+				else
+					ok = false;
+
+				if (!ok)
+				{
+					printf("%s(%d): bad entity field '%s'\n", textPath, lineNumber, field.c_str());
+					return false;
+				}
+			}
+
+			entityRecords.push_back(entity);
+			transformRecords.push_back(transform);
+		}
+		else
+		{
+			printf("%s(%d): unknown keyword '%s'\n", textPath, lineNumber, keyword.c_str());
+			return false;
+		}
+	}
+	if (stringBlock.empty())
+		stringBlock.push_back(0);
+
+	// Bucket the streamed entities by sector.  Sorting by coordinate keeps
+	// each sector's entities together, in the order they were written.
+	struct SectorEntity { int x, y, z; unsigned int entity; };
+	std::vector<SectorEntity> sectorEntries;
+	for (size_t i = 0; i < entityRecords.size(); i++)
+	{
+		if (entityRecords[i].flags & SCENE_ENTITY_GLOBAL)
+			continue;
+		const XMFLOAT3& p = transformRecords[i].position;
+		SectorEntity entry = {
+			(int)floorf(p.x / sectorSize), (int)floorf(p.y / sectorSize), (int)floorf(p.z / sectorSize),
+			(unsigned int)i };
+		sectorEntries.push_back(entry);
+	}
+	std::stable_sort(sectorEntries.begin(), sectorEntries.end(), [](const SectorEntity& a, const SectorEntity& b)
+	{
+		if (a.x != b.x) return a.x < b.x;
+		if (a.y != b.y) return a.y < b.y;
+		return a.z < b.z;
+	});
+
+	std::vector<SceneSectorRecord> sectorRecords;
+	std::vector<unsigned int> sectorEntityList;
+	for (size_t i = 0; i < sectorEntries.size(); i++)
+	{
+		const SectorEntity& entry = sectorEntries[i];
+		if (sectorRecords.empty() || sectorRecords.back().x != entry.x || sectorRecords.back().y != entry.y || sectorRecords.back().z != entry.z)
+		{
+			SceneSectorRecord sector = { entry.x, entry.y, entry.z, (unsigned int)i, 0 };
+			sectorRecords.push_back(sector);
+		}
+		sectorRecords.back().entityCount++;
+		sectorEntityList.push_back(entry.entity);
+	}
+
+	// Lay the arrays out back to back, each 16 byte aligned
+	SceneFileHeader header = {};
+	header.magic = SCENE_FILE_MAGIC;
+	header.version = SCENE_FILE_VERSION;
+	header.meshCount = (unsigned int)meshPaths.size();
+	header.entityCount = (unsigned int)entityRecords.size();
+	header.bodyCount = (unsigned int)bodyRecords.size();
+	header.stringSize = (unsigned int)stringBlock.size();
+	header.sectorSize = sectorSize;
+	header.sectorCount = (unsigned int)sectorRecords.size();
+	header.sectorEntityCount = (unsigned int)sectorEntityList.size();
+
+	header.meshOffset = AlignOffset(sizeof(SceneFileHeader));
+	header.entityOffset = AlignOffset(header.meshOffset + header.meshCount * sizeof(SceneMeshRecord));
+	header.transformOffset = AlignOffset(header.entityOffset + header.entityCount * sizeof(SceneEntityRecord));
+	header.bodyOffset = AlignOffset(header.transformOffset + header.entityCount * sizeof(SceneTransformRecord));
+	header.sectorOffset = AlignOffset(header.bodyOffset + header.bodyCount * sizeof(SceneBodyRecord));
+	header.sectorEntityOffset = AlignOffset(header.sectorOffset + header.sectorCount * sizeof(SceneSectorRecord));
+	header.stringOffset = AlignOffset(header.sectorEntityOffset + header.sectorEntityCount * sizeof(unsigned int));
+	header.fileSize = header.stringOffset + header.stringSize;
+
+	std::vector<unsigned char> blob(header.fileSize, 0);
+	memcpy(&blob[0], &header, sizeof(header));
+	for (unsigned int i = 0; i < header.meshCount; i++)
+	{
+		SceneMeshRecord mesh = { meshPaths[i] };
+		memcpy(&blob[header.meshOffset + i * sizeof(SceneMeshRecord)], &mesh, sizeof(mesh));
+	}
+	if (header.entityCount > 0)
+	{
+		memcpy(&blob[header.entityOffset], &entityRecords[0], header.entityCount * sizeof(SceneEntityRecord));
+		memcpy(&blob[header.transformOffset], &transformRecords[0], header.entityCount * sizeof(SceneTransformRecord));
+	}
+	if (header.bodyCount > 0)
+		memcpy(&blob[header.bodyOffset], &bodyRecords[0], header.bodyCount * sizeof(SceneBodyRecord));
+	if (header.sectorCount > 0)
+	{
+		memcpy(&blob[header.sectorOffset], &sectorRecords[0], header.sectorCount * sizeof(SceneSectorRecord));
+		memcpy(&blob[header.sectorEntityOffset], &sectorEntityList[0], header.sectorEntityCount * sizeof(unsigned int));
+	}
+	memcpy(&blob[header.stringOffset], stringBlock.data(), header.stringSize);
+
+	std::ofstream binary(binaryPath, std::ios::binary | std::ios::trunc);
+	if (!binary.is_open())
+		return false;
+	binary.write((const char*)&blob[0], blob.size());
+	return binary.good();
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <DirectXMath.h>
+
+// --------------------------------------------------------
+// Cooked scene format.
+//
+// Levels are written as text (see Debug/Levels) and cooked
+// into one flat blob: a header followed by arrays of plain
+// records.  Everything refers to everything else by index
+// or by byte offset from the start of the blob, never by
+// pointer, so the blob can be mapped anywhere and its
+// arrays read in place with no fix-up or parsing.
+//
+// The world is cut into cubic sectors.  Every entity that
+// isn't marked global belongs to the sector its position
+// falls in, and each sector lists its entities so they can
+// be streamed in and out together.
+// --------------------------------------------------------
+
+#define SCENE_FILE_MAGIC	0x424e4353	// "SCNB"
+#define SCENE_FILE_VERSION	2
+#define SCENE_NO_BODY		0xffffffff
+
+struct SceneFileHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int fileSize;
+
+	unsigned int meshCount;
+	unsigned int meshOffset;
+	unsigned int entityCount;
+	unsigned int entityOffset;
+	unsigned int transformOffset;	// One per entity, same order
+	unsigned int bodyCount;
+	unsigned int bodyOffset;
+	unsigned int stringSize;
+	unsigned int stringOffset;
+
+	float sectorSize;
+	unsigned int sectorCount;
+	unsigned int sectorOffset;
+	unsigned int sectorEntityCount;
+	unsigned int sectorEntityOffset;	// Entity indices, grouped by sector
+};
+
+struct SceneMeshRecord
+{
+	unsigned int pathOffset;		// Into the string block, null terminated
+};
+
+enum SceneEntityFlags
+{
+	SCENE_ENTITY_GLOBAL = 1			// Always loaded, not in any sector
+};
+
+struct SceneEntityRecord
+{
+	unsigned int mesh;
+	unsigned int material;			// Slot in the game's material table
+	unsigned int body;				// SCENE_NO_BODY for static scenery
+	unsigned int flags;
+};
+
+struct SceneTransformRecord
+{
+	DirectX::XMFLOAT3 position;
+	DirectX::XMFLOAT4 orientation;	// Quaternion, x y z w
+	DirectX::XMFLOAT3 scale;
+};
+
+enum SceneBodyShape
+{
+	SCENE_BODY_SPHERE = 0
+};
+
+struct SceneBodyRecord
+{
+	unsigned int shape;
+	float radius;
+	float mass;
+	unsigned int entity;
+};
+
+struct SceneSectorRecord
+{
+	int x, y, z;					// Sector coordinates, position / sectorSize rounded down
+	unsigned int firstEntity;		// Into the sector entity list
+	unsigned int entityCount;
+};
+
+// --------------------------------------------------------
+// A cooked scene mapped into memory
+// --------------------------------------------------------
+class SceneFile
+{
+public:
+	SceneFile();
+	~SceneFile();
+
+	// Maps the blob and checks the header and every offset against the
+	// file size.  Returns false, and leaves nothing mapped, if it's bad.
+	bool Load(const char* path);
+	void Unload();
+	bool IsLoaded() { return data != 0; }
+
+	// Text to blob.  Only needs to run when the text changes.
+	static bool Cook(const char* textPath, const char* binaryPath);
+	static bool IsCookedUpToDate(const char* textPath, const char* binaryPath);
+
+	// Arrays point straight into the mapped file
+	int GetMeshCount() { return (int)header->meshCount; }
+	const char* GetMeshPath(int mesh);
+
+	int GetEntityCount() { return (int)header->entityCount; }
+	const SceneEntityRecord* GetEntities() { return entities; }
+	const SceneTransformRecord* GetTransforms() { return transforms; }
+
+	int GetBodyCount() { return (int)header->bodyCount; }
+	const SceneBodyRecord* GetBodies() { return bodies; }
+
+	float GetSectorSize() { return header->sectorSize; }
+	int GetSectorCount() { return (int)header->sectorCount; }
+	const SceneSectorRecord* GetSectors() { return sectors; }
+	const unsigned int* GetSectorEntities() { return sectorEntities; }
+
+private:
+	bool Validate(unsigned int size);
+
+	void* fileHandle;
+	void* mappingHandle;
+	const unsigned char* data;
+
+	const SceneFileHeader* header;
+	const SceneMeshRecord* meshes;
+	const SceneEntityRecord* entities;
+	const SceneTransformRecord* transforms;
+	const SceneBodyRecord* bodies;
+	const SceneSectorRecord* sectors;
+	const unsigned int* sectorEntities;
+	const char* strings;
+};
@@ -0,0 +1,232 @@
+#include "SceneGraph.h"
+#include <parallel_for.h>
+#include <blocked_range.h>
+
+using namespace DirectX;
+
+// Levels smaller than this are not worth splitting across threads
+static const int LEVEL_GRAIN_SIZE = 64;
+
+SceneGraph::SceneGraph(int maxNodes) {
+	this->maxNodes = maxNodes;
+	liveCount = 0;
+	levelCount = 0;
+	orderDirty = false;
+
+	nodeEntity = new GameEntity*[maxNodes];
+	nodeParent = new int[maxNodes];
+	nodeDepth = new int[maxNodes];
+	nodeSlot = new int[maxNodes];
+	nodeAlive = new bool[maxNodes];
+	nodeLocal = new XMFLOAT4X4[maxNodes];
+
+	freeNodes = new int[maxNodes];
+	slotNode = new int[maxNodes];
+	slotParent = new int[maxNodes];
+	worldMatrices = new XMFLOAT4X4[maxNodes];
+
+	// Every id starts out free, handed out lowest first
+	freeCount = maxNodes;
+	for (int i = 0; i < maxNodes; i++) {
+		freeNodes[i] = maxNodes - 1 - i;
+		nodeAlive[i] = false;
+		nodeEntity[i] = 0;
+		nodeParent[i] = INVALID_NODE;
+		nodeDepth[i] = 0;
+		nodeSlot[i] = -1;
+	}
+
+	for (int d = 0; d <= MAX_DEPTH; d++)
+		levelStart[d] = 0;
+}
+
+SceneGraph::~SceneGraph() {
+	// The graph never owns the entities, only references them
+	delete[] nodeEntity;
+	delete[] nodeParent;
+	delete[] nodeDepth;
+	delete[] nodeSlot;
+	delete[] nodeAlive;
+	delete[] nodeLocal;
+	delete[] freeNodes;
+	delete[] slotNode;
+	delete[] slotParent;
+	delete[] worldMatrices;
+}
+
+int SceneGraph::CreateNode(GameEntity* entity) {
+	if (freeCount == 0)
+		return INVALID_NODE;
+
+	int node = freeNodes[--freeCount];
+	nodeAlive[node] = true;
+	nodeEntity[node] = entity;
+	nodeParent[node] = INVALID_NODE;
+	nodeDepth[node] = 0;
+	XMStoreFloat4x4(&nodeLocal[node], XMMatrixIdentity());
+
+	liveCount++;
+	orderDirty = true;
+	return node;
+}
+
+void SceneGraph::DestroyNode(int node) {
+	if (node < 0 || node >= maxNodes || !nodeAlive[node])
+		return;
+
+	// Children of a destroyed node become roots rather than dangling
+	for (int i = 0; i < maxNodes; i++) {
+		if (nodeAlive[i] && nodeParent[i] == node)
+			nodeParent[i] = INVALID_NODE;
+	}
+
+	nodeAlive[node] = false;
+	nodeEntity[node] = 0;
+	nodeParent[node] = INVALID_NODE;
+	freeNodes[freeCount++] = node;
+
+	liveCount--;
+	orderDirty = true;
+}
+
+bool SceneGraph::Attach(int child, int parent) {
+	if (child < 0 || child >= maxNodes || !nodeAlive[child])
+		return false;
+	if (parent < 0 || parent >= maxNodes || !nodeAlive[parent])
+		return false;
+
+	// Refuse to create a cycle - the parent can't be inside the child's subtree
+	int parentDepth = 0;
+	for (int p = parent; p != INVALID_NODE; p = nodeParent[p]) {
+		if (p == child)
+			return false;
+		parentDepth++;
+	}
+
+	// The whole subtree moves down, so make sure it still fits
+	if (parentDepth + SubtreeHeight(child) > MAX_DEPTH)
+		return false;
+
+	nodeParent[child] = parent;
+	orderDirty = true;
+	return true;
+}
+
+void SceneGraph::Detach(int child) {
+	if (child < 0 || child >= maxNodes || !nodeAlive[child])
+		return;
+	if (nodeParent[child] == INVALID_NODE)
+		return;
+
+	nodeParent[child] = INVALID_NODE;
+	orderDirty = true;
+}
+
+void SceneGraph::SetLocalPosition(int node, XMFLOAT3 position) {
+	XMStoreFloat4x4(&nodeLocal[node], XMMatrixTranslation(position.x, position.y, position.z));
+}
+
+void SceneGraph::SetLocalTransform(int node, const XMFLOAT4X4& local) {
+	nodeLocal[node] = local;
+}
+
+// Number of levels in the subtree rooted at node (1 for a leaf)
+int SceneGraph::SubtreeHeight(int node) {
+	int height = 1;
+	for (int i = 0; i < maxNodes; i++) {
+		if (!nodeAlive[i])
+			continue;
+
+		int steps = 1;
+		for (int p = i; p != INVALID_NODE; p = nodeParent[p], steps++) {
+			if (p == node) {
+				height = max(height, steps);
+				break;
+			}
+		}
+	}
+	return height;
+}
+
+// Re-sorts the slots by depth with a counting sort.  Only runs after
+// the hierarchy changed, and uses no memory beyond the fixed arrays.
+void SceneGraph::RebuildOrder() {
+	int counts[MAX_DEPTH];
+	for (int d = 0; d < MAX_DEPTH; d++)
+		counts[d] = 0;
+
+	levelCount = 0;
+	for (int i = 0; i < maxNodes; i++) {
+		if (!nodeAlive[i])
+			continue;
+
+		int depth = 0;
+		for (int p = nodeParent[i]; p != INVALID_NODE; p = nodeParent[p])
+			depth++;
+
+		nodeDepth[i] = depth;
+		counts[depth]++;
+		levelCount = max(levelCount, depth + 1);
+	}
+
+	// Prefix sum gives the first slot of every level
+	int cursor[MAX_DEPTH];
+	levelStart[0] = 0;
+	for (int d = 0; d < MAX_DEPTH; d++) {
+		cursor[d] = levelStart[d];
+		levelStart[d + 1] = levelStart[d] + counts[d];
+	}
+
+	for (int i = 0; i < maxNodes; i++) {
+		if (!nodeAlive[i])
+			continue;
+
+		int slot = cursor[nodeDepth[i]]++;
+		slotNode[slot] = i;
+		nodeSlot[i] = slot;
+	}
+
+	// Parents always sit in an earlier level, so their slots are final now
+	for (int s = 0; s < liveCount; s++) {
+		int parent = nodeParent[slotNode[s]];
+		slotParent[s] = (parent == INVALID_NODE) ? -1 : nodeSlot[parent];
+	}
+
+	orderDirty = false;
+}
+
+void SceneGraph::UpdateLevel(int first, int last) {
+	tbb::parallel_for(tbb::blocked_range<int>(first, last, LEVEL_GRAIN_SIZE),
+		[this](const tbb::blocked_range<int>& range) {
+		for (int s = range.begin(); s != range.end(); s++) {
+			int node = slotNode[s];
+
+			XMMATRIX local = nodeEntity[node]
+				? nodeEntity[node]->GetLocalMatrix()
+				: XMLoadFloat4x4(&nodeLocal[node]);
+
+			XMMATRIX world = local;
+			if (slotParent[s] >= 0)
+				world = local * XMLoadFloat4x4(&worldMatrices[slotParent[s]]);
+
+			XMStoreFloat4x4(&worldMatrices[s], world);
+
+			// Entities keep their matrix transposed for HLSL
+			if (nodeEntity[node]) {
+				XMFLOAT4X4 transposed;
+				XMStoreFloat4x4(&transposed, XMMatrixTranspose(world));
+				nodeEntity[node]->SetWorldMatrix(transposed);
+			}
+		}
+	});
+}
+
+void SceneGraph::UpdateTransforms() {
+	if (orderDirty)
+		RebuildOrder();
+
+	// Each level only reads from the one above, so levels run in order
+	// and the nodes within a level run in parallel
+	for (int d = 0; d < levelCount; d++)
+		UpdateLevel(levelStart[d], levelStart[d + 1]);
+}
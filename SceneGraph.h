@@ -0,0 +1,78 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include "GameEntity.h"
+
+// --------------------------------------------------------
+// Transform hierarchy stored in flat, depth-sorted arrays.
+//
+// Nodes are addressed by a stable id.  Internally every live
+// node also owns a "slot", and slots are kept sorted by depth
+// so that all of level 0 comes first, then level 1, etc.
+// World transforms are propagated one level at a time with a
+// parallel_for over each level, since every node in a level
+// only depends on nodes in the level above it.
+//
+// All storage is allocated up front for maxNodes, so creating,
+// attaching and detaching nodes never reallocates.
+// --------------------------------------------------------
+class SceneGraph {
+public:
+	static const int MAX_DEPTH = 16;
+	static const int INVALID_NODE = -1;
+
+	SceneGraph(int maxNodes);
+	~SceneGraph();
+
+	// Node lifetime - the entity may be null for pure "anchor" nodes
+	int CreateNode(GameEntity* entity);
+	void DestroyNode(int node);
+
+	// Hierarchy editing
+	bool Attach(int child, int parent);
+	void Detach(int child);
+	int GetParent(int node) { return nodeParent[node]; }
+	int GetDepth(int node) { return nodeDepth[node]; }
+
+	// Local transform for nodes without an entity.  Nodes that have
+	// an entity take their local transform from the entity itself.
+	void SetLocalPosition(int node, DirectX::XMFLOAT3 position);
+	void SetLocalTransform(int node, const DirectX::XMFLOAT4X4& local);
+
+	// Propagates world transforms top-down and writes them
+	// back into the attached entities
+	void UpdateTransforms();
+
+	DirectX::XMFLOAT4X4 GetWorldMatrix(int node) { return worldMatrices[nodeSlot[node]]; }
+	int GetNodeCount() { return liveCount; }
+
+private:
+	void RebuildOrder();
+	void UpdateLevel(int first, int last);
+	int SubtreeHeight(int node);
+
+	int maxNodes;
+	int liveCount;
+	bool orderDirty;
+
+	// Per-node data, indexed by node id
+	GameEntity** nodeEntity;
+	int* nodeParent;
+	int* nodeDepth;
+	int* nodeSlot;
+	bool* nodeAlive;
+	DirectX::XMFLOAT4X4* nodeLocal;
+
+	// Free list of node ids
+	int* freeNodes;
+	int freeCount;
+
+	// Per-slot data, sorted by depth
+	int* slotNode;
+	int* slotParent;
+	DirectX::XMFLOAT4X4* worldMatrices;
+
+	// Slot range for each level: [levelStart[d], levelStart[d + 1])
+	int levelStart[MAX_DEPTH + 1];
+	int levelCount;
+};
@@ -0,0 +1,255 @@
+#include "SpatialHashGrid.h"
+#include <math.h>
+#include <emmintrin.h>
+#include <parallel_for.h>
+#include <blocked_range.h>
+
+using namespace DirectX;
+
+SpatialHashGrid::SpatialHashGrid(float cellSize, int bucketCount)
+{
+	this->cellSize = cellSize;
+	invCellSize = 1.0f / cellSize;
+
+	this->bucketCount = 1;
+	while (this->bucketCount < bucketCount)
+		this->bucketCount <<= 1;
+
+	bucketStart.assign(this->bucketCount + 1, 0);
+}
+
+SpatialHashGrid::~SpatialHashGrid()
+{
+}
+
+void SpatialHashGrid::Clear()
+{
+	itemX.clear();
+	itemY.clear();
+	itemZ.clear();
+	itemData.clear();
+}
+
+int SpatialHashGrid::Insert(const XMFLOAT3& position, void* userData)
+{
+	itemX.push_back(position.x);
+	itemY.push_back(position.y);
+	itemZ.push_back(position.z);
+	itemData.push_back(userData);
+	return (int)itemX.size() - 1;
+}
+
+int SpatialHashGrid::CellCoord(float value) const
+{
+	return (int)floorf(value * invCellSize);
+}
+
+unsigned int SpatialHashGrid::HashCell(int x, int y, int z) const
+{
+	// Teschner et al. primes
+	unsigned int h = ((unsigned int)x * 73856093u) ^ ((unsigned int)y * 19349663u) ^ ((unsigned int)z * 83492791u);
+	return h & (unsigned int)(bucketCount - 1);
+}
+
+void SpatialHashGrid::Build()
+{
+	int count = (int)itemX.size();
+	itemBucket.resize(count);
+	sortedItems.resize(count);
+	sortedCellX.resize(count);
+	sortedCellY.resize(count);
+	sortedCellZ.resize(count);
+	sortedX.resize(count);
+	sortedY.resize(count);
+	sortedZ.resize(count);
+
+	// Count items per bucket
+	for (int b = 0; b <= bucketCount; b++)
+		bucketStart[b] = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		itemBucket[i] = HashCell(CellCoord(itemX[i]), CellCoord(itemY[i]), CellCoord(itemZ[i]));
+		bucketStart[itemBucket[i] + 1]++;
+	}
+
+	// Prefix sum gives the first slot of every bucket
+	for (int b = 0; b < bucketCount; b++)
+		bucketStart[b + 1] += bucketStart[b];
+
+	// Scatter, walking backwards from the end of each bucket so items
+	// keep their insertion order.  Afterwards bucketStart[b + 1] holds
+	// the start of bucket b, so shift everything down by one.
+	for (int i = count - 1; i >= 0; i--)
+	{
+		int slot = --bucketStart[itemBucket[i] + 1];
+		sortedItems[slot] = i;
+		sortedCellX[slot] = CellCoord(itemX[i]);
+		sortedCellY[slot] = CellCoord(itemY[i]);
+		sortedCellZ[slot] = CellCoord(itemZ[i]);
+		sortedX[slot] = itemX[i];
+		sortedY[slot] = itemY[i];
+		sortedZ[slot] = itemZ[i];
+	}
+	for (int b = 0; b < bucketCount; b++)
+		bucketStart[b] = bucketStart[b + 1];
+	bucketStart[bucketCount] = count;
+}
+
+// Adds an item to a sorted best-k list, dropping the furthest if it's full.
+// The caller has already checked it beats the furthest.
+static void InsertNearest(int* out, float* bestDistSq, int k, int& found, int item, float distSq)
+{
+	int slot = found < k ? found++ : k - 1;
+	while (slot > 0 && bestDistSq[slot - 1] > distSq)
+	{
+		bestDistSq[slot] = bestDistSq[slot - 1];
+		out[slot] = out[slot - 1];
+		slot--;
+	}
+	bestDistSq[slot] = distSq;
+	out[slot] = item;
+}
+
+// Distances for a run of sorted items, four at a time.  With matchCell set
+// only items in cell (x, y, z) count, which skips hash collisions in the
+// bucket.  Candidates are rare once the list fills up, so inserting them
+// stays scalar.
+void SpatialHashGrid::NearestInRun(int begin, int end, const XMFLOAT3& center, bool matchCell, int x, int y, int z,
+	float maxRadiusSq, int k, int& found, float* bestDistSq, int* out) const
+{
+	__m128 centerX = _mm_set1_ps(center.x);
+	__m128 centerY = _mm_set1_ps(center.y);
+	__m128 centerZ = _mm_set1_ps(center.z);
+	__m128i cellX = _mm_set1_epi32(x);
+	__m128i cellY = _mm_set1_epi32(y);
+	__m128i cellZ = _mm_set1_epi32(z);
+
+	// Anything further than this can't get in
+	float limit = found == k ? bestDistSq[k - 1] : maxRadiusSq;
+
+	int i = begin;
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(&sortedX[i]), centerX);
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(&sortedY[i]), centerY);
+		__m128 dz = _mm_sub_ps(_mm_loadu_ps(&sortedZ[i]), centerZ);
+		__m128 distSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+		// Full lists need strictly closer, so ties keep the earlier item
+		__m128 accept = found == k ? _mm_cmplt_ps(distSq, _mm_set1_ps(limit)) : _mm_cmple_ps(distSq, _mm_set1_ps(limit));
+		if (matchCell)
+		{
+			__m128i same = _mm_and_si128(
+				_mm_and_si128(
+					_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)&sortedCellX[i]), cellX),
+					_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)&sortedCellY[i]), cellY)),
+				_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)&sortedCellZ[i]), cellZ));
+			accept = _mm_and_ps(accept, _mm_castsi128_ps(same));
+		}
+
+		int mask = _mm_movemask_ps(accept);
+		if (mask == 0)
+			continue;
+
+		float lanes[4];
+		_mm_storeu_ps(lanes, distSq);
+		for (int lane = 0; lane < 4; lane++)
+		{
+			// The list may have tightened since the compare
+			if (!(mask & (1 << lane)))
+				continue;
+			if (found == k ? lanes[lane] >= limit : lanes[lane] > limit)
+				continue;
+
+			InsertNearest(out, bestDistSq, k, found, sortedItems[i + lane], lanes[lane]);
+			limit = found == k ? bestDistSq[k - 1] : maxRadiusSq;
+		}
+	}
+
+	// Leftovers that don't fill a group
+	for (; i < end; i++)
+	{
+		if (matchCell && (sortedCellX[i] != x || sortedCellY[i] != y || sortedCellZ[i] != z))
+			continue;
+
+		float dx = sortedX[i] - center.x;
+		float dy = sortedY[i] - center.y;
+		float dz = sortedZ[i] - center.z;
+		float distSq = dx * dx + dy * dy + dz * dz;
+		if (found == k ? distSq >= limit : distSq > limit)
+			continue;
+
+		InsertNearest(out, bestDistSq, k, found, sortedItems[i], distSq);
+		limit = found == k ? bestDistSq[k - 1] : maxRadiusSq;
+	}
+}
+
+int SpatialHashGrid::QueryNearest(const XMFLOAT3& center, int k, float maxRadius, int* out) const
+{
+	if (k <= 0 || itemX.empty())
+		return 0;
+
+	// Best k so far, sorted nearest first
+	int found = 0;
+	float bestDistSq[MAX_NEAREST];
+	if (k > MAX_NEAREST)
+		k = MAX_NEAREST;
+
+	float maxRadiusSq = maxRadius * maxRadius;
+	int centerX = CellCoord(center.x);
+	int centerY = CellCoord(center.y);
+	int centerZ = CellCoord(center.z);
+	int maxRing = (int)(maxRadius * invCellSize) + 1;
+
+	// Search shells of cells outwards from the center cell.  After ring r,
+	// everything closer than r cell widths has been seen.
+	for (int ring = 0; ring <= maxRing; ring++)
+	{
+		// Once a shell covers more cells than there are buckets, scanning
+		// every item is cheaper than carrying on
+		double shellCells = (double)(2 * ring + 1) * (2 * ring + 1) * (2 * ring + 1);
+		if (shellCells > (double)bucketCount)
+		{
+			found = 0;
+			NearestInRun(0, (int)sortedItems.size(), center, false, 0, 0, 0, maxRadiusSq, k, found, bestDistSq, out);
+			break;
+		}
+
+		for (int z = centerZ - ring; z <= centerZ + ring; z++)
+		{
+			for (int y = centerY - ring; y <= centerY + ring; y++)
+			{
+				// Rows on the shell's faces are walked fully, inner rows only at the two ends
+				bool onFace = z == centerZ - ring || z == centerZ + ring || y == centerY - ring || y == centerY + ring;
+				int step = onFace ? 1 : 2 * ring;
+				for (int x = centerX - ring; x <= centerX + ring; x += step)
+				{
+					unsigned int bucket = HashCell(x, y, z);
+					NearestInRun(bucketStart[bucket], bucketStart[bucket + 1], center, true, x, y, z, maxRadiusSq, k, found, bestDistSq, out);
+				}
+			}
+		}
+
+		float searched = ring * cellSize;
+		if (found == k && bestDistSq[k - 1] <= searched * searched)
+			break;
+	}
+
+	return found;
+}
+
+// Queries are independent and only read the grid, so ranges of them go to
+// worker threads as they are
+void SpatialHashGrid::QueryNearestBatch(const XMFLOAT3* centers, int count, int k, float maxRadius, int* out, int* counts) const
+{
+	if (k > MAX_NEAREST)
+		k = MAX_NEAREST;
+
+	tbb::parallel_for(tbb::blocked_range<int>(0, count, NEAREST_BATCH_GRAIN),
+		[&](const tbb::blocked_range<int>& range)
+	{
+		for (int q = range.begin(); q != range.end(); q++)
+			counts[q] = QueryNearest(centers[q], k, maxRadius, out + q * k);
+	});
+}
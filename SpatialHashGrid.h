@@ -0,0 +1,143 @@
+#pragma once
+
+#include <vector>
+#include <DirectXMath.h>
+
+// --------------------------------------------------------
+// Uniform grid of points, hashed into a fixed number of
+// buckets so the world doesn't need bounds.
+//
+// Points are added with Insert() and then sorted by bucket
+// in Build() with a counting sort, so every bucket ends up
+// as one contiguous run of positions.  The grid is meant to
+// be cleared and rebuilt each frame, which is O(N) and
+// never allocates once the arrays have grown.
+//
+// Items are identified by the order they were inserted.
+//
+// Nearest queries measure distances four items at a time
+// with SSE, straight from the sorted coordinate arrays.
+// Batches of them run in parallel for callers that need
+// the closest items to many points at once.
+// --------------------------------------------------------
+class SpatialHashGrid
+{
+public:
+	static const int MAX_NEAREST = 64;		// Largest k for the nearest queries
+	static const int NEAREST_BATCH_GRAIN = 16;	// Queries per task in a batch
+
+	// bucketCount is rounded up to a power of two
+	SpatialHashGrid(float cellSize, int bucketCount);
+	~SpatialHashGrid();
+
+	void Clear();
+	int Insert(const DirectX::XMFLOAT3& position, void* userData);
+	void Build();
+
+	int GetItemCount() const { return (int)itemX.size(); }
+	DirectX::XMFLOAT3 GetPosition(int item) const { return DirectX::XMFLOAT3(itemX[item], itemY[item], itemZ[item]); }
+	void* GetUserData(int item) const { return itemData[item]; }
+
+	// Calls fn(item, distanceSq) for every item within radius
+	template<typename F>
+	void QueryRadius(const DirectX::XMFLOAT3& center, float radius, F fn) const
+	{
+		float radiusSq = radius * radius;
+		VisitCells(center, DirectX::XMFLOAT3(radius, radius, radius), [&](int item, float dx, float dy, float dz)
+		{
+			float distSq = dx * dx + dy * dy + dz * dz;
+			if (distSq <= radiusSq)
+				fn(item, distSq);
+		});
+	}
+
+	// Calls fn(item) for every item inside the box center +- halfExtent
+	template<typename F>
+	void QueryBox(const DirectX::XMFLOAT3& center, const DirectX::XMFLOAT3& halfExtent, F fn) const
+	{
+		VisitCells(center, halfExtent, [&](int item, float dx, float dy, float dz)
+		{
+			if (dx >= -halfExtent.x && dx <= halfExtent.x &&
+				dy >= -halfExtent.y && dy <= halfExtent.y &&
+				dz >= -halfExtent.z && dz <= halfExtent.z)
+				fn(item);
+		});
+	}
+
+	// Up to k items closest to center and no further than maxRadius,
+	// nearest first.  out must have room for k.  Returns how many were found.
+	int QueryNearest(const DirectX::XMFLOAT3& center, int k, float maxRadius, int* out) const;
+
+	// QueryNearest for many centers, spread over worker threads.  Query q
+	// writes its items to out + q * k and how many it found to counts[q].
+	// k is capped at MAX_NEAREST, the stride through out included.
+	void QueryNearestBatch(const DirectX::XMFLOAT3* centers, int count, int k, float maxRadius, int* out, int* counts) const;
+
+private:
+	int CellCoord(float value) const;
+	unsigned int HashCell(int x, int y, int z) const;
+
+	void NearestInRun(int begin, int end, const DirectX::XMFLOAT3& center, bool matchCell, int x, int y, int z,
+		float maxRadiusSq, int k, int& found, float* bestDistSq, int* out) const;
+
+	// Walks every item in the cells overlapping center +- extent and calls
+	// fn(item, dx, dy, dz) with its offset from center.  Items are only
+	// visited from their own cell, so bucket collisions can't repeat them.
+	template<typename F>
+	void VisitCells(const DirectX::XMFLOAT3& center, const DirectX::XMFLOAT3& extent, F fn) const
+	{
+		int minX = CellCoord(center.x - extent.x), maxX = CellCoord(center.x + extent.x);
+		int minY = CellCoord(center.y - extent.y), maxY = CellCoord(center.y + extent.y);
+		int minZ = CellCoord(center.z - extent.z), maxZ = CellCoord(center.z + extent.z);
+
+		// A huge query touches every bucket anyway, so just scan everything
+		double cellCount = (double)(maxX - minX + 1) * (maxY - minY + 1) * (maxZ - minZ + 1);
+		if (cellCount > (double)bucketCount)
+		{
+			for (int i = 0; i < (int)sortedItems.size(); i++)
+				fn(sortedItems[i], sortedX[i] - center.x, sortedY[i] - center.y, sortedZ[i] - center.z);
+			return;
+		}
+
+		for (int z = minZ; z <= maxZ; z++)
+		{
+			for (int y = minY; y <= maxY; y++)
+			{
+				for (int x = minX; x <= maxX; x++)
+					VisitCell(x, y, z, center, fn);
+			}
+		}
+	}
+
+	template<typename F>
+	void VisitCell(int x, int y, int z, const DirectX::XMFLOAT3& center, F& fn) const
+	{
+		unsigned int bucket = HashCell(x, y, z);
+		for (int i = bucketStart[bucket]; i < bucketStart[bucket + 1]; i++)
+		{
+			if (sortedCellX[i] == x && sortedCellY[i] == y && sortedCellZ[i] == z)
+				fn(sortedItems[i], sortedX[i] - center.x, sortedY[i] - center.y, sortedZ[i] - center.z);
+		}
+	}
+
+	float cellSize;
+	float invCellSize;
+	int bucketCount;
+
+	// Items in insertion order
+	std::vector<float> itemX;
+	std::vector<float> itemY;
+	std::vector<float> itemZ;
+	std::vector<void*> itemData;
+
+	// Items sorted by bucket: [bucketStart[b], bucketStart[b + 1])
+	std::vector<int> bucketStart;
+	std::vector<int> sortedItems;
+	std::vector<int> sortedCellX;
+	std::vector<int> sortedCellY;
+	std::vector<int> sortedCellZ;
+	std::vector<float> sortedX;
+	std::vector<float> sortedY;
+	std::vector<float> sortedZ;
+	std::vector<unsigned int> itemBucket;
+};
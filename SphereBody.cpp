@@ -0,0 +1,19 @@
+#include "SphereBody.h"
+
+// Static bodies get no inertia, same as a plain btRigidBody setup
+static btVector3 SphereInertia(btSphereShape& shape, float mass)
+{
+	btVector3 inertia(0, 0, 0);
+	if (mass != 0.0f)
+		shape.calculateLocalInertia(mass, inertia);
+	return inertia;
+}
+
+// Members are built in declaration order, so the shape and motion state
+// are ready by the time the body takes their addresses
+SphereBody::SphereBody(float radius, const btTransform& transform, float mass)
+	: shape(radius),
+	motionState(transform),
+	body(btRigidBody::btRigidBodyConstructionInfo(mass, &motionState, &shape, SphereInertia(shape, mass)))
+{
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "btBulletDynamicsCommon.h"
+
+// --------------------------------------------------------
+// A sphere rigid body together with its shape and motion
+// state, so all three fit in one pool slot and get built
+// and torn down together.  The body points at the other two
+// members, so a SphereBody must never be copied or moved.
+// --------------------------------------------------------
+ATTRIBUTE_ALIGNED16(struct) SphereBody
+{
+	BT_DECLARE_ALIGNED_ALLOCATOR();
+
+	SphereBody(float radius, const btTransform& transform, float mass);
+
+	btSphereShape shape;
+	btDefaultMotionState motionState;
+	btRigidBody body;
+
+private:
+	SphereBody(const SphereBody&);
+	SphereBody& operator=(const SphereBody&);
+};
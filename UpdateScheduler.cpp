@@ -0,0 +1,62 @@
+#include "UpdateScheduler.h"
+
+using namespace DirectX;
+
+UpdateScheduler::UpdateScheduler()
+{
+	viewer = XMFLOAT3(0, 0, 0);
+	nearDistance = 25.0f;
+	frame = 0;
+	nextPhase = 0;
+	time = 0.0;
+}
+
+void UpdateScheduler::BeginFrame(float deltaTime)
+{
+	frame++;
+	time += deltaTime;
+}
+
+// New entities start in the fastest bucket and are due straight away
+UpdateRateComponent UpdateScheduler::Register(int maxBucket)
+{
+	UpdateRateComponent rate;
+	rate.bucket = 0;
+	rate.maxBucket = maxBucket < MAX_BUCKETS - 1 ? maxBucket : MAX_BUCKETS - 1;
+	rate.phase = nextPhase++;
+	rate.lastUpdate = time;
+	return rate;
+}
+
+bool UpdateScheduler::IsDue(const UpdateRateComponent& rate) const
+{
+	unsigned int periodMask = (1u << rate.bucket) - 1;
+	return ((frame ^ rate.phase) & periodMask) == 0;
+}
+
+float UpdateScheduler::Consume(UpdateRateComponent& rate, const XMFLOAT3& position) const
+{
+	float elapsed = (float)(time - rate.lastUpdate);
+	rate.lastUpdate = time;
+	rate.bucket = PickBucket(position, rate.maxBucket);
+	return elapsed;
+}
+
+// Bucket k reaches out to nearDistance * 2^k, compared squared so there's
+// no square root per entity
+int UpdateScheduler::PickBucket(const XMFLOAT3& position, int maxBucket) const
+{
+	float dx = position.x - viewer.x;
+	float dy = position.y - viewer.y;
+	float dz = position.z - viewer.z;
+	float distSq = dx * dx + dy * dy + dz * dz;
+
+	int bucket = 0;
+	float reachSq = nearDistance * nearDistance;
+	while (bucket < maxBucket && distSq > reachSq)
+	{
+		bucket++;
+		reachSq *= 4.0f;
+	}
+	return bucket;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include "GameComponents.h"
+
+// --------------------------------------------------------
+// Time slices per-entity updates by distance from a viewer.
+//
+// Entities go into buckets that update every frame, every
+// 2nd frame, every 4th and so on, with each bucket twice as
+// far out as the last.  Every entity gets a phase when it is
+// registered, handed out round robin, and is due on frames
+// where the low bits of the frame count match the low bits
+// of its phase.  That spreads every bucket evenly over its
+// period, so the number of updates per frame stays flat
+// instead of spiking every Nth frame.
+//
+// Entities keep the time of their last update, so a system
+// that integrates gets the whole time that passed since then
+// rather than one frame's worth.
+//
+// Only BeginFrame and Register change the scheduler, the rest
+// just read it, so systems can call them from worker threads.
+// --------------------------------------------------------
+class UpdateScheduler
+{
+public:
+	static const int MAX_BUCKETS = 4;	// Every frame up to every 8th
+
+	UpdateScheduler();
+
+	// Entities within nearDistance of the viewer update every frame
+	void SetNearDistance(float distance) { nearDistance = distance; }
+	void SetViewer(const DirectX::XMFLOAT3& position) { viewer = position; }
+
+	void BeginFrame(float deltaTime);
+
+	// Fills in a new entity's schedule.  maxBucket caps how far it can be
+	// slowed down, 0 for things that always need every frame.
+	UpdateRateComponent Register(int maxBucket = MAX_BUCKETS - 1);
+
+	bool IsDue(const UpdateRateComponent& rate) const;
+
+	// Call when a due entity is updated.  Returns the time since its last
+	// update and picks its bucket for next time from where it is now.
+	float Consume(UpdateRateComponent& rate, const DirectX::XMFLOAT3& position) const;
+
+	unsigned int GetFrame() const { return frame; }
+
+private:
+	int PickBucket(const DirectX::XMFLOAT3& position, int maxBucket) const;
+
+	DirectX::XMFLOAT3 viewer;
+	float nearDistance;
+
+	unsigned int frame;
+	unsigned int nextPhase;
+	double time;
+};
@@ -8,8 +8,7 @@
 cbuffer externalData : register(b0)
 {
 	matrix world;
-	matrix view;
-	matrix projection;
+	matrix viewProjection;	// Combined once per camera on the CPU
 };
 
 // Struct representing a single vertex worth of data
@@ -49,6 +48,7 @@ struct VertexToPixel
 	float2 uv           : TEXCOORD;     // UV co-ordinates
 	float3 tangent		: TANGENT;
 	float3 worldPos		: POSITION;
+	float4 tint			: COLOR;		// Only instanced draws change it
 };
 
 // --------------------------------------------------------
@@ -65,19 +65,13 @@ VertexToPixel main(VertexShaderInput input)
 
 	// The vertex's position (input.position) must be converted to world space,
 	// then camera space (relative to our 3D camera), then to proper homogenous 
-	// screen-space coordinates.  This is taken care of by our world, view and
-	// projection matrices.  
-	//
-	// First we multiply them together to get a single matrix which represents
-	// all of those transformations (world to view to projection space)
-	matrix worldViewProj = mul(mul(world, view), projection);
-
-	// Then we convert our 3-component position vector to a 4-component vector
-	// and multiply it by our final 4x4 matrix.
+	// screen-space coordinates.  View and projection arrive already combined,
+	// so that's just two vector-matrix multiplies.
 	//
 	// The result is essentially the position (XY) of the vertex on our 2D 
 	// screen and the distance (Z) from the camera (the "depth" of the pixel)
-	output.position = mul(float4(input.position, 1.0f), worldViewProj);
+	float4 worldPosition = mul(float4(input.position, 1.0f), world);
+	output.position = mul(worldPosition, viewProjection);
 
 	// Pass the color through 
 	// - The values will be interpolated per-pixel by the rasterizer
@@ -85,8 +79,9 @@ VertexToPixel main(VertexShaderInput input)
 	//output.color = input.color;
 	output.normal = mul(input.normal, (float3x3)world);
 	output.tangent = mul(input.tangent, (float3x3)world);
-	output.worldPos = mul(float4(input.position, 1.0f), world).xyz;
+	output.worldPos = worldPosition.xyz;
 	output.uv = input.uv;
+	output.tint = float4(1.0f, 1.0f, 1.0f, 1.0f);
 	// Whatever we return will make its way through the pipeline to the
 	// next programmable stage we're using (the pixel shader for now)
 	return output;
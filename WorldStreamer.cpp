@@ -0,0 +1,265 @@
+#include "WorldStreamer.h"
+#include <math.h>
+
+using namespace DirectX;
+
+WorldStreamer::WorldStreamer(SceneFile* scene, float loadRadius, float unloadRadius, float prefetchTime)
+{
+	this->scene = scene;
+	this->loadRadius = loadRadius;
+	this->unloadRadius = unloadRadius > loadRadius ? unloadRadius : loadRadius;
+	this->prefetchTime = prefetchTime;
+	sectorSize = scene->GetSectorSize();
+	pageTouchSum = 0;
+
+	SectorStatus unloaded = { SECTOR_UNLOADED, 0, false };
+	sectorStates.assign(scene->GetSectorCount(), unloaded);
+
+	working = false;
+	stopping = false;
+	worker = boost::thread(&WorldStreamer::WorkerLoop, this);
+}
+
+WorldStreamer::~WorldStreamer()
+{
+	{
+		boost::lock_guard<boost::mutex> lock(queueMutex);
+		stopping = true;
+	}
+	queueSignal.notify_one();
+	worker.join();
+}
+
+void WorldStreamer::Update(const XMFLOAT3& cameraPosition, const XMFLOAT3& cameraVelocity)
+{
+	// Where the camera will be once a load started now has had time to land
+	XMFLOAT3 predicted(
+		cameraPosition.x + cameraVelocity.x * prefetchTime,
+		cameraPosition.y + cameraVelocity.y * prefetchTime,
+		cameraPosition.z + cameraVelocity.z * prefetchTime);
+
+	// Drop whatever neither point needs any more
+	float unloadRadiusSq = unloadRadius * unloadRadius;
+	size_t kept = 0;
+	for (size_t i = 0; i < activeSectors.size(); i++)
+	{
+		int sector = activeSectors[i];
+		SectorStatus& status = sectorStates[sector];
+		if (status.state != SECTOR_UNLOADED &&
+			(DistanceSqToSector(sector, cameraPosition) > unloadRadiusSq &&
+			DistanceSqToSector(sector, predicted) > unloadRadiusSq))
+		{
+			if (status.state == SECTOR_QUEUED)
+			{
+				// The worker still has it, drop it when it comes back
+				status.cancelled = true;
+			}
+			else
+			{
+				if (status.state == SECTOR_COMMITTING)
+				{
+					for (size_t c = 0; c < committing.size(); c++)
+					{
+						if (committing[c] == sector)
+						{
+							committing.erase(committing.begin() + c);
+							break;
+						}
+					}
+				}
+				unloading.push_back(sector);
+				status.state = SECTOR_UNLOADED;
+			}
+		}
+
+		if (status.state != SECTOR_UNLOADED)
+			activeSectors[kept++] = sector;
+	}
+	activeSectors.resize(kept);
+
+	RequestSectorsAround(cameraPosition);
+	RequestSectorsAround(predicted);
+}
+
+int WorldStreamer::GetResidentCount()
+{
+	int count = 0;
+	for (size_t i = 0; i < activeSectors.size(); i++)
+	{
+		if (sectorStates[activeSectors[i]].state == SECTOR_RESIDENT)
+			count++;
+	}
+	return count;
+}
+
+// Binary search, -1 if the cooker wrote no such sector
+int WorldStreamer::FindSector(int x, int y, int z)
+{
+	const SceneSectorRecord* sectors = scene->GetSectors();
+	int low = 0;
+	int high = scene->GetSectorCount();
+	while (low < high)
+	{
+		int mid = (low + high) / 2;
+		const SceneSectorRecord& s = sectors[mid];
+		bool less = s.x != x ? s.x < x : (s.y != y ? s.y < y : s.z < z);
+		if (less)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if (low < scene->GetSectorCount() && sectors[low].x == x && sectors[low].y == y && sectors[low].z == z)
+		return low;
+	return -1;
+}
+
+// Squared distance from the point to the sector's cube, 0 inside it
+float WorldStreamer::DistanceSqToSector(int sector, const XMFLOAT3& point)
+{
+	const SceneSectorRecord& s = scene->GetSectors()[sector];
+	float cellMin[3] = { s.x * sectorSize, s.y * sectorSize, s.z * sectorSize };
+	float p[3] = { point.x, point.y, point.z };
+
+	float distSq = 0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float d = 0;
+		if (p[axis] < cellMin[axis])
+			d = cellMin[axis] - p[axis];
+		else if (p[axis] > cellMin[axis] + sectorSize)
+			d = p[axis] - (cellMin[axis] + sectorSize);
+		distSq += d * d;
+	}
+	return distSq;
+}
+
+void WorldStreamer::RequestSectorsAround(const XMFLOAT3& point)
+{
+	float loadRadiusSq = loadRadius * loadRadius;
+	int lowX = (int)floorf((point.x - loadRadius) / sectorSize), highX = (int)floorf((point.x + loadRadius) / sectorSize);
+	int lowY = (int)floorf((point.y - loadRadius) / sectorSize), highY = (int)floorf((point.y + loadRadius) / sectorSize);
+	int lowZ = (int)floorf((point.z - loadRadius) / sectorSize), highZ = (int)floorf((point.z + loadRadius) / sectorSize);
+
+	bool queued = false;
+	for (int x = lowX; x <= highX; x++)
+	{
+		for (int y = lowY; y <= highY; y++)
+		{
+			for (int z = lowZ; z <= highZ; z++)
+			{
+				int sector = FindSector(x, y, z);
+				if (sector < 0 || DistanceSqToSector(sector, point) > loadRadiusSq)
+					continue;
+
+				SectorStatus& status = sectorStates[sector];
+				if (status.state == SECTOR_QUEUED)
+				{
+					// Back in range before the worker finished with it
+					status.cancelled = false;
+				}
+				else if (status.state == SECTOR_UNLOADED)
+				{
+					status.state = SECTOR_QUEUED;
+					status.cancelled = false;
+					status.commitCursor = 0;
+					activeSectors.push_back(sector);
+
+					boost::lock_guard<boost::mutex> lock(queueMutex);
+					requests.push_back(sector);
+					queued = true;
+				}
+			}
+		}
+	}
+
+	if (queued)
+		queueSignal.notify_one();
+}
+
+void WorldStreamer::WaitForLoads()
+{
+	boost::unique_lock<boost::mutex> lock(queueMutex);
+	while (!requests.empty() || working)
+		idleSignal.wait(lock);
+}
+
+void WorldStreamer::CollectFinishedLoads()
+{
+	std::vector<int> done;
+	{
+		boost::lock_guard<boost::mutex> lock(queueMutex);
+		if (finished.empty())
+			return;
+		done.swap(finished);
+	}
+
+	for (size_t i = 0; i < done.size(); i++)
+	{
+		SectorStatus& status = sectorStates[done[i]];
+		if (status.state != SECTOR_QUEUED)
+			continue;
+
+		if (status.cancelled)
+		{
+			status.state = SECTOR_UNLOADED;
+			for (size_t a = 0; a < activeSectors.size(); a++)
+			{
+				if (activeSectors[a] == done[i])
+				{
+					activeSectors.erase(activeSectors.begin() + a);
+					break;
+				}
+			}
+		}
+		else
+		{
+			status.state = SECTOR_COMMITTING;
+			status.commitCursor = 0;
+			committing.push_back(done[i]);
+		}
+	}
+}
+
+// Reads every record the sector's entities use, which pulls those pages
+// of the mapped file into memory before the main thread touches them
+void WorldStreamer::WorkerLoop()
+{
+	const SceneEntityRecord* entities = scene->GetEntities();
+	const SceneTransformRecord* transforms = scene->GetTransforms();
+	const SceneBodyRecord* bodies = scene->GetBodies();
+	const unsigned int* sectorEntities = scene->GetSectorEntities();
+
+	for (;;)
+	{
+		int sector;
+		{
+			boost::unique_lock<boost::mutex> lock(queueMutex);
+			while (requests.empty() && !stopping)
+				queueSignal.wait(lock);
+			if (stopping)
+				return;
+			sector = requests.front();
+			requests.pop_front();
+			working = true;
+		}
+
+		const SceneSectorRecord& record = scene->GetSectors()[sector];
+		unsigned int sum = 0;
+		for (unsigned int i = 0; i < record.entityCount; i++)
+		{
+			unsigned int entity = sectorEntities[record.firstEntity + i];
+			sum += entities[entity].mesh;
+			sum += *(const unsigned int*)&transforms[entity].position.x;
+			if (entities[entity].body != SCENE_NO_BODY)
+				sum += bodies[entities[entity].body].shape;
+		}
+
+		boost::lock_guard<boost::mutex> lock(queueMutex);
+		pageTouchSum += sum;
+		finished.push_back(sector);
+		working = false;
+		if (requests.empty())
+			idleSignal.notify_all();
+	}
+}
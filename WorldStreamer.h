@@ -0,0 +1,131 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <DirectXMath.h>
+#include "boost\thread.hpp"
+#include "SceneFile.h"
+
+// --------------------------------------------------------
+// Streams the sectors of a scene file in and out around
+// the camera.
+//
+// Every frame Update() works out which sectors are within
+// the load radius of the camera, or of where the camera
+// will be a little later at its current velocity, and
+// queues the missing ones.  A worker thread walks each
+// queued sector's records in the mapped file, so any page
+// faults happen off the main thread.
+//
+// The game creates the sector's objects itself, but only
+// a budgeted number of entities per frame through
+// CommitLoads(), so a burst of loads never stalls a frame.
+// Sectors beyond the unload radius are handed back through
+// CommitUnloads().  The gap between the two radii stops
+// sectors on the boundary from flickering in and out.
+// --------------------------------------------------------
+class WorldStreamer
+{
+public:
+	WorldStreamer(SceneFile* scene, float loadRadius, float unloadRadius, float prefetchTime);
+	~WorldStreamer();
+
+	// Picks the sectors to load and unload this frame
+	void Update(const DirectX::XMFLOAT3& cameraPosition, const DirectX::XMFLOAT3& cameraVelocity);
+
+	// Blocks until the worker has finished every sector queued so far, so
+	// the next CommitLoads() sees them.  Replays call this every frame to
+	// keep what spawns when from depending on thread timing.
+	void WaitForLoads();
+
+	// Calls spawn(sector, entity) for at most maxEntities entities of
+	// sectors the worker has finished with.  Returns how many it spawned.
+	template<typename F>
+	int CommitLoads(int maxEntities, F spawn)
+	{
+		CollectFinishedLoads();
+
+		int spawned = 0;
+		while (spawned < maxEntities && !committing.empty())
+		{
+			int sector = committing.front();
+			const SceneSectorRecord& record = scene->GetSectors()[sector];
+			const unsigned int* sectorEntities = scene->GetSectorEntities() + record.firstEntity;
+
+			unsigned int& cursor = sectorStates[sector].commitCursor;
+			while (spawned < maxEntities && cursor < record.entityCount)
+			{
+				spawn(sector, (int)sectorEntities[cursor++]);
+				spawned++;
+			}
+
+			if (cursor == record.entityCount)
+			{
+				sectorStates[sector].state = SECTOR_RESIDENT;
+				committing.pop_front();
+			}
+		}
+		return spawned;
+	}
+
+	// Calls unload(sector) for every sector that has gone out of range.
+	// Sectors can be part way through committing when they're dropped.
+	template<typename F>
+	void CommitUnloads(F unload)
+	{
+		for (size_t i = 0; i < unloading.size(); i++)
+			unload(unloading[i]);
+		unloading.clear();
+	}
+
+	bool IsSectorResident(int sector) { return sectorStates[sector].state == SECTOR_RESIDENT; }
+	int GetResidentCount();
+
+private:
+	enum SectorState
+	{
+		SECTOR_UNLOADED,
+		SECTOR_QUEUED,			// Waiting for or on the worker
+		SECTOR_COMMITTING,		// Worker done, entities going out a few a frame
+		SECTOR_RESIDENT
+	};
+
+	struct SectorStatus
+	{
+		SectorState state;
+		unsigned int commitCursor;
+		bool cancelled;			// Went out of range while the worker had it
+	};
+
+	// The cooker writes sectors sorted by x, then y, then z
+	int FindSector(int x, int y, int z);
+	float DistanceSqToSector(int sector, const DirectX::XMFLOAT3& point);
+	void RequestSectorsAround(const DirectX::XMFLOAT3& point);
+	void CollectFinishedLoads();
+	void WorkerLoop();
+
+	SceneFile* scene;
+	float loadRadius;
+	float unloadRadius;
+	float prefetchTime;
+	float sectorSize;
+
+	std::vector<SectorStatus> sectorStates;
+	std::deque<int> committing;
+	std::vector<int> unloading;
+
+	// Every sector that isn't unloaded, so Update() doesn't walk the world
+	std::vector<int> activeSectors;
+
+	// Shared with the worker
+	boost::mutex queueMutex;
+	boost::condition_variable queueSignal;
+	boost::condition_variable idleSignal;	// Worker ran out of requests
+	std::deque<int> requests;
+	std::vector<int> finished;
+	bool working;							// Worker has a sector out of requests
+	bool stopping;
+	boost::thread worker;
+
+	volatile unsigned int pageTouchSum;
+};